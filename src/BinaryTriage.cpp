@@ -0,0 +1,260 @@
+#include "BinaryTriage.h"
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <thread>
+#include "FFmpegUtils.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace llvm::object;
+using namespace std;
+
+// FFmpeg symbols of one binary, merged over the members of an archive
+struct BinaryUsage {
+    // FFmpeg libraries of DT_NEEDED
+    set<string> libraries;
+    // undefined FFmpeg symbol -> version, empty when unversioned
+    map<string, string> imports;
+    // relocations against each import
+    map<string, unsigned> relocations;
+    // FFmpeg functions defined in the binary
+    set<string> linked;
+    string error;
+};
+
+/**
+ * Whether a file is one of FFmpeg's own libraries, e.g. libavcodec.so.60, libavutil-58.so or libswscale.a
+ *
+ * Project binaries named after FFmpeg, such as obs-ffmpeg-mux, use the APIs and are read.
+ *
+ * @param filename
+ * @return
+ */
+static bool isFFmpegLibrary(StringRef filename) {
+    if (!filename.consume_front("lib")) return false;
+    const char *const libraries[] = {"avcodec", "avformat", "avutil", "avdevice", "avfilter", "swscale", "swresample",
+                                     "postproc"};
+    const bool known = any_of(begin(libraries), end(libraries),
+                              [&filename](const char *library) { return filename.consume_front(library); });
+    if (!known) return false;
+    // major version in the name, libavcodec-60.so
+    if (filename.consume_front("-")) {
+        const size_t digits = filename.find_first_not_of("0123456789");
+        if (digits == 0 || digits == StringRef::npos) return false;
+        filename = filename.drop_front(digits);
+    }
+    if (!filename.consume_front(".so") && !filename.consume_front(".a")) return false;
+    // version suffix of the shared library, libavcodec.so.60.31.102
+    return filename.find_first_not_of(".0123456789") == StringRef::npos;
+}
+
+static bool isBinary(const string &path) {
+    file_magic magic;
+    if (identify_magic(path, magic)) return false;
+    return magic == file_magic::elf_relocatable || magic == file_magic::elf_executable ||
+           magic == file_magic::elf_shared_object || magic == file_magic::archive;
+}
+
+template<class ELFT>
+static void readNeededLibraries(const ELFObjectFile<ELFT> &object, BinaryUsage &usage) {
+    const ELFFile<ELFT> &file = object.getELFFile();
+    auto entries = file.dynamicEntries();
+    if (!entries) {
+        consumeError(entries.takeError());
+        return;
+    }
+    uint64_t stringTable = 0;
+    vector<uint64_t> needed;
+    for (const auto &entry: *entries) {
+        if (entry.d_tag == ELF::DT_STRTAB) {
+            stringTable = entry.getPtr();
+        } else if (entry.d_tag == ELF::DT_NEEDED) {
+            needed.push_back(entry.getVal());
+        }
+    }
+    if (!stringTable || needed.empty()) return;
+    auto strings = file.toMappedAddr(stringTable);
+    if (!strings) {
+        consumeError(strings.takeError());
+        return;
+    }
+    const StringRef mapped(reinterpret_cast<const char *>(*strings),
+                           file.base() + file.getBufSize() - *strings);
+    for (const uint64_t offset: needed) {
+        if (offset >= mapped.size()) continue;
+        const StringRef library = mapped.drop_front(offset).take_until([](char c) { return c == '\0'; });
+        if (isFFmpegPath(library.str())) {
+            usage.libraries.insert(library.str());
+        }
+    }
+}
+
+static void classifySymbol(const ELFSymbolRef &symbol, const string &version, BinaryUsage &usage) {
+    Expected<StringRef> name = symbol.getName();
+    if (!name) {
+        consumeError(name.takeError());
+        return;
+    }
+    Expected<uint32_t> flags = symbol.getFlags();
+    if (!flags) {
+        consumeError(flags.takeError());
+        return;
+    }
+    // the static symbol table spells the version into the name, avcodec_open2@LIBAVCODEC_60
+    const auto [symbolName, suffix] = name->split('@');
+    const string symbolVersion = version.empty() ? suffix.ltrim('@').str() : version;
+    // the version of an import names its library
+    if (symbolName.empty() ||
+        (!isFFmpegSymbol(symbolName.str()) && (symbolVersion.empty() || !isFFmpegPath(symbolVersion)))) return;
+
+    if (*flags & SymbolRef::SF_Undefined) {
+        // the dynamic symbol table comes first and keeps its version
+        usage.imports.emplace(symbolName.str(), symbolVersion);
+    } else if (symbol.getELFType() == ELF::STT_FUNC) {
+        usage.linked.insert(symbolName.str());
+    }
+}
+
+static void readObject(const ObjectFile &object, BinaryUsage &usage) {
+    const auto *elf = dyn_cast<ELFObjectFileBase>(&object);
+    if (!elf) return;
+
+    if (const auto *file = dyn_cast<ELF64LEObjectFile>(elf)) {
+        readNeededLibraries(*file, usage);
+    } else if (const auto *file = dyn_cast<ELF32LEObjectFile>(elf)) {
+        readNeededLibraries(*file, usage);
+    } else if (const auto *file = dyn_cast<ELF64BEObjectFile>(elf)) {
+        readNeededLibraries(*file, usage);
+    } else if (const auto *file = dyn_cast<ELF32BEObjectFile>(elf)) {
+        readNeededLibraries(*file, usage);
+    }
+
+    vector<VersionEntry> versions;
+    if (auto read = elf->readDynsymVersions()) {
+        versions = std::move(*read);
+    } else {
+        consumeError(read.takeError());
+    }
+    size_t index = 0;
+    for (const ELFSymbolRef &symbol: elf->getDynamicSymbolIterators()) {
+        classifySymbol(symbol, index < versions.size() ? versions[index].Name : "", usage);
+        index++;
+    }
+    for (const ELFSymbolRef &symbol: elf->symbols()) {
+        classifySymbol(symbol, "", usage);
+    }
+
+    // only relocation sections have entries: .rela.plt and .rela.dyn, or .rela.text of objects
+    for (const SectionRef &section: elf->sections()) {
+        for (const RelocationRef &relocation: section.relocations()) {
+            const symbol_iterator symbol = relocation.getSymbol();
+            if (symbol == elf->symbol_end()) continue;
+            Expected<StringRef> name = symbol->getName();
+            if (!name) {
+                consumeError(name.takeError());
+                continue;
+            }
+            if (usage.imports.count(name->str())) {
+                usage.relocations[name->str()]++;
+            }
+        }
+    }
+}
+
+static void readBinary(const string &path, BinaryUsage &usage) {
+    Expected<OwningBinary<Binary>> binary = createBinary(path);
+    if (!binary) {
+        usage.error = toString(binary.takeError());
+        return;
+    }
+    if (const auto *archive = dyn_cast<Archive>(binary->getBinary())) {
+        Error err = Error::success();
+        for (const Archive::Child &child: archive->children(err)) {
+            Expected<unique_ptr<Binary>> member = child.getAsBinary();
+            if (!member) {
+                consumeError(member.takeError());
+                continue;
+            }
+            if (const auto *object = dyn_cast<ObjectFile>(member->get())) {
+                readObject(*object, usage);
+            }
+        }
+        if (err) {
+            usage.error = toString(std::move(err));
+        }
+    } else if (const auto *object = dyn_cast<ObjectFile>(binary->getBinary())) {
+        readObject(*object, usage);
+    }
+}
+
+BinaryTriage::BinaryTriage(unsigned threads) : threads(threads ? threads : max(1u, thread::hardware_concurrency())) {
+}
+
+nlohmann::json BinaryTriage::scan(const vector<string> &inputs) {
+    vector<string> candidates;
+    for (const string &input: inputs) {
+        if (!sys::fs::is_directory(input)) {
+            candidates.push_back(input);
+            continue;
+        }
+        error_code ec;
+        for (sys::fs::recursive_directory_iterator it(input, ec, false), end; it != end && !ec; it.increment(ec)) {
+            if (it->type() == sys::fs::file_type::regular_file) {
+                candidates.push_back(it->path());
+            }
+        }
+        if (ec) {
+            errs() << "Error: Could not read '" << input << "': " << ec.message() << "\n";
+        }
+    }
+
+    // the magic check reads every candidate, so it runs on the pool together with the parsing
+    vector<BinaryUsage> usages(candidates.size());
+    vector<char> read(candidates.size(), false);
+    atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < candidates.size(); i = next++) {
+            // FFmpeg's own libraries provide the APIs rather than use them
+            if (isFFmpegLibrary(sys::path::filename(candidates[i])) || !isBinary(candidates[i])) continue;
+            read[i] = true;
+            readBinary(candidates[i], usages[i]);
+        }
+    };
+    vector<thread> pool;
+    for (unsigned i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (thread &t: pool) {
+        t.join();
+    }
+
+    // llvm::json is visible through the object headers
+    nlohmann::json result = nlohmann::json::object();
+    scanned = 0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (!read[i]) continue;
+        scanned++;
+        const BinaryUsage &usage = usages[i];
+        if (!usage.error.empty()) {
+            errs() << "Error: Could not read '" << candidates[i] << "': " << usage.error << "\n";
+        }
+        if (usage.libraries.empty() && usage.imports.empty() && usage.linked.empty()) continue;
+
+        nlohmann::json imports = nlohmann::json::object();
+        for (const auto &[symbol, version]: usage.imports) {
+            auto relocations = usage.relocations.find(symbol);
+            imports[symbol] = {{"version", version},
+                               {"relocations", relocations == usage.relocations.end() ? 0u : relocations->second}};
+        }
+        result[candidates[i]] = {{"libraries", usage.libraries}, {"imports", imports}, {"linked", usage.linked}};
+    }
+    return result;
+}
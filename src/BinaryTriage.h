@@ -0,0 +1,44 @@
+#ifndef RUIANALYSIS_BINARYTRIAGE_H
+#define RUIANALYSIS_BINARYTRIAGE_H
+
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * Find the FFmpeg APIs used by build artifacts without compile commands or sources
+ *
+ * ELF executables, shared libraries, objects and static archives are read by a pool of threads. The
+ * dynamic and static symbol tables give the imported FFmpeg symbols (with the symbol version naming their
+ * library, e.g. LIBAVCODEC_60) and the statically linked ones; relocations against the imports approximate
+ * the number of call sites. FFmpeg's own libraries (libavcodec.so.60, libavutil.a, ...) are skipped.
+ */
+class BinaryTriage {
+public:
+    /**
+     * @param threads reader threads, 0 for one per core
+     */
+    explicit BinaryTriage(unsigned threads);
+
+    /**
+     * Read the ELF files and archives among the inputs and below the input directories
+     *
+     * @param inputs files or directories, symbolic links in directories are not followed
+     * @return {binary: {"libraries": [...], "imports": {symbol: {"version", "relocations"}}, "linked": [...]}}
+     *         for the binaries using FFmpeg
+     */
+    nlohmann::json scan(const std::vector<std::string> &inputs);
+
+    /**
+     * @return number of binaries read by the last scan
+     */
+    size_t scannedCount() const {
+        return scanned;
+    }
+
+private:
+    unsigned threads;
+    size_t scanned = 0;
+};
+
+#endif // RUIANALYSIS_BINARYTRIAGE_H
@@ -0,0 +1,128 @@
+#include "BitcodeAnalyser.h"
+
+#include <set>
+#include <vector>
+#include "FFmpegUtils.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+bool isBitcodeFile(const string &path) {
+    const StringRef extension = sys::path::extension(path);
+    return extension == ".bc" || extension == ".ll";
+}
+
+/**
+ * Absolute path of a debug info file
+ *
+ * @param file
+ * @return
+ */
+static string debugFilePath(const DIFile *file) {
+    if (!file) return "";
+    SmallString<256> path(file->getFilename());
+    if (!sys::path::is_absolute(path)) {
+        path = file->getDirectory();
+        sys::path::append(path, file->getFilename());
+    }
+    return string(path);
+}
+
+static bool isFFmpegFunction(StringRef symbol, const DISubprogram *subprogram) {
+    // declarations in a module carry no header path to check
+    if (isFFmpegSymbol(symbol.str())) return true;
+    return subprogram && isFFmpegPath(debugFilePath(subprogram->getFile()));
+}
+
+/**
+ * Name of a function as the source analysis reports it: Class::method or function
+ *
+ * @param F
+ * @return
+ */
+static string functionName(const Function &F) {
+    if (const DISubprogram *subprogram = F.getSubprogram()) {
+        const string name = subprogram->getName().str();
+        if (const auto *type = dyn_cast_or_null<DICompositeType>(subprogram->getScope())) {
+            return type->getName().str() + "::" + name;
+        }
+        return name;
+    }
+    // no debug info: demangled symbol without its parameter list
+    const string demangled = demangle(F.getName().str());
+    return demangled.substr(0, demangled.find('('));
+}
+
+bool analyseBitcodeFile(const string &path, json &ffmpegCalls, json &callGraph) {
+    LLVMContext context;
+    SMDiagnostic diagnostic;
+    unique_ptr<Module> module = parseIRFile(path, diagnostic, context);
+    if (!module) {
+        errs() << "Error: Could not read '" << path << "': " << diagnostic.getMessage() << "\n";
+        return false;
+    }
+
+    for (const Function &F: *module) {
+        if (F.isDeclaration()) continue;
+        const DISubprogram *subprogram = F.getSubprogram();
+        // FFmpeg inline helpers and system header code are not project functions
+        if (isFFmpegFunction(F.getName(), subprogram)) continue;
+        if (subprogram && StringRef(debugFilePath(subprogram->getFile())).starts_with("/usr/include/")) continue;
+
+        // functions are keyed by their translation unit, as in the source analysis
+        string file = module->getSourceFileName();
+        if (subprogram && subprogram->getUnit()) {
+            file = debugFilePath(subprogram->getUnit()->getFile());
+        }
+
+        vector<string> calls;
+        vector<string> apis;
+        set<const DISubprogram *> inlined;
+        for (const Instruction &I: instructions(F)) {
+            // every inlined-at level above the function itself is an inlined call
+            for (const DILocation *location = I.getDebugLoc().get(); location && location->getInlinedAt();
+                 location = location->getInlinedAt()) {
+                const DISubprogram *callee = location->getScope()->getSubprogram();
+                if (callee && inlined.insert(callee).second && isFFmpegFunction(callee->getName(), callee)) {
+                    calls.push_back(callee->getName().str());
+                    apis.push_back(callee->getName().str());
+                }
+            }
+
+            const auto *call = dyn_cast<CallBase>(&I);
+            if (!call) continue;
+            const auto *callee = dyn_cast<Function>(call->getCalledOperand()->stripPointerCastsAndAliases());
+            if (!callee || callee->isIntrinsic()) continue;
+
+            if (isFFmpegFunction(callee->getName(), callee->getSubprogram())) {
+                calls.push_back(callee->getName().str());
+                apis.push_back(callee->getName().str());
+            } else {
+                calls.push_back(functionName(*callee));
+            }
+        }
+
+        const string fileKey = toDisplayPath(file);
+        const string function = functionName(F);
+        if (!apis.empty()) {
+            ffmpegCalls[fileKey][function] = apis;
+        }
+        if (!calls.empty()) {
+            callGraph[fileKey][function] = calls;
+        }
+    }
+    return true;
+}
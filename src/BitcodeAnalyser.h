@@ -0,0 +1,30 @@
+#ifndef RUIANALYSIS_BITCODEANALYSER_H
+#define RUIANALYSIS_BITCODEANALYSER_H
+
+#include <string>
+#include <nlohmann/json.hpp>
+
+/**
+ * Check if an input is LLVM bitcode (.bc) or textual IR (.ll) rather than source
+ *
+ * @param path
+ * @return
+ */
+bool isBitcodeFile(const std::string &path);
+
+/**
+ * Read the FFmpeg calls of an LLVM module instead of parsing source
+ *
+ * The call instructions of every defined function are scanned, so calls that only exist after
+ * optimisation are included: FFmpeg inline helpers are found through the inlined-at chain of the debug
+ * locations, and devirtualised and macro-expanded calls are plain calls. Files and function names come
+ * from the debug info when the module has it, otherwise from the module and the demangled symbols.
+ *
+ * @param path
+ * @param ffmpegCalls receives {file: {function: [api, ...]}} like the source analysis
+ * @param callGraph receives {file: {function: [callee, ...]}}
+ * @return false if the module cannot be read
+ */
+bool analyseBitcodeFile(const std::string &path, nlohmann::json &ffmpegCalls, nlohmann::json &callGraph);
+
+#endif // RUIANALYSIS_BITCODEANALYSER_H
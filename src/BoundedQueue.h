@@ -0,0 +1,70 @@
+#ifndef RUIANALYSIS_BOUNDEDQUEUE_H
+#define RUIANALYSIS_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * Queue between pipeline stages, a producer waits while it is full so that a slow stage holds back the one
+ * feeding it instead of buffering its whole output
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1) {
+    }
+
+    /**
+     * Add an item, waiting for room
+     *
+     * @param item
+     * @return false if the queue was closed
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> guard(mutex);
+        notFull.wait(guard, [this]() { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * Take the oldest item, waiting for one
+     *
+     * @param item
+     * @return false once the queue is closed and drained
+     */
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> guard(mutex);
+        notEmpty.wait(guard, [this]() { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * End the input, items already queued are still taken
+     */
+    void close() {
+        std::lock_guard<std::mutex> guard(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> items;
+    bool closed = false;
+};
+
+#endif // RUIANALYSIS_BOUNDEDQUEUE_H
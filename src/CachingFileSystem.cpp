@@ -0,0 +1,175 @@
+#include "CachingFileSystem.h"
+
+#include <mutex>
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Path.h"
+
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+void FileSystemCache::clear() {
+    unique_lock<shared_mutex> guard(mutex);
+    stats.clear();
+    files.clear();
+    directories.clear();
+}
+
+json FileSystemCache::report() const {
+    auto counts = [](const Counter &counter) {
+        return json{{"hits", counter.hits.load()}, {"misses", counter.misses.load()}};
+    };
+    return {{"stat", counts(statCounter)}, {"open", counts(openCounter)}, {"directory", counts(directoryCounter)}};
+}
+
+/**
+ * A cached file, its buffer is shared with the cache
+ */
+class CachedFile : public vfs::File {
+    vfs::Status fileStatus;
+    shared_ptr<MemoryBuffer> buffer;
+
+public:
+    CachedFile(vfs::Status status, shared_ptr<MemoryBuffer> buffer)
+        : fileStatus(std::move(status)), buffer(std::move(buffer)) {
+    }
+
+    ErrorOr<vfs::Status> status() override {
+        return fileStatus;
+    }
+
+    ErrorOr<unique_ptr<MemoryBuffer>> getBuffer(const Twine &name, int64_t fileSize, bool requiresNullTerminator,
+                                                bool isVolatile) override {
+        return MemoryBuffer::getMemBuffer(buffer->getBuffer(), name.str(), requiresNullTerminator);
+    }
+
+    error_code close() override {
+        return {};
+    }
+};
+
+/**
+ * Iterator over a cached directory listing, entries are named after the directory as given
+ */
+class CachedDirectoryIterator : public vfs::detail::DirIterImpl {
+    string directory;
+    shared_ptr<const vector<FileSystemCache::Entry>> entries;
+    size_t next = 0;
+
+public:
+    CachedDirectoryIterator(string directory, shared_ptr<const vector<FileSystemCache::Entry>> entries)
+        : directory(std::move(directory)), entries(std::move(entries)) {
+        increment();
+    }
+
+    error_code increment() override {
+        if (next == entries->size()) {
+            CurrentEntry = vfs::directory_entry();
+            return {};
+        }
+        const FileSystemCache::Entry &entry = (*entries)[next++];
+        SmallString<256> path(directory);
+        sys::path::append(path, entry.name);
+        CurrentEntry = vfs::directory_entry(string(path), entry.type);
+        return {};
+    }
+};
+
+string CachingFileSystem::cacheKey(const Twine &path) {
+    SmallString<256> absolute;
+    path.toVector(absolute);
+    if (makeAbsolute(absolute)) return "";
+    sys::path::remove_dots(absolute);
+    return string(absolute);
+}
+
+ErrorOr<vfs::Status> CachingFileSystem::status(const Twine &path) {
+    const string key = cacheKey(path);
+    if (key.empty()) return ProxyFileSystem::status(path);
+    {
+        shared_lock<shared_mutex> guard(cache.mutex);
+        auto cached = cache.stats.find(key);
+        if (cached != cache.stats.end()) {
+            cache.statCounter.hits++;
+            if (!cached->second) return cached->second.getError();
+            // the physical file system names the status after the path as given
+            return vfs::Status::copyWithNewName(*cached->second, path);
+        }
+    }
+    cache.statCounter.misses++;
+    ErrorOr<vfs::Status> result = ProxyFileSystem::status(path);
+    unique_lock<shared_mutex> guard(cache.mutex);
+    cache.stats.try_emplace(key, result);
+    return result;
+}
+
+ErrorOr<unique_ptr<vfs::File>> CachingFileSystem::openFileForRead(const Twine &path) {
+    const string key = cacheKey(path);
+    if (key.empty()) return ProxyFileSystem::openFileForRead(path);
+    auto open = [&path](const FileSystemCache::Contents &contents) -> unique_ptr<vfs::File> {
+        return make_unique<CachedFile>(vfs::Status::copyWithNewName(contents.status, path), contents.buffer);
+    };
+    {
+        shared_lock<shared_mutex> guard(cache.mutex);
+        auto cached = cache.files.find(key);
+        if (cached != cache.files.end()) {
+            cache.openCounter.hits++;
+            if (!cached->second) return cached->second.getError();
+            return open(*cached->second);
+        }
+    }
+    cache.openCounter.misses++;
+
+    ErrorOr<FileSystemCache::Contents> contents = [&]() -> ErrorOr<FileSystemCache::Contents> {
+        auto file = ProxyFileSystem::openFileForRead(path);
+        if (!file) return file.getError();
+        auto fileStatus = (*file)->status();
+        if (!fileStatus) return fileStatus.getError();
+        // read once in full, large files are memory-mapped by the physical file system
+        auto buffer = (*file)->getBuffer(path, fileStatus->getSize(), true, false);
+        if (!buffer) return buffer.getError();
+        return FileSystemCache::Contents{*fileStatus, shared_ptr<MemoryBuffer>(std::move(*buffer))};
+    }();
+    unique_lock<shared_mutex> guard(cache.mutex);
+    // another worker may have read the file meanwhile, its buffer is kept
+    auto entry = cache.files.try_emplace(key, std::move(contents)).first;
+    if (!entry->second) return entry->second.getError();
+    return open(*entry->second);
+}
+
+vfs::directory_iterator CachingFileSystem::dir_begin(const Twine &dir, error_code &ec) {
+    const string key = cacheKey(dir);
+    if (key.empty()) return ProxyFileSystem::dir_begin(dir, ec);
+    using Listing = shared_ptr<const vector<FileSystemCache::Entry>>;
+    auto iterate = [&dir, &ec](const ErrorOr<Listing> &listing) {
+        if (!listing) {
+            ec = listing.getError();
+            return vfs::directory_iterator();
+        }
+        ec = {};
+        return vfs::directory_iterator(make_shared<CachedDirectoryIterator>(dir.str(), *listing));
+    };
+    {
+        shared_lock<shared_mutex> guard(cache.mutex);
+        auto cached = cache.directories.find(key);
+        if (cached != cache.directories.end()) {
+            cache.directoryCounter.hits++;
+            return iterate(cached->second);
+        }
+    }
+    cache.directoryCounter.misses++;
+
+    ErrorOr<Listing> listing = [&]() -> ErrorOr<Listing> {
+        error_code listError;
+        auto entries = make_shared<vector<FileSystemCache::Entry>>();
+        for (vfs::directory_iterator it = ProxyFileSystem::dir_begin(dir, listError), end;
+             !listError && it != end; it.increment(listError)) {
+            entries->push_back({sys::path::filename(it->path()).str(), it->type()});
+        }
+        if (listError) return listError;
+        return Listing(std::move(entries));
+    }();
+    unique_lock<shared_mutex> guard(cache.mutex);
+    auto entry = cache.directories.try_emplace(key, std::move(listing)).first;
+    return iterate(entry->second);
+}
@@ -0,0 +1,100 @@
+#ifndef RUIANALYSIS_CACHINGFILESYSTEM_H
+#define RUIANALYSIS_CACHINGFILESYSTEM_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+/**
+ * Stats, directory listings and file contents shared by the file systems of all parse workers
+ *
+ * Every translation unit looks up the same project, FFmpeg and system headers, and the header search probes
+ * the same missing paths in every include directory. Results are kept by absolute path for the whole run,
+ * failed lookups included, so each path is stat'ed and read once; files are assumed not to change while
+ * they are analysed. Lookups take a shared lock, only the first lookup of a path an exclusive one.
+ */
+class FileSystemCache {
+public:
+    /**
+     * Forget everything, e.g. before sources changed on disk are analysed again
+     */
+    void clear();
+
+    /**
+     * @return {"stat": {"hits": n, "misses": n}, "open": {...}, "directory": {...}}
+     */
+    nlohmann::json report() const;
+
+    struct Contents {
+        llvm::vfs::Status status;
+        // the buffer is null-terminated, views handed out can require it
+        std::shared_ptr<llvm::MemoryBuffer> buffer;
+    };
+
+    // member of a directory listing
+    struct Entry {
+        std::string name;
+        llvm::sys::fs::file_type type;
+    };
+
+private:
+    struct Counter {
+        std::atomic<size_t> hits{0};
+        std::atomic<size_t> misses{0};
+    };
+
+    mutable std::shared_mutex mutex;
+    llvm::StringMap<llvm::ErrorOr<llvm::vfs::Status>> stats;
+    llvm::StringMap<llvm::ErrorOr<Contents>> files;
+    llvm::StringMap<llvm::ErrorOr<std::shared_ptr<const std::vector<Entry>>>> directories;
+
+    Counter statCounter;
+    Counter openCounter;
+    Counter directoryCounter;
+
+    friend class CachingFileSystem;
+};
+
+/**
+ * File system of one parse worker answering from the shared cache
+ *
+ * Each worker keeps its own underlying file system and working directory, relative paths are made absolute
+ * before they are looked up.
+ */
+class CachingFileSystem : public llvm::vfs::ProxyFileSystem {
+public:
+    CachingFileSystem(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem, FileSystemCache &cache)
+        : ProxyFileSystem(std::move(fileSystem)), cache(cache) {
+    }
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &path) override;
+
+    bool exists(const llvm::Twine &path) override {
+        return bool(status(path));
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(const llvm::Twine &path) override;
+
+    llvm::vfs::directory_iterator dir_begin(const llvm::Twine &dir, std::error_code &ec) override;
+
+private:
+    FileSystemCache &cache;
+
+    /**
+     * Key of a path in the cache
+     *
+     * @param path
+     * @return empty if the path cannot be made absolute
+     */
+    std::string cacheKey(const llvm::Twine &path);
+};
+
+#endif // RUIANALYSIS_CACHINGFILESYSTEM_H
@@ -0,0 +1,160 @@
+#include "CallMapDiff.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <utility>
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+bool CallMapDiff::loadDenyList(const string &path) {
+    ifstream ifs(path);
+    if (!ifs) {
+        errs() << "Error: Could not read deny list '" << path << "'\n";
+        return false;
+    }
+    try {
+        json file = json::parse(ifs);
+        const json apisSection = file.value("apis", json::object());
+        for (const auto &[api, reason]: apisSection.items()) {
+            deniedApis[api] = reason.get<string>();
+        }
+        const json prefixesSection = file.value("prefixes", json::object());
+        for (const auto &[prefix, reason]: prefixesSection.items()) {
+            deniedPrefixes[prefix] = reason.get<string>();
+        }
+    } catch (const json::exception &e) {
+        errs() << "Error: Invalid deny list '" << path << "': " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+uint32_t CallMapDiff::intern(const string &name) {
+    auto [entry, inserted] = ids.emplace(name, names.size());
+    if (inserted) {
+        names.push_back(name);
+    }
+    return entry->second;
+}
+
+vector<CallMapDiff::Edge> CallMapDiff::collectEdges(const json &callMap) {
+    vector<Edge> edges;
+    for (const auto &[fileKey, functions]: callMap.items()) {
+        const uint32_t file = intern(fileKey);
+        for (const auto &[function, apis]: functions.items()) {
+            const uint32_t functionId = intern(function);
+            for (const auto &api: apis) {
+                edges.push_back({file, functionId, intern(api.get<string>())});
+            }
+        }
+    }
+    return edges;
+}
+
+const string *CallMapDiff::denyReason(const string &api) const {
+    auto exact = deniedApis.find(api);
+    if (exact != deniedApis.end()) return &exact->second;
+    // longest matching prefix
+    const string *reason = nullptr;
+    size_t matched = 0;
+    for (const auto &[prefix, prefixReason]: deniedPrefixes) {
+        if (prefix.size() > matched && api.compare(0, prefix.size(), prefix) == 0) {
+            reason = &prefixReason;
+            matched = prefix.size();
+        }
+    }
+    return reason;
+}
+
+json CallMapDiff::compare(const json &before, const json &after) {
+    names.clear();
+    ids.clear();
+    vector<Edge> oldEdges = collectEdges(before);
+    vector<Edge> newEdges = collectEdges(after);
+
+    // renumber the names in name order, the edge lists then sort like the names
+    vector<uint32_t> order(names.size());
+    iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return names[a] < names[b]; });
+    vector<uint32_t> rank(names.size());
+    vector<string> sortedNames(names.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        rank[order[i]] = i;
+        sortedNames[i] = std::move(names[order[i]]);
+    }
+    names = std::move(sortedNames);
+    ids.clear();
+    auto normalise = [&rank](vector<Edge> &edges) {
+        for (Edge &edge: edges) {
+            edge = {rank[edge.file], rank[edge.function], rank[edge.api]};
+        }
+        // a function calling an API several times has one edge
+        std::sort(edges.begin(), edges.end());
+        edges.erase(unique(edges.begin(), edges.end()), edges.end());
+    };
+    normalise(oldEdges);
+    normalise(newEdges);
+
+    // one pass over both sorted lists
+    auto difference = [](const auto &before, const auto &after, auto &&onRemoved, auto &&onAdded) {
+        auto oldIt = before.begin();
+        auto newIt = after.begin();
+        while (oldIt != before.end() || newIt != after.end()) {
+            if (newIt == after.end() || (oldIt != before.end() && *oldIt < *newIt)) {
+                onRemoved(*oldIt++);
+            } else if (oldIt == before.end() || *newIt < *oldIt) {
+                onAdded(*newIt++);
+            } else {
+                ++oldIt;
+                ++newIt;
+            }
+        }
+    };
+    auto changes = [](json &entry) -> json & {
+        if (entry.is_null()) {
+            entry = {{"added", json::array()}, {"removed", json::array()}};
+        }
+        return entry;
+    };
+
+    json functions = json::object();
+    json denied = json::array();
+    difference(
+        oldEdges, newEdges,
+        [&](const Edge &edge) {
+            changes(functions[names[edge.file]][names[edge.function]])["removed"].push_back(names[edge.api]);
+        },
+        [&](const Edge &edge) {
+            changes(functions[names[edge.file]][names[edge.function]])["added"].push_back(names[edge.api]);
+            if (const string *reason = denyReason(names[edge.api])) {
+                denied.push_back({{"file", names[edge.file]}, {"function", names[edge.function]},
+                                  {"api", names[edge.api]}, {"reason", *reason}});
+            }
+        });
+
+    // an API is added to a file when no function of the file called it before
+    auto fileEdges = [](const vector<Edge> &edges) {
+        vector<pair<uint32_t, uint32_t>> result;
+        for (const Edge &edge: edges) {
+            result.push_back({edge.file, edge.api});
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(unique(result.begin(), result.end()), result.end());
+        return result;
+    };
+    json files = json::object();
+    difference(
+        fileEdges(oldEdges), fileEdges(newEdges),
+        [&](const pair<uint32_t, uint32_t> &edge) {
+            changes(files[names[edge.first]])["removed"].push_back(names[edge.second]);
+        },
+        [&](const pair<uint32_t, uint32_t> &edge) {
+            changes(files[names[edge.first]])["added"].push_back(names[edge.second]);
+        });
+
+    return {{"functions", functions}, {"files", files}, {"denied", denied}};
+}
@@ -0,0 +1,71 @@
+#ifndef RUIANALYSIS_CALLMAPDIFF_H
+#define RUIANALYSIS_CALLMAPDIFF_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * Compare the FFmpeg call maps of two runs
+ *
+ * Both maps are flattened into (file, function, API) edges over one table of interned names, numbered in
+ * name order, so that sorting the edges orders them like the names and one linear pass over both sorted
+ * lists finds the added and removed edges, independent of the formatting and order of the files.
+ *
+ * A deny list file is a JSON object naming APIs which must not be newly called, with the reason:
+ * {"apis": {"avcodec_decode_video2": "deprecated"}, "prefixes": {"sws_scale": "use a filter graph"}}
+ */
+class CallMapDiff {
+public:
+    /**
+     * Merge a deny list file into the current entries
+     *
+     * @param path
+     * @return false if the file cannot be read or parsed
+     */
+    bool loadDenyList(const std::string &path);
+
+    /**
+     * Compare two call maps
+     *
+     * @param before {file: {function: [api, ...]}} as written to ffmpeg_calls.json
+     * @param after
+     * @return {"functions": {file: {function: {"added": [...], "removed": [...]}}},
+     *          "files": {file: {"added": [...], "removed": [...]}}, "denied": [{"file", "function", "api", "reason"}]}
+     */
+    nlohmann::json compare(const nlohmann::json &before, const nlohmann::json &after);
+
+private:
+    struct Edge {
+        uint32_t file;
+        uint32_t function;
+        uint32_t api;
+
+        bool operator<(const Edge &other) const {
+            if (file != other.file) return file < other.file;
+            if (function != other.function) return function < other.function;
+            return api < other.api;
+        }
+
+        bool operator==(const Edge &other) const {
+            return file == other.file && function == other.function && api == other.api;
+        }
+    };
+
+    std::map<std::string, std::string> deniedApis;
+    std::map<std::string, std::string> deniedPrefixes;
+
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> ids;
+
+    uint32_t intern(const std::string &name);
+
+    std::vector<Edge> collectEdges(const nlohmann::json &callMap);
+
+    const std::string *denyReason(const std::string &api) const;
+};
+
+#endif // RUIANALYSIS_CALLMAPDIFF_H
@@ -0,0 +1,67 @@
+#include "CallSites.h"
+
+#include "FFmpegUtils.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/AST/StmtCXX.h"
+
+using namespace clang;
+using namespace std;
+
+/**
+ * Visitor class: find function calls and the loops around them
+ */
+class LoopCallVisitor : public RecursiveASTVisitor<LoopCallVisitor> {
+    ASTContext &Context;
+    vector<CallSite> &callSites;
+    vector<const Stmt *> loops;
+
+public:
+    LoopCallVisitor(ASTContext &Context, vector<CallSite> &callSites) : Context(Context), callSites(callSites) {
+    }
+
+    bool TraverseForStmt(ForStmt *loop) {
+        loops.push_back(loop);
+        bool result = RecursiveASTVisitor::TraverseForStmt(loop);
+        loops.pop_back();
+        return result;
+    }
+
+    bool TraverseWhileStmt(WhileStmt *loop) {
+        loops.push_back(loop);
+        bool result = RecursiveASTVisitor::TraverseWhileStmt(loop);
+        loops.pop_back();
+        return result;
+    }
+
+    bool TraverseDoStmt(DoStmt *loop) {
+        loops.push_back(loop);
+        bool result = RecursiveASTVisitor::TraverseDoStmt(loop);
+        loops.pop_back();
+        return result;
+    }
+
+    bool TraverseCXXForRangeStmt(CXXForRangeStmt *loop) {
+        loops.push_back(loop);
+        bool result = RecursiveASTVisitor::TraverseCXXForRangeStmt(loop);
+        loops.pop_back();
+        return result;
+    }
+
+    bool VisitCallExpr(CallExpr *callExpr) {
+        const FunctionDecl *callee = callExpr->getDirectCallee();
+        if (!callee) return true;
+        callSites.push_back({getMethodFullName(callee), isFFmpegAPIDecl(callee, Context),
+                             static_cast<unsigned>(loops.size()), callExpr, loops.empty() ? nullptr : loops.back()});
+        return true;
+    }
+};
+
+vector<CallSite> collectCallSites(const FunctionDecl *func, ASTContext &Context) {
+    vector<CallSite> callSites;
+    Stmt *body = func->getBody();
+    if (!body) return callSites;
+
+    LoopCallVisitor visitor(Context, callSites);
+    visitor.TraverseStmt(body);
+    return callSites;
+}
@@ -0,0 +1,32 @@
+#ifndef RUIANALYSIS_CALLSITES_H
+#define RUIANALYSIS_CALLSITES_H
+
+#include <string>
+#include <vector>
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+
+/**
+ * Direct call inside a function body
+ */
+struct CallSite {
+    std::string callee;
+    bool ffmpeg;
+    // number of loops enclosing the call inside the caller
+    unsigned loopDepth;
+    const clang::CallExpr *expr;
+    // innermost loop around the call, null outside loops
+    const clang::Stmt *loop;
+};
+
+/**
+ * Collect the direct calls of a function with their loop nesting depth
+ *
+ * @param func
+ * @param Context
+ * @return
+ */
+std::vector<CallSite> collectCallSites(const clang::FunctionDecl *func, clang::ASTContext &Context);
+
+#endif // RUIANALYSIS_CALLSITES_H
@@ -0,0 +1,352 @@
+#include "CodecLatencyAudit.h"
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+#include "CallSites.h"
+#include "FFmpegUtils.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/StringRef.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+// AV_CODEC_FLAG_LOW_DELAY, a constant right-hand side is checked for its bit as printing expands the macro
+static constexpr uint64_t lowDelayFlag = 1u << 19;
+
+// AVCodecContext fields which decide how many frames a codec holds back
+static const set<string> latencyFields = {
+    "flags", "flags2", "max_b_frames", "thread_type", "thread_count", "gop_size",
+};
+
+/**
+ * Step of a codec setup or send/receive sequence inside a function, ordered by source location
+ */
+struct CodecEvent {
+    SourceLocation loc;
+    // call of an FFmpeg API, null for a field assignment
+    const CallSite *call;
+    // field assignment: codec context, field, assignment operator and right-hand side
+    string context;
+    string field;
+    string op;
+    string value;
+    // right-hand side if it is a constant
+    optional<uint64_t> bits;
+};
+
+/**
+ * Fields and options of a codec context, as set before an open
+ */
+struct CodecConfiguration {
+    // compound assignments are appended with their operator, "|= AV_CODEC_FLAG_LOW_DELAY"
+    map<string, string> values;
+    // AV_CODEC_FLAG_LOW_DELAY after the assignments and options so far
+    bool lowDelay = false;
+};
+
+/**
+ * Visitor class: find assignments to the latency fields of a codec context
+ */
+class CodecFieldVisitor : public RecursiveASTVisitor<CodecFieldVisitor> {
+    ASTContext &Context;
+    vector<CodecEvent> &events;
+
+public:
+    CodecFieldVisitor(ASTContext &Context, vector<CodecEvent> &events) : Context(Context), events(events) {
+    }
+
+    bool VisitBinaryOperator(BinaryOperator *assignment) {
+        if (!assignment->isAssignmentOp()) return true;
+        const auto *member = dyn_cast<MemberExpr>(assignment->getLHS()->IgnoreParenImpCasts());
+        if (!member) return true;
+        const string field = member->getMemberDecl()->getNameAsString();
+        if (!latencyFields.count(field)) return true;
+
+        QualType base = member->getBase()->getType();
+        if (member->isArrow() && base->isPointerType()) {
+            base = base->getPointeeType();
+        }
+        const RecordDecl *record = base->getAsRecordDecl();
+        if (!record || record->getName() != "AVCodecContext") return true;
+
+        optional<uint64_t> bits;
+        Expr::EvalResult result;
+        if (assignment->getRHS()->EvaluateAsInt(result, Context)) {
+            bits = result.Val.getInt().getZExtValue();
+        }
+        events.push_back({assignment->getBeginLoc(), nullptr, exprToString(member->getBase(), Context), field,
+                          assignment->getOpcodeStr().str(), exprToString(assignment->getRHS(), Context), bits});
+        return true;
+    }
+};
+
+/**
+ * Codec context an av_opt_set call tunes, options of the private data belong to the context
+ *
+ * @param arg
+ * @param Context
+ * @return
+ */
+static string optionTarget(const Expr *arg, const ASTContext &Context) {
+    const string text = objectToString(arg, Context);
+    StringRef target(text);
+    for (StringRef suffix: {"->priv_data", ".priv_data"}) {
+        if (target.ends_with(suffix)) {
+            return target.drop_back(suffix.size()).str();
+        }
+    }
+    return target.str();
+}
+
+/**
+ * Role of a codec opened with the given codec argument, from an avcodec_find_encoder/decoder call
+ * directly in the argument or in the initialiser of the variable passed
+ *
+ * @param codec
+ * @return "encoder", "decoder" or empty
+ */
+static string roleOfCodec(const Expr *codec) {
+    const Expr *expr = codec->IgnoreParenImpCasts();
+    if (const auto *ref = dyn_cast<DeclRefExpr>(expr)) {
+        const auto *var = dyn_cast<VarDecl>(ref->getDecl());
+        if (!var || !var->getInit()) return "";
+        expr = var->getInit()->IgnoreParenImpCasts();
+    }
+    const auto *call = dyn_cast<CallExpr>(expr);
+    const FunctionDecl *callee = call ? call->getDirectCallee() : nullptr;
+    if (!callee) return "";
+    const string name = callee->getNameAsString();
+    if (name.rfind("avcodec_find_encoder", 0) == 0) return "encoder";
+    if (name.rfind("avcodec_find_decoder", 0) == 0) return "decoder";
+    return "";
+}
+
+/**
+ * Whether a field or option was set to a value mentioning the text, fields use constants (FF_THREAD_SLICE),
+ * options their lowercase names ("slice")
+ */
+static bool contains(const map<string, string> &configuration, const string &key, StringRef text) {
+    auto entry = configuration.find(key);
+    return entry != configuration.end() && StringRef(entry->second).contains_insensitive(text);
+}
+
+/**
+ * Low-delay flag after an assignment to the flags field
+ *
+ * A constant value is applied bitwise. Otherwise "|=" sets the flag when the value mentions LOW_DELAY and
+ * "&= ~" clears it only then, so clearing other flags keeps it; "=" replaces all flags.
+ *
+ * @param lowDelay flag before the assignment
+ * @param op assignment operator
+ * @param value right-hand side
+ * @param bits right-hand side if it is a constant
+ * @return
+ */
+static bool assignLowDelay(bool lowDelay, StringRef op, StringRef value, optional<uint64_t> bits) {
+    if (bits) {
+        const bool set = *bits & lowDelayFlag;
+        if (op == "=") return set;
+        if (op == "|=") return lowDelay || set;
+        if (op == "&=") return lowDelay && set;
+        if (op == "^=") return lowDelay != set;
+        return lowDelay;
+    }
+    const bool mentioned = value.contains_insensitive("low_delay");
+    if (op == "=") return mentioned && !value.contains('~');
+    if (op == "|=") return lowDelay || mentioned;
+    if (op == "&=") return lowDelay && !(mentioned && value.contains('~'));
+    if (op == "^=") return mentioned ? !lowDelay : lowDelay;
+    return lowDelay;
+}
+
+/**
+ * Low-delay flag after setting the "flags" option, "+low_delay" and "-low_delay" change one flag, a value
+ * without a sign replaces all of them
+ *
+ * @param lowDelay flag before the option
+ * @param value
+ * @return
+ */
+static bool optionLowDelay(bool lowDelay, StringRef value) {
+    const size_t pos = value.find_insensitive("low_delay");
+    if (pos == StringRef::npos) return value.starts_with("+") || value.starts_with("-") ? lowDelay : false;
+    return pos == 0 || value[pos - 1] != '-';
+}
+
+/**
+ * Latency findings of the configuration a codec is opened with
+ *
+ * @param role
+ * @param codec fields and options set before the open
+ * @return
+ */
+static json configurationFindings(const string &role, const CodecConfiguration &codec) {
+    const map<string, string> &configuration = codec.values;
+    json findings = json::array();
+    if (!codec.lowDelay) {
+        findings.push_back("lowDelayFlagMissing");
+    }
+    if (role == "encoder") {
+        auto bFrames = configuration.find("max_b_frames");
+        if (bFrames == configuration.end()) {
+            bFrames = configuration.find("bf");
+        }
+        if (bFrames == configuration.end()) {
+            findings.push_back("defaultMaxBFrames");
+        } else if (bFrames->second != "0") {
+            findings.push_back("bFrames");
+        }
+    }
+    if (role == "decoder") {
+        // frame threads each hold a frame back, slice threading does not
+        auto threads = configuration.find("thread_count");
+        if (threads == configuration.end()) {
+            threads = configuration.find("threads");
+        }
+        const bool sliceThreads = contains(configuration, "thread_type", "slice")
+                                  && !contains(configuration, "thread_type", "frame");
+        if (threads != configuration.end() && threads->second != "1" && !sliceThreads) {
+            findings.push_back("frameThreading");
+        }
+    }
+    return findings;
+}
+
+void CodecLatencyAudit::analyseTranslationUnit(ASTContext &Context, const string &fileName) {
+    const SourceManager &SM = Context.getSourceManager();
+    const string fileKey = toDisplayPath(fileName);
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        // static functions of the same name in different files have their own USR, a header function only one
+        if (!audited.insert(getFunctionUSR(func)).second) continue;
+        const string name = getMethodFullName(func);
+
+        const vector<CallSite> callSites = collectCallSites(func, Context);
+        vector<CodecEvent> events;
+        // the calls a context is used with tell encoders from decoders
+        map<string, string> roles;
+        for (const CallSite &site: callSites) {
+            if (!site.ffmpeg) continue;
+            events.push_back({site.expr->getBeginLoc(), &site, "", "", "", "", nullopt});
+            if (site.expr->getNumArgs() < 1) continue;
+            if (site.callee == "avcodec_send_packet" || site.callee == "avcodec_receive_frame") {
+                roles[objectToString(site.expr->getArg(0), Context)] = "decoder";
+            } else if (site.callee == "avcodec_send_frame" || site.callee == "avcodec_receive_packet") {
+                roles[objectToString(site.expr->getArg(0), Context)] = "encoder";
+            }
+        }
+        if (events.empty()) continue;
+        CodecFieldVisitor(Context, events).TraverseStmt(func->getBody());
+        stable_sort(events.begin(), events.end(), [&](const CodecEvent &a, const CodecEvent &b) {
+            return SM.isBeforeInTranslationUnit(SM.getExpansionLoc(a.loc), SM.getExpansionLoc(b.loc));
+        });
+
+        // the configuration of a context as it is at each open, the options dictionary overrides fields
+        map<string, map<string, string>> dictionaries;
+        map<string, CodecConfiguration> configurations;
+        map<const CodecEvent *, CodecConfiguration> opened;
+        // receives per context in source order
+        map<string, vector<const CodecEvent *>> receives;
+        for (const CodecEvent &event: events) {
+            if (!event.call) {
+                CodecConfiguration &configuration = configurations[event.context];
+                string &value = configuration.values[event.field];
+                if (event.op == "=") {
+                    value = event.value;
+                } else {
+                    value += (value.empty() ? "" : " ") + event.op + " " + event.value;
+                }
+                if (event.field == "flags") {
+                    configuration.lowDelay = assignLowDelay(configuration.lowDelay, event.op, event.value,
+                                                             event.bits);
+                }
+                continue;
+            }
+            const CallExpr *call = event.call->expr;
+            const string &api = event.call->callee;
+            if (call->getNumArgs() < 1) continue;
+            const string context = objectToString(call->getArg(0), Context);
+            if (api == "avcodec_receive_frame" || api == "avcodec_receive_packet") {
+                receives[context].push_back(&event);
+            } else if (api == "avcodec_open2" && call->getNumArgs() >= 3) {
+                CodecConfiguration &configuration = opened[&event] = configurations[context];
+                if (!isNullArgument(call->getArg(2), Context)) {
+                    for (const auto &[option, value]: dictionaries[objectToString(call->getArg(2), Context)]) {
+                        configuration.values[option] = value;
+                        if (option == "flags") {
+                            configuration.lowDelay = optionLowDelay(configuration.lowDelay, value);
+                        }
+                    }
+                }
+            } else if ((api == "av_dict_set" || api == "av_dict_set_int") && call->getNumArgs() >= 3) {
+                if (const auto *key = dyn_cast<StringLiteral>(call->getArg(1)->IgnoreParenImpCasts())) {
+                    dictionaries[context][key->getString().str()] = argumentToString(call->getArg(2), Context);
+                }
+            } else if (api == "av_dict_free") {
+                dictionaries.erase(context);
+            } else if (api.rfind("av_opt_set", 0) == 0 && call->getNumArgs() >= 3) {
+                if (const auto *key = dyn_cast<StringLiteral>(call->getArg(1)->IgnoreParenImpCasts())) {
+                    CodecConfiguration &configuration = configurations[optionTarget(call->getArg(0), Context)];
+                    const string value = argumentToString(call->getArg(2), Context);
+                    configuration.values[key->getString().str()] = value;
+                    if (key->getString() == "flags") {
+                        configuration.lowDelay = optionLowDelay(configuration.lowDelay, value);
+                    }
+                }
+            }
+        }
+
+        json sites = json::array();
+        for (const CodecEvent &event: events) {
+            if (!event.call) continue;
+            const CallExpr *call = event.call->expr;
+            const string &api = event.call->callee;
+            const bool open = opened.count(&event) > 0;
+            const bool send = (api == "avcodec_send_packet" || api == "avcodec_send_frame") && call->getNumArgs() >= 2;
+            if (!open && !send) continue;
+
+            const string context = objectToString(call->getArg(0), Context);
+            json site = {{"api", api}};
+            site.update(describeLocation(call->getBeginLoc(), SM));
+            site["context"] = context;
+            site["loopDepth"] = event.call->loopDepth;
+            if (open) {
+                string role = roles.count(context) ? roles[context] : roleOfCodec(call->getArg(1));
+                site["role"] = role.empty() ? "unknown" : role;
+                site["configuration"] = opened[&event].values;
+                site["findings"] = configurationFindings(role, opened[&event]);
+            } else {
+                // a receive below the send drains every output, a receive-first loop drains before sending
+                const unsigned depth = event.call->loopDepth;
+                const CodecEvent *drain = nullptr;
+                const vector<const CodecEvent *> &contextReceives = receives[context];
+                for (const CodecEvent *receive: contextReceives) {
+                    const unsigned receiveDepth = receive->call->loopDepth;
+                    const bool after = SM.isBeforeInTranslationUnit(SM.getExpansionLoc(event.loc),
+                                                                    SM.getExpansionLoc(receive->loc));
+                    if ((after && receiveDepth > depth) || (!after && depth > 0 && receiveDepth == depth)) {
+                        drain = receive;
+                        break;
+                    }
+                }
+                json findings = json::array();
+                if (contextReceives.empty()) {
+                    findings.push_back("sendWithoutReceive");
+                } else if (!drain) {
+                    findings.push_back("receiveNotInLoop");
+                }
+                site["role"] = api == "avcodec_send_packet" ? "decoder" : "encoder";
+                site["flush"] = isNullArgument(call->getArg(1), Context);
+                site["receive"] = drain ? describeLocation(drain->loc, SM) : json();
+                site["findings"] = findings;
+            }
+            sites.push_back(site);
+        }
+        // overloads share the name
+        for (json &site: sites) {
+            results[fileKey][name].push_back(std::move(site));
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef RUIANALYSIS_CODECLATENCYAUDIT_H
+#define RUIANALYSIS_CODECLATENCYAUDIT_H
+
+#include <set>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+
+/**
+ * Audit encoder and decoder contexts for settings and call patterns that add latency
+ *
+ * Within every function, each codec context is followed by the text of its expression. At avcodec_open2
+ * the configuration set before it is checked: assignments to the context fields (flags, max_b_frames,
+ * thread_type, ...), av_opt_set tunings on the context or its private data and the options dictionary
+ * passed to the open. Every avcodec_send_packet/avcodec_send_frame is matched with the
+ * avcodec_receive_frame/avcodec_receive_packet of the same context; without a receive in a loop below the
+ * send, frames stay buffered in the codec until later sends.
+ */
+class CodecLatencyAudit {
+public:
+    void analyseTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Open and send call sites with their configuration and findings
+     *
+     * @return {file: {function: [{"api", "line", "column", "context", "role", "findings", ...}]}}
+     */
+    nlohmann::json report() const {
+        return results;
+    }
+
+private:
+    nlohmann::json results = nlohmann::json::object();
+    // USRs of the functions audited so far
+    std::set<std::string> audited;
+};
+
+#endif // RUIANALYSIS_CODECLATENCYAUDIT_H
@@ -0,0 +1,253 @@
+#include "CostModel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include "CallSites.h"
+#include "FFmpegUtils.h"
+#include "StronglyConnectedComponents.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+CostCatalog CostCatalog::defaults() {
+    CostCatalog catalog;
+    catalog.classes = {
+        {"codec", 1000}, {"scale", 300}, {"io", 100}, {"alloc", 10}, {"trivial", 1}, {"other", 5},
+    };
+    catalog.prefixes = {
+        {"sws_", "scale"}, {"swr_", "scale"}, {"avio_", "io"}, {"avfilter_graph_", "alloc"},
+        {"av_malloc", "alloc"}, {"av_dict_", "trivial"}, {"av_q2d", "trivial"}, {"av_rescale", "trivial"},
+        {"av_log", "trivial"},
+    };
+    catalog.apis = {
+        // encode/decode
+        {"avcodec_send_frame", "codec"}, {"avcodec_receive_packet", "codec"},
+        {"avcodec_send_packet", "codec"}, {"avcodec_receive_frame", "codec"},
+        {"avcodec_encode_video2", "codec"}, {"avcodec_decode_video2", "codec"},
+        {"avcodec_encode_audio2", "codec"}, {"avcodec_decode_audio4", "codec"},
+        {"avcodec_decode_subtitle2", "codec"}, {"avcodec_open2", "codec"},
+        {"avformat_find_stream_info", "codec"},
+        // scale/convert/filter
+        {"sws_getContext", "alloc"}, {"sws_getCachedContext", "alloc"}, {"sws_freeContext", "alloc"},
+        {"swr_alloc", "alloc"}, {"swr_alloc_set_opts", "alloc"}, {"swr_alloc_set_opts2", "alloc"},
+        {"swr_init", "alloc"}, {"swr_free", "alloc"},
+        {"av_buffersrc_add_frame", "scale"}, {"av_buffersrc_add_frame_flags", "scale"},
+        {"av_buffersink_get_frame", "scale"}, {"av_image_copy", "scale"}, {"av_frame_copy", "scale"},
+        // I/O
+        {"avformat_open_input", "io"}, {"avformat_close_input", "io"}, {"av_read_frame", "io"},
+        {"av_seek_frame", "io"}, {"avformat_seek_file", "io"}, {"avformat_write_header", "io"},
+        {"av_write_frame", "io"}, {"av_interleaved_write_frame", "io"}, {"av_write_trailer", "io"},
+        // allocation
+        {"av_mallocz", "alloc"}, {"av_calloc", "alloc"}, {"av_realloc", "alloc"}, {"av_free", "alloc"},
+        {"av_freep", "alloc"}, {"av_strdup", "alloc"}, {"av_frame_alloc", "alloc"}, {"av_frame_free", "alloc"},
+        {"av_frame_get_buffer", "alloc"}, {"av_frame_ref", "alloc"}, {"av_frame_unref", "alloc"},
+        {"av_frame_clone", "alloc"}, {"av_packet_alloc", "alloc"}, {"av_packet_free", "alloc"},
+        {"av_packet_ref", "alloc"}, {"av_packet_unref", "alloc"}, {"av_packet_clone", "alloc"},
+        {"av_new_packet", "alloc"}, {"av_image_alloc", "alloc"}, {"avcodec_alloc_context3", "alloc"},
+        {"avcodec_free_context", "alloc"}, {"avcodec_parameters_alloc", "alloc"},
+        {"avcodec_parameters_free", "alloc"}, {"avcodec_parameters_copy", "alloc"},
+        {"avcodec_parameters_from_context", "alloc"}, {"avcodec_parameters_to_context", "alloc"},
+        {"avformat_alloc_context", "alloc"}, {"avformat_alloc_output_context2", "alloc"},
+        {"avformat_free_context", "alloc"}, {"avformat_new_stream", "alloc"},
+        // trivial accessors
+        {"av_make_q", "trivial"}, {"av_inv_q", "trivial"}, {"av_cmp_q", "trivial"},
+        {"av_compare_ts", "trivial"}, {"av_strerror", "trivial"}, {"av_get_pix_fmt_name", "trivial"},
+        {"av_get_sample_fmt_name", "trivial"}, {"av_get_bytes_per_sample", "trivial"},
+        {"avcodec_get_name", "trivial"}, {"avcodec_find_encoder", "trivial"},
+        {"avcodec_find_encoder_by_name", "trivial"}, {"avcodec_find_decoder", "trivial"},
+        {"av_guess_format", "trivial"}, {"av_packet_rescale_ts", "trivial"},
+    };
+    return catalog;
+}
+
+bool CostCatalog::load(const string &path) {
+    ifstream ifs(path);
+    if (!ifs) {
+        errs() << "Error: Could not read cost catalog '" << path << "'\n";
+        return false;
+    }
+    try {
+        json file = json::parse(ifs);
+        if (file.contains("loopWeight")) {
+            loopWeight = file["loopWeight"].get<double>();
+        }
+        if (file.contains("maxLoopDepth")) {
+            maxLoopDepth = file["maxLoopDepth"].get<unsigned>();
+        }
+        const json classesSection = file.value("classes", json::object());
+        for (const auto &[name, cost]: classesSection.items()) {
+            classes[name] = cost.get<double>();
+        }
+        const json apisSection = file.value("apis", json::object());
+        for (const auto &[api, costClass]: apisSection.items()) {
+            apis[api] = costClass.get<string>();
+        }
+        const json prefixesSection = file.value("prefixes", json::object());
+        for (const auto &[prefix, costClass]: prefixesSection.items()) {
+            prefixes[prefix] = costClass.get<string>();
+        }
+    } catch (const json::exception &e) {
+        errs() << "Error: Invalid cost catalog '" << path << "': " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+optional<string> CostCatalog::classify(const string &api, bool ffmpeg) const {
+    auto exact = apis.find(api);
+    if (exact != apis.end()) return exact->second;
+
+    const string *best = nullptr;
+    size_t bestLength = 0;
+    for (const auto &[prefix, costClass]: prefixes) {
+        if (prefix.size() > bestLength && api.rfind(prefix, 0) == 0) {
+            best = &costClass;
+            bestLength = prefix.size();
+        }
+    }
+    if (best) return *best;
+    if (ffmpeg) return string("other");
+    return nullopt;
+}
+
+double CostCatalog::classCost(const string &costClass) const {
+    auto it = classes.find(costClass);
+    return it == classes.end() ? 0 : it->second;
+}
+
+void CostModel::analyseTranslationUnit(ASTContext &Context, const string &fileName) {
+    const string fileKey = toDisplayPath(fileName);
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        // an inline function defined in a header has the same USR in every translation unit including it
+        auto [inserted, added] = functions.try_emplace(getFunctionUSR(func));
+        if (!added) continue;
+
+        FunctionCalls &entry = inserted->second;
+        entry.name = getMethodFullName(func);
+        entry.fileKey = fileKey;
+        if (const json *cached = cache ? cache->lookup(func, fileKey, "cost") : nullptr) {
+            for (const auto &call: *cached) {
+                const string callee = call.at("callee").get<string>();
+                entry.calls.push_back({callee, call.value("usr", callee), call.at("ffmpeg").get<bool>(),
+                                       call.at("loopDepth").get<unsigned>()});
+            }
+            continue;
+        }
+        json calls = json::array();
+        for (const CallSite &site: collectCallSites(func, Context)) {
+            const string calleeUSR = getFunctionUSR(site.expr->getDirectCallee());
+            entry.calls.push_back({site.callee, calleeUSR, site.ffmpeg, site.loopDepth});
+            calls.push_back({{"callee", site.callee}, {"usr", calleeUSR}, {"ffmpeg", site.ffmpeg},
+                             {"loopDepth", site.loopDepth}});
+        }
+        if (cache) {
+            cache->store(func, fileKey, "cost", std::move(calls));
+        }
+    }
+}
+
+double CostModel::loopFactor(unsigned loopDepth) const {
+    return pow(catalog.loopWeight, min(loopDepth, catalog.maxLoopDepth));
+}
+
+map<string, CostModel::Breakdown> CostModel::inclusiveCosts() const {
+    vector<const FunctionCalls *> nodes;
+    vector<string> usrs;
+    map<string, size_t> nodeIndex;
+    for (const auto &[usr, function]: functions) {
+        nodeIndex[usr] = nodes.size();
+        nodes.push_back(&function);
+        usrs.push_back(usr);
+    }
+    vector<vector<size_t>> edges(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (const WeightedCall &call: nodes[i]->calls) {
+            auto target = nodeIndex.find(call.calleeUSR);
+            if (target != nodeIndex.end()) {
+                edges[i].push_back(target->second);
+            }
+        }
+    }
+    const StronglyConnectedComponents scc = stronglyConnectedComponents(edges);
+
+    // Project functions propagate their own cost, recursion within a component contributes nothing further
+    vector<Breakdown> componentCosts(scc.members.size());
+    for (size_t c = 0; c < scc.members.size(); ++c) {
+        Breakdown &breakdown = componentCosts[c];
+        for (const size_t member: scc.members[c]) {
+            for (const WeightedCall &call: nodes[member]->calls) {
+                const double factor = loopFactor(call.loopDepth);
+                auto target = nodeIndex.find(call.calleeUSR);
+                if (target != nodeIndex.end()) {
+                    if (scc.component[target->second] == c) continue;
+                    for (const auto &[costClass, cost]: componentCosts[scc.component[target->second]]) {
+                        breakdown[costClass] += cost * factor;
+                    }
+                    continue;
+                }
+                if (optional<string> costClass = catalog.classify(call.callee, call.ffmpeg)) {
+                    breakdown[*costClass] += catalog.classCost(*costClass) * factor;
+                }
+            }
+        }
+    }
+
+    map<string, Breakdown> result;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        result[usrs[i]] = componentCosts[scc.component[i]];
+    }
+    return result;
+}
+
+json CostModel::report() const {
+    const map<string, Breakdown> inclusiveCost = inclusiveCosts();
+    map<string, double> fileCosts;
+    json rankedFunctions = json::array();
+
+    for (const auto &[usr, entry]: functions) {
+        const Breakdown &inclusive = inclusiveCost.at(usr);
+        double cost = 0;
+        for (const auto &[costClass, classCost]: inclusive) {
+            cost += classCost;
+        }
+        double selfCost = 0;
+        for (const WeightedCall &call: entry.calls) {
+            if (functions.count(call.calleeUSR)) continue;
+            if (optional<string> costClass = catalog.classify(call.callee, call.ffmpeg)) {
+                selfCost += catalog.classCost(*costClass) * loopFactor(call.loopDepth);
+            }
+        }
+        if (cost == 0) continue;
+
+        fileCosts[entry.fileKey] += selfCost;
+        rankedFunctions.push_back({
+            {"file", entry.fileKey}, {"function", entry.name}, {"cost", cost}, {"selfCost", selfCost},
+            {"classes", inclusive}
+        });
+    }
+
+    sort(rankedFunctions.begin(), rankedFunctions.end(), [](const json &a, const json &b) {
+        if (a["cost"] != b["cost"]) return a["cost"].get<double>() > b["cost"].get<double>();
+        if (a["function"] != b["function"]) return a["function"].get<string>() < b["function"].get<string>();
+        return a["file"].get<string>() < b["file"].get<string>();
+    });
+
+    json rankedFiles = json::array();
+    for (const auto &[file, cost]: fileCosts) {
+        rankedFiles.push_back({{"file", file}, {"selfCost", cost}});
+    }
+    stable_sort(rankedFiles.begin(), rankedFiles.end(), [](const json &a, const json &b) {
+        return a["selfCost"].get<double>() > b["selfCost"].get<double>();
+    });
+
+    for (const auto &function: rankedFunctions) {
+        outs() << llvm::format("%.1f", function["cost"].get<double>()) << "\t"
+                << function["file"].get<string>() << " " << function["function"].get<string>() << "\n";
+    }
+    return json{{"functions", rankedFunctions}, {"files", rankedFiles}};
+}
@@ -0,0 +1,114 @@
+#ifndef RUIANALYSIS_COSTMODEL_H
+#define RUIANALYSIS_COSTMODEL_H
+
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+#include "FunctionCache.h"
+
+/**
+ * Cost classes of FFmpeg APIs
+ *
+ * A catalog file is a JSON object which extends the built-in entries:
+ * {"loopWeight": 10, "classes": {"codec": 1000}, "apis": {"avcodec_send_frame": "codec"}, "prefixes": {"sws_": "scale"}}
+ */
+class CostCatalog {
+public:
+    // a call inside a loop counts this many times per nesting level
+    double loopWeight = 10;
+    // deeper loop nests are not weighted further
+    unsigned maxLoopDepth = 3;
+
+    static CostCatalog defaults();
+
+    /**
+     * Merge a catalog file into the current entries
+     *
+     * @param path
+     * @return false if the file cannot be read or parsed
+     */
+    bool load(const std::string &path);
+
+    /**
+     * Cost class of an API, exact names take precedence over the longest matching prefix
+     *
+     * @param api
+     * @param ffmpeg whether the callee was recognised as an FFmpeg API
+     * @return nothing for project functions
+     */
+    std::optional<std::string> classify(const std::string &api, bool ffmpeg) const;
+
+    double classCost(const std::string &costClass) const;
+
+private:
+    std::map<std::string, double> classes;
+    std::map<std::string, std::string> apis;
+    std::map<std::string, std::string> prefixes;
+};
+
+/**
+ * Estimate the relative media-processing cost of every project function
+ *
+ * Each FFmpeg call contributes the cost of its class, multiplied per enclosing loop. Calls to project
+ * functions contribute the callee's inclusive cost, so the weight of helpers propagates to their callers.
+ * The functions of a recursive cycle share the cost of the whole cycle, counted once.
+ */
+class CostModel {
+public:
+    explicit CostModel(CostCatalog catalog) : catalog(std::move(catalog)) {
+    }
+
+    /**
+     * Reuse the call sites of unchanged functions
+     *
+     * @param functionCache
+     */
+    void useCache(FunctionCache *functionCache) {
+        cache = functionCache;
+    }
+
+    void analyseTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Rank functions and files by estimated cost
+     *
+     * @return {"functions": [...], "files": [...]}
+     */
+    nlohmann::json report() const;
+
+private:
+    using Breakdown = std::map<std::string, double>;
+
+    struct WeightedCall {
+        std::string callee;
+        // USR, which identifies project callees
+        std::string calleeUSR;
+        bool ffmpeg;
+        unsigned loopDepth;
+    };
+
+    struct FunctionCalls {
+        std::string name;
+        std::string fileKey;
+        std::vector<WeightedCall> calls;
+    };
+
+    CostCatalog catalog;
+    // keyed by USR, static functions of the same name in different files are distinct
+    std::map<std::string, FunctionCalls> functions;
+    FunctionCache *cache = nullptr;
+
+    double loopFactor(unsigned loopDepth) const;
+
+    /**
+     * Inclusive cost of every function, bottom-up over the strongly connected components of the call graph
+     *
+     * @return USR -> cost per class
+     */
+    std::map<std::string, Breakdown> inclusiveCosts() const;
+};
+
+#endif // RUIANALYSIS_COSTMODEL_H
@@ -0,0 +1,156 @@
+#include "DemandDriver.h"
+
+#include <algorithm>
+#include "CallSites.h"
+#include "FFmpegUtils.h"
+
+using namespace clang;
+using namespace std;
+using json = nlohmann::json;
+
+DemandDriver::DemandDriver(const SymbolIndex &index, const vector<string> &entries)
+    : index(index), entries(entries) {
+    for (const string &entry: entries) {
+        const vector<string> usrs = index.functionUSRs(entry);
+        if (usrs.empty()) {
+            // no USR to follow, reported under its name
+            unresolved.insert(entry);
+            names[entry] = entry;
+        }
+        for (const string &usr: usrs) {
+            names[usr] = entry;
+            require(usr);
+        }
+    }
+}
+
+void DemandDriver::require(const string &usr) {
+    if (!reachable.insert(usr).second) return;
+    auto definition = defined.find(usr);
+    if (definition == defined.end()) {
+        locate(usr);
+        return;
+    }
+    for (const string &callee: definition->second.callees) {
+        require(callee);
+    }
+}
+
+void DemandDriver::locate(const string &usr) {
+    // a translation unit already queued may define it, otherwise the first one not tried yet
+    const vector<string> files = index.definingFiles(usr);
+    for (const string &file: files) {
+        if (queued.count(file) && !parsed.count(file)) {
+            awaiting[usr] = file;
+            return;
+        }
+    }
+    for (const string &file: files) {
+        if (queued.insert(file).second) {
+            awaiting[usr] = file;
+            pending.push_back(file);
+            return;
+        }
+    }
+    // not in the index, or every translation unit listed no longer defines it
+    awaiting.erase(usr);
+    unresolved.insert(usr);
+}
+
+bool DemandDriver::next(string &file) {
+    unique_lock<std::mutex> guard(mutex);
+    wake.wait(guard, [this]() { return !pending.empty() || inFlight.empty(); });
+    if (pending.empty()) return false;
+    file = pending.front();
+    pending.pop_front();
+    inFlight.insert(file);
+    return true;
+}
+
+void DemandDriver::addTranslationUnit(ASTContext &Context, const string &fileName) {
+    const SourceManager &SM = Context.getSourceManager();
+    const string fileKey = toDisplayPath(fileName);
+    map<string, FunctionCalls> functions;
+    // USR -> name of the callees
+    map<string, string> calleeNames;
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        FunctionCalls &entry = functions[getFunctionUSR(func)];
+        entry.name = getMethodFullName(func);
+        entry.fileKey = fileKey;
+        for (const CallSite &site: collectCallSites(func, Context)) {
+            const FunctionDecl *callee = site.expr->getDirectCallee();
+            if (site.ffmpeg) {
+                if (std::find(entry.ffmpegCalls.begin(), entry.ffmpegCalls.end(), site.callee) ==
+                    entry.ffmpegCalls.end()) {
+                    entry.ffmpegCalls.push_back(site.callee);
+                }
+                continue;
+            }
+            if (SM.isInSystemHeader(callee->getLocation())) continue;
+            const string usr = getFunctionUSR(callee);
+            if (std::find(entry.callees.begin(), entry.callees.end(), usr) == entry.callees.end()) {
+                entry.callees.push_back(usr);
+                calleeNames.emplace(usr, site.callee);
+            }
+        }
+    }
+
+    lock_guard<std::mutex> guard(mutex);
+    names.insert(calleeNames.begin(), calleeNames.end());
+    for (auto &[usr, calls]: functions) {
+        if (!defined.emplace(usr, std::move(calls)).second) continue;
+        awaiting.erase(usr);
+        if (!reachable.count(usr)) continue;
+        for (const string &callee: defined[usr].callees) {
+            require(callee);
+        }
+    }
+    wake.notify_all();
+}
+
+void DemandDriver::finished(const string &file) {
+    lock_guard<std::mutex> guard(mutex);
+    if (!inFlight.erase(file)) return;
+    parsed.insert(file);
+    // functions the index placed in this file which it did not define, e.g. after an edit or a failed parse
+    vector<string> missing;
+    for (const auto &[usr, awaited]: awaiting) {
+        if (awaited == file) missing.push_back(usr);
+    }
+    for (const string &usr: missing) {
+        locate(usr);
+    }
+    wake.notify_all();
+}
+
+json DemandDriver::report() const {
+    lock_guard<std::mutex> guard(mutex);
+    json functions = json::object();
+    for (const string &usr: reachable) {
+        auto definition = defined.find(usr);
+        if (definition == defined.end()) continue;
+        // overloads share the name
+        json &calls = functions[definition->second.fileKey][definition->second.name];
+        if (calls.is_null()) {
+            calls = json::array();
+        }
+        for (const string &api: definition->second.ffmpegCalls) {
+            if (std::find(calls.begin(), calls.end(), api) == calls.end()) {
+                calls.push_back(api);
+            }
+        }
+    }
+    set<string> unresolvedNames;
+    for (const string &usr: unresolved) {
+        unresolvedNames.insert(names.at(usr));
+    }
+    return {{"entries", entries},
+            {"translationUnits", parsed},
+            {"functions", functions},
+            {"unresolved", unresolvedNames}};
+}
+
+size_t DemandDriver::parsedCount() const {
+    lock_guard<std::mutex> guard(mutex);
+    return parsed.size();
+}
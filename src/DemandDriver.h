@@ -0,0 +1,100 @@
+#ifndef RUIANALYSIS_DEMANDDRIVER_H
+#define RUIANALYSIS_DEMANDDRIVER_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+#include "SymbolIndex.h"
+
+/**
+ * Choose the translation units to parse from the functions reachable from a few entry functions
+ *
+ * Functions are followed by USR, so a static function is not taken for another of the same name; the entry
+ * names are mapped to USRs once through the symbol index, and every function of such a name is an entry.
+ * The worklist starts with the translation units the symbol index lists for the entries. Every parsed
+ * translation unit adds the callees of its reachable functions; a callee defined in a translation unit
+ * already parsed is followed at once, one defined elsewhere queues a translation unit defining it. The
+ * scheduler takes files from the worklist while others are still parsed, and the run ends when the
+ * worklist is empty and no file is in flight. Calls through function pointers are not followed.
+ */
+class DemandDriver {
+public:
+    /**
+     * @param index updated by the parse workers while it is consulted
+     * @param entries names of the entry functions as in the call map
+     */
+    DemandDriver(const SymbolIndex &index, const std::vector<std::string> &entries);
+
+    /**
+     * Wait for the next translation unit to parse
+     *
+     * @param file
+     * @return false when all reachable functions are known
+     */
+    bool next(std::string &file);
+
+    /**
+     * Add the calls of the functions defined by a parsed translation unit, may be called from any worker
+     *
+     * @param Context
+     * @param fileName
+     */
+    void addTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Mark a translation unit taken from next() as done, whether or not it was parsed
+     *
+     * @param file
+     */
+    void finished(const std::string &file);
+
+    /**
+     * Reachable functions with their FFmpeg calls, the parsed translation units and the callees no
+     * translation unit defines
+     *
+     * @return {"entries", "translationUnits", "functions": {file: {function: [api]}}, "unresolved"}
+     */
+    nlohmann::json report() const;
+
+    size_t parsedCount() const;
+
+private:
+    struct FunctionCalls {
+        std::string name;
+        std::string fileKey;
+        // USRs
+        std::vector<std::string> callees;
+        std::vector<std::string> ffmpegCalls;
+    };
+
+    const SymbolIndex &index;
+    std::vector<std::string> entries;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    // USR -> calls of the function in the first parsed translation unit defining it
+    std::map<std::string, FunctionCalls> defined;
+    // USR -> name of the entries and callees, for the report
+    std::map<std::string, std::string> names;
+    // USRs
+    std::set<std::string> reachable;
+    std::set<std::string> unresolved;
+    // reachable USRs not defined yet -> translation unit queued for them
+    std::map<std::string, std::string> awaiting;
+    std::set<std::string> queued;
+    std::deque<std::string> pending;
+    std::set<std::string> inFlight;
+    std::set<std::string> parsed;
+
+    void require(const std::string &usr);
+
+    void locate(const std::string &usr);
+};
+
+#endif // RUIANALYSIS_DEMANDDRIVER_H
@@ -0,0 +1,285 @@
+#include "DemuxAudit.h"
+
+#include <algorithm>
+#include <deque>
+#include <set>
+#include "CallSites.h"
+#include "FFmpegUtils.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+// demuxer options which bound the data read while probing
+static const set<string> probingOptions = {
+    "probesize", "analyzeduration", "fflags", "fpsprobesize", "formatprobesize", "max_probe_packets",
+};
+
+// AVFormatContext fields behind the probing options
+static const map<string, string> probingFields = {
+    {"probesize", "probesize"}, {"max_analyze_duration", "analyzeduration"}, {"flags", "fflags"},
+    {"fps_probe_size", "fpsprobesize"}, {"format_probesize", "formatprobesize"},
+    {"max_probe_packets", "max_probe_packets"},
+};
+
+/**
+ * Step of an open/probe sequence inside a function, ordered by source location
+ */
+struct DemuxEvent {
+    SourceLocation loc;
+    // call of an FFmpeg API, null for a field assignment
+    const CallSite *call;
+    // field assignment: format context, option and assigned value
+    string context;
+    string option;
+    string value;
+};
+
+/**
+ * Visitor class: find assignments to the probing fields of a format context
+ */
+class ProbeFieldVisitor : public RecursiveASTVisitor<ProbeFieldVisitor> {
+    ASTContext &Context;
+    vector<DemuxEvent> &events;
+
+public:
+    ProbeFieldVisitor(ASTContext &Context, vector<DemuxEvent> &events) : Context(Context), events(events) {
+    }
+
+    bool VisitBinaryOperator(BinaryOperator *assignment) {
+        if (!assignment->isAssignmentOp()) return true;
+        const auto *member = dyn_cast<MemberExpr>(assignment->getLHS()->IgnoreParenImpCasts());
+        if (!member) return true;
+        auto field = probingFields.find(member->getMemberDecl()->getNameAsString());
+        if (field == probingFields.end()) return true;
+
+        QualType base = member->getBase()->getType();
+        if (member->isArrow() && base->isPointerType()) {
+            base = base->getPointeeType();
+        }
+        const RecordDecl *record = base->getAsRecordDecl();
+        if (!record || record->getName() != "AVFormatContext") return true;
+
+        events.push_back({assignment->getBeginLoc(), nullptr, exprToString(member->getBase(), Context),
+                          field->second, exprToString(assignment->getRHS(), Context)});
+        return true;
+    }
+};
+
+DemuxAudit::DemuxAudit(const vector<string> &handlerPatterns) {
+    const vector<string> defaults = {"*[Hh]andle*", "*[Rr]equest*"};
+    for (const string &pattern: handlerPatterns.empty() ? defaults : handlerPatterns) {
+        Expected<GlobPattern> glob = GlobPattern::create(pattern);
+        if (!glob) {
+            errs() << "Error: Invalid request handler pattern '" << pattern << "': " << toString(glob.takeError())
+                   << "\n";
+            continue;
+        }
+        handlers.push_back(std::move(*glob));
+    }
+}
+
+bool DemuxAudit::isHandler(const string &function) const {
+    return any_of(handlers.begin(), handlers.end(), [&](const GlobPattern &glob) { return glob.match(function); });
+}
+
+void DemuxAudit::analyseTranslationUnit(ASTContext &Context, const string &fileName) {
+    const SourceManager &SM = Context.getSourceManager();
+    const string fileKey = toDisplayPath(fileName);
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        // a function of a header included by several translation units is audited with the first
+        auto [inserted, added] = functions.try_emplace(getFunctionUSR(func));
+        if (!added) continue;
+
+        FunctionProbes &entry = inserted->second;
+        entry.name = getMethodFullName(func);
+        entry.fileKey = fileKey;
+        const vector<CallSite> callSites = collectCallSites(func, Context);
+        vector<DemuxEvent> events;
+        for (const CallSite &site: callSites) {
+            if (!site.ffmpeg) {
+                entry.calls.push_back({getFunctionUSR(site.expr->getDirectCallee()), site.loopDepth});
+                continue;
+            }
+            events.push_back({site.expr->getBeginLoc(), &site, "", "", ""});
+        }
+        if (events.empty()) continue;
+        ProbeFieldVisitor(Context, events).TraverseStmt(func->getBody());
+        stable_sort(events.begin(), events.end(), [&](const DemuxEvent &a, const DemuxEvent &b) {
+            return SM.isBeforeInTranslationUnit(SM.getExpansionLoc(a.loc), SM.getExpansionLoc(b.loc));
+        });
+
+        // options are followed by the text of the dictionary and the format context within the function
+        map<string, map<string, string>> dictionaries;
+        map<string, map<string, string>> contexts;
+        map<string, size_t> opened;
+        for (const DemuxEvent &event: events) {
+            if (!event.call) {
+                contexts[event.context][event.option] = event.value;
+                continue;
+            }
+            const CallExpr *call = event.call->expr;
+            const string &api = event.call->callee;
+            if ((api == "av_dict_set" || api == "av_dict_set_int") && call->getNumArgs() >= 3) {
+                const auto *key = dyn_cast<StringLiteral>(call->getArg(1)->IgnoreParenImpCasts());
+                if (key && probingOptions.count(key->getString().str())) {
+                    dictionaries[objectToString(call->getArg(0), Context)][key->getString().str()] =
+                        argumentToString(call->getArg(2), Context);
+                }
+                continue;
+            }
+            if (api == "av_dict_free" && call->getNumArgs() >= 1) {
+                dictionaries.erase(objectToString(call->getArg(0), Context));
+                continue;
+            }
+
+            ProbeSite site;
+            site.api = api;
+            site.location = describeLocation(call->getBeginLoc(), SM);
+            site.loopDepth = event.call->loopDepth;
+            if (api == "avformat_open_input" && call->getNumArgs() >= 4) {
+                site.context = objectToString(call->getArg(0), Context);
+                site.formatForced = !isNullArgument(call->getArg(2), Context);
+                site.options = contexts[site.context];
+                if (!isNullArgument(call->getArg(3), Context)) {
+                    for (const auto &[option, value]: dictionaries[objectToString(call->getArg(3), Context)]) {
+                        site.options[option] = value;
+                    }
+                }
+            } else if (api == "avformat_find_stream_info" && call->getNumArgs() >= 1) {
+                // the context keeps the options of its open, fields set afterwards still apply
+                site.context = objectToString(call->getArg(0), Context);
+                auto open = opened.find(site.context);
+                if (open != opened.end()) {
+                    site.options = entry.sites[open->second].options;
+                    site.opened = entry.sites[open->second].location;
+                }
+                for (const auto &[option, value]: contexts[site.context]) {
+                    site.options[option] = value;
+                }
+            } else if ((api == "av_probe_input_buffer" || api == "av_probe_input_buffer2") && call->getNumArgs() >= 6) {
+                site.context = objectToString(call->getArg(0), Context);
+                const Expr *maxProbeSize = call->getArg(5);
+                Expr::EvalResult result;
+                const bool zero = maxProbeSize->EvaluateAsInt(result, Context) && result.Val.getInt() == 0;
+                if (!zero) {
+                    site.options["probesize"] = exprToString(maxProbeSize, Context);
+                }
+            } else if (api.rfind("av_probe_input_format", 0) == 0 && call->getNumArgs() >= 1) {
+                site.context = objectToString(call->getArg(0), Context);
+            } else {
+                continue;
+            }
+            if (api == "avformat_open_input") {
+                opened[site.context] = entry.sites.size();
+            }
+            entry.sites.push_back(std::move(site));
+        }
+    }
+}
+
+map<string, DemuxAudit::Reach> DemuxAudit::reach(const vector<pair<string, string>> &seeds) const {
+    map<string, Reach> reached;
+    deque<string> queue;
+    for (const auto &[function, origin]: seeds) {
+        if (!functions.count(function) || reached.count(function)) continue;
+        reached[function] = {origin, ""};
+        queue.push_back(function);
+    }
+    while (!queue.empty()) {
+        const string function = queue.front();
+        queue.pop_front();
+        for (const auto &[callee, loopDepth]: functions.at(function).calls) {
+            if (!functions.count(callee) || reached.count(callee)) continue;
+            reached[callee] = {reached[function].origin, function};
+            queue.push_back(callee);
+        }
+    }
+    return reached;
+}
+
+json DemuxAudit::report() const {
+    vector<pair<string, string>> handlerSeeds;
+    vector<pair<string, string>> loopSeeds;
+    for (const auto &[usr, entry]: functions) {
+        if (isHandler(entry.name)) {
+            handlerSeeds.push_back({usr, usr});
+        }
+        for (const auto &[callee, loopDepth]: entry.calls) {
+            if (loopDepth > 0) {
+                loopSeeds.push_back({callee, usr});
+            }
+        }
+    }
+    const map<string, Reach> fromHandlers = reach(handlerSeeds);
+    const map<string, Reach> fromLoops = reach(loopSeeds);
+    auto describeReach = [this](const string &kind, const string &function, const map<string, Reach> &reached) {
+        const string &origin = reached.at(function).origin;
+        vector<string> path;
+        for (string current = function; !current.empty(); current = reached.at(current).previous) {
+            path.push_back(current);
+        }
+        if (path.back() != origin) {
+            path.push_back(origin);
+        }
+        reverse(path.begin(), path.end());
+        vector<string> names;
+        for (const string &usr: path) {
+            names.push_back(functions.at(usr).name);
+        }
+        return json{{"kind", kind}, {"function", functions.at(origin).name}, {"path", names}};
+    };
+
+    json result = json::object();
+    for (const auto &[usr, entry]: functions) {
+        if (entry.sites.empty()) continue;
+        // overloads share the name
+        json &sites = result[entry.fileKey][entry.name];
+        for (const ProbeSite &site: entry.sites) {
+            json findings = json::array();
+            json reachedFrom = json::array();
+            if (site.loopDepth > 0) {
+                findings.push_back("probeInLoop");
+            }
+            if (fromLoops.count(usr)) {
+                findings.push_back("reachedFromLoop");
+                reachedFrom.push_back(describeReach("loop", usr, fromLoops));
+            }
+            if (fromHandlers.count(usr)) {
+                findings.push_back("reachedFromHandler");
+                reachedFrom.push_back(describeReach("handler", usr, fromHandlers));
+            }
+            // a forced input format skips format probing, stream analysis still reads up to the limits
+            const bool probesFormat = site.api == "avformat_open_input"
+                                          ? !site.formatForced
+                                          : site.api.rfind("av_probe_input_buffer", 0) == 0;
+            const bool analysesStreams = site.api == "avformat_find_stream_info";
+            if ((probesFormat || analysesStreams) && !site.options.count("probesize")) {
+                findings.push_back("defaultProbesize");
+            }
+            if (analysesStreams && !site.options.count("analyzeduration")) {
+                findings.push_back("defaultAnalyzeduration");
+            }
+
+            json entrySite = {{"api", site.api}, {"line", site.location["line"]},
+                              {"column", site.location["column"]}, {"context", site.context},
+                              {"options", site.options}, {"loopDepth", site.loopDepth}};
+            if (site.api == "avformat_open_input") {
+                entrySite["formatForced"] = site.formatForced;
+            }
+            if (analysesStreams) {
+                entrySite["opened"] = site.opened;
+            }
+            if (!reachedFrom.empty()) {
+                entrySite["reachedFrom"] = reachedFrom;
+            }
+            entrySite["findings"] = findings;
+            sites.push_back(entrySite);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,83 @@
+#ifndef RUIANALYSIS_DEMUXAUDIT_H
+#define RUIANALYSIS_DEMUXAUDIT_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+#include "llvm/Support/GlobPattern.h"
+
+/**
+ * Audit the cost of opening and probing demuxer inputs
+ *
+ * Every avformat_open_input, avformat_find_stream_info and av_probe_input_* call is reported with the
+ * probing options set before it in the same function: av_dict_set/av_dict_set_int on the options dictionary
+ * passed to the open, and assignments to the probing fields of the format context (probesize,
+ * max_analyze_duration, ...). Probing without a probesize or analyzeduration limit reads the defaults of
+ * several megabytes and seconds of media. Calls inside a loop, or in a function reachable from a loop or a
+ * request handler in any translation unit, reopen inputs per iteration or request and are flagged.
+ */
+class DemuxAudit {
+public:
+    /**
+     * @param handlerPatterns glob patterns of request handler names, e.g. "*Handler::*"; empty for the defaults
+     */
+    explicit DemuxAudit(const std::vector<std::string> &handlerPatterns);
+
+    void analyseTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Open and probe call sites with their options and findings
+     *
+     * @return {file: {function: [{"api", "line", "column", "context", "options", "loopDepth", "findings", ...}]}}
+     */
+    nlohmann::json report() const;
+
+private:
+    struct ProbeSite {
+        std::string api;
+        nlohmann::json location;
+        // format context expression
+        std::string context;
+        // probing option -> value set before the call
+        std::map<std::string, std::string> options;
+        unsigned loopDepth = 0;
+        // avformat_open_input with an explicit input format skips format probing
+        bool formatForced = false;
+        // avformat_find_stream_info: location of the open of the same context, null if not in this function
+        nlohmann::json opened;
+    };
+
+    struct FunctionProbes {
+        std::string name;
+        std::string fileKey;
+        std::vector<ProbeSite> sites;
+        // USRs of the project callees with the loop depth of the call
+        std::vector<std::pair<std::string, unsigned>> calls;
+    };
+
+    struct Reach {
+        // USR of the handler, or of the function with the loop around the first call
+        std::string origin;
+        // caller on a shortest path from the origin, empty for the first function
+        std::string previous;
+    };
+
+    std::vector<llvm::GlobPattern> handlers;
+    // keyed by USR, static functions of the same name in different files stay apart
+    std::map<std::string, FunctionProbes> functions;
+
+    bool isHandler(const std::string &function) const;
+
+    /**
+     * Breadth-first over project calls from the given functions
+     *
+     * @param seeds function USR -> origin USR
+     * @return reached function USRs with their shortest path back to an origin
+     */
+    std::map<std::string, Reach> reach(const std::vector<std::pair<std::string, std::string>> &seeds) const;
+};
+
+#endif // RUIANALYSIS_DEMUXAUDIT_H
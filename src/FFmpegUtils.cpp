@@ -0,0 +1,182 @@
+#include "FFmpegUtils.h"
+
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Index/USRGeneration.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+vector<filesystem::path> inputRootDirs;
+
+bool isFFmpegAPIName(const string &name) {
+    return (
+        name.rfind("avutil", 0) == 0 ||
+        name.rfind("swscale", 0) == 0 ||
+        name.rfind("swresample", 0) == 0 ||
+        name.rfind("avcodec", 0) == 0 ||
+        name.rfind("avformat", 0) == 0 ||
+        name.rfind("avdevice", 0) == 0 ||
+        name.rfind("avfilter", 0) == 0 ||
+        name.rfind("ffmpeg", 0) == 0
+    );
+}
+
+bool isFFmpegSymbol(const string &name) {
+    // API prefixes not covered by the library names
+    static const char *const prefixes[] = {"av_", "avio_", "sws_", "swr_", "avsubtitle_"};
+    if (isFFmpegAPIName(name)) return true;
+    for (const char *prefix: prefixes) {
+        if (name.rfind(prefix, 0) == 0) return true;
+    }
+    return false;
+}
+
+bool isFFmpegPath(const string &path) {
+    // lowercase checking
+    string lower;
+    lower.resize(path.size());
+    transform(path.begin(), path.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    // FFmpeg library source: https://www.ffmpeg.org/documentation.html
+    return (
+        lower.find("avutil") != string::npos ||
+        lower.find("swscale") != string::npos ||
+        lower.find("swresample") != string::npos ||
+        lower.find("avcodec") != string::npos ||
+        lower.find("avformat") != string::npos ||
+        lower.find("avdevice") != string::npos ||
+        lower.find("avfilter") != string::npos ||
+        lower.find("ffmpeg") != string::npos
+    );
+}
+
+bool isFFmpegAPIDecl(const FunctionDecl *decl, const ASTContext &Context) {
+    if (!decl) return false;
+
+    // Heuristic: File name contains FFmpeg libs
+    if (isFFmpegAPIName(decl->getNameAsString())) {
+        return true;
+    }
+
+    // Heuristic: Header path contains FFmpeg libs
+    // Get callee source location
+    const SourceManager &SM = Context.getSourceManager();
+    SourceLocation loc = decl->getLocation();
+    if (!loc.isValid()) return false;
+
+    SourceLocation spellingLoc = SM.getSpellingLoc(loc);
+    return isFFmpegPath(SM.getFilename(spellingLoc).str());
+}
+
+string toDisplayPath(const string &absoluteOrInputPath) {
+    // Resolving symlinks costs a stat per path component, every function of a file asks for the same path
+    static shared_mutex displayPathsMutex;
+    static unordered_map<string, string> displayPaths;
+    {
+        shared_lock<shared_mutex> guard(displayPathsMutex);
+        auto known = displayPaths.find(absoluteOrInputPath);
+        if (known != displayPaths.end()) return known->second;
+    }
+
+    filesystem::path absPath = filesystem::weakly_canonical(filesystem::path(absoluteOrInputPath));
+    string displayPath = absPath.filename().string();
+    for (const auto &root: inputRootDirs) {
+        filesystem::path rel = absPath.lexically_relative(root);
+        if (!rel.empty() && rel.native().find("..") != 0) {
+            displayPath = rel.string();
+            break;
+        }
+    }
+    unique_lock<shared_mutex> guard(displayPathsMutex);
+    displayPaths.emplace(absoluteOrInputPath, displayPath);
+    return displayPath;
+}
+
+string getMethodFullName(const FunctionDecl *func) {
+    // if method
+    if (auto *method = dyn_cast<CXXMethodDecl>(func)) {
+        if (auto *cls = method->getParent()) {
+            return cls->getNameAsString() + "::" + method->getNameAsString();
+        }
+    }
+    // if function
+    return func->getNameAsString();
+}
+
+string getFunctionUSR(const FunctionDecl *func) {
+    if (!func) return "";
+    SmallString<128> usr;
+    if (index::generateUSRForDecl(func, usr)) return getMethodFullName(func);
+    return string(usr);
+}
+
+/**
+ * Visitor class: find function definitions in a translation unit
+ */
+class FunctionDefinitionCollector : public RecursiveASTVisitor<FunctionDefinitionCollector> {
+    const SourceManager &SM;
+    vector<const FunctionDecl *> &functions;
+
+public:
+    FunctionDefinitionCollector(const SourceManager &SM, vector<const FunctionDecl *> &functions)
+        : SM(SM), functions(functions) {
+    }
+
+    bool VisitFunctionDecl(FunctionDecl *func) {
+        if (!func->doesThisDeclarationHaveABody()) return true;
+        if (SM.isInSystemHeader(func->getLocation())) return true;
+        functions.push_back(func);
+        return true;
+    }
+};
+
+vector<const FunctionDecl *> collectFunctionDefinitions(ASTContext &Context) {
+    vector<const FunctionDecl *> functions;
+    FunctionDefinitionCollector collector(Context.getSourceManager(), functions);
+    collector.TraverseDecl(Context.getTranslationUnitDecl());
+    return functions;
+}
+
+string exprToString(const Expr *expr, const ASTContext &Context) {
+    string text;
+    raw_string_ostream os(text);
+    expr->printPretty(os, nullptr, Context.getPrintingPolicy());
+    return os.str();
+}
+
+string objectToString(const Expr *arg, const ASTContext &Context) {
+    const Expr *expr = arg->IgnoreParenImpCasts();
+    if (const auto *unary = dyn_cast<UnaryOperator>(expr)) {
+        if (unary->getOpcode() == UO_AddrOf) {
+            expr = unary->getSubExpr()->IgnoreParenImpCasts();
+        }
+    }
+    return exprToString(expr, Context);
+}
+
+string argumentToString(const Expr *arg, const ASTContext &Context) {
+    if (const auto *literal = dyn_cast<StringLiteral>(arg->IgnoreParenImpCasts())) {
+        return literal->getString().str();
+    }
+    return exprToString(arg, Context);
+}
+
+bool isNullArgument(const Expr *arg, ASTContext &Context) {
+    return arg->isNullPointerConstant(Context, Expr::NPC_ValueDependentIsNotNull) != Expr::NPCK_NotNull;
+}
+
+json describeLocation(SourceLocation loc, const SourceManager &SM) {
+    PresumedLoc presumed = SM.getPresumedLoc(SM.getExpansionLoc(loc));
+    if (presumed.isInvalid()) {
+        return json{{"line", 0}, {"column", 0}};
+    }
+    return json{{"line", presumed.getLine()}, {"column", presumed.getColumn()}};
+}
@@ -0,0 +1,128 @@
+#ifndef RUIANALYSIS_FFMPEGUTILS_H
+#define RUIANALYSIS_FFMPEGUTILS_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+
+// directories provided as inputs
+extern std::vector<std::filesystem::path> inputRootDirs;
+
+/**
+ * Check if a function name has the prefix of an FFmpeg library
+ *
+ * @param name
+ * @return
+ */
+bool isFFmpegAPIName(const std::string &name);
+
+/**
+ * Check if a linker symbol belongs to FFmpeg, for callees without a header path (bitcode, binaries)
+ *
+ * @param name
+ * @return
+ */
+bool isFFmpegSymbol(const std::string &name);
+
+/**
+ * Check if a file belongs to an FFmpeg library, e.g. a header below libavcodec/
+ *
+ * @param path
+ * @return
+ */
+bool isFFmpegPath(const std::string &path);
+
+/**
+ * Check if API belongs to FFmpeg
+ *
+ * @param decl
+ * @param Context
+ * @return
+ */
+bool isFFmpegAPIDecl(const clang::FunctionDecl *decl, const clang::ASTContext &Context);
+
+/**
+ * Get the relative file path to store in the result, resolved once per path: inputRootDirs must be set
+ * before the first call
+ *
+ * @param absoluteOrInputPath
+ * @return
+ */
+std::string toDisplayPath(const std::string &absoluteOrInputPath);
+
+/**
+ * Get the name of a function, prefixed by its class for methods
+ *
+ * @param func
+ * @return
+ */
+std::string getMethodFullName(const clang::FunctionDecl *func);
+
+/**
+ * USR of a function, equal for its declarations in every translation unit and distinct for static
+ * functions of the same name in different files
+ *
+ * @param func
+ * @return the full name if no USR can be generated, empty for null
+ */
+std::string getFunctionUSR(const clang::FunctionDecl *func);
+
+/**
+ * Collect all function definitions of a translation unit outside system headers
+ *
+ * @param Context
+ * @return
+ */
+std::vector<const clang::FunctionDecl *> collectFunctionDefinitions(clang::ASTContext &Context);
+
+/**
+ * Print an expression as source-like text
+ *
+ * @param expr
+ * @param Context
+ * @return
+ */
+std::string exprToString(const clang::Expr *expr, const clang::ASTContext &Context);
+
+/**
+ * Print the object an argument refers to, without casts and a leading address-of, so that &ctx and ctx
+ * name the same object
+ *
+ * @param arg
+ * @param Context
+ * @return
+ */
+std::string objectToString(const clang::Expr *arg, const clang::ASTContext &Context);
+
+/**
+ * Print an argument value, string literals without their quotes
+ *
+ * @param arg
+ * @param Context
+ * @return
+ */
+std::string argumentToString(const clang::Expr *arg, const clang::ASTContext &Context);
+
+/**
+ * Whether an argument is a null pointer constant, NULL, 0 or nullptr
+ *
+ * @param arg
+ * @param Context
+ * @return
+ */
+bool isNullArgument(const clang::Expr *arg, clang::ASTContext &Context);
+
+/**
+ * Line and column of a location, resolved through macro expansions
+ *
+ * @param loc
+ * @param SM
+ * @return {"line": ..., "column": ...}
+ */
+nlohmann::json describeLocation(clang::SourceLocation loc, const clang::SourceManager &SM);
+
+#endif // RUIANALYSIS_FFMPEGUTILS_H
@@ -0,0 +1,99 @@
+#include "FunctionCache.h"
+
+#include <fstream>
+#include "FFmpegUtils.h"
+#include "clang/AST/ASTContext.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+// Bumped whenever an analysis changes the results it stores
+static constexpr unsigned cacheVersion = 2;
+
+string FunctionCache::functionKey(const FunctionDecl *func) {
+    // the ODR hash is computed once per declaration and kept in the AST
+    return getMethodFullName(func) + "@" + to_string(const_cast<FunctionDecl *>(func)->getODRHash());
+}
+
+unsigned FunctionCache::firstLine(const FunctionDecl *func) {
+    const SourceManager &SM = func->getASTContext().getSourceManager();
+    return describeLocation(func->getBeginLoc(), SM)["line"].get<unsigned>();
+}
+
+bool FunctionCache::load(const string &path) {
+    ifstream ifs(path);
+    if (!ifs) return true;
+    try {
+        json cache = json::parse(ifs);
+        if (cache.value("version", 0u) != cacheVersion) return true;
+        functions = cache.value("files", json::object());
+    } catch (const json::exception &e) {
+        errs() << "Error: Invalid function cache '" << path << "': " << e.what() << "\n";
+        functions = json::object();
+        return false;
+    }
+    return true;
+}
+
+bool FunctionCache::save(const string &path) const {
+    json files = json::object();
+    for (const auto &[file, entries]: functions.items()) {
+        if (!analysedFiles.count(file)) {
+            files[file] = entries;
+            continue;
+        }
+        // edited and removed functions of the analysed files are not kept
+        json current = json::object();
+        for (const auto &[key, sections]: entries.items()) {
+            if (seen.count({file, key})) current[key] = sections;
+        }
+        if (!current.empty()) files[file] = current;
+    }
+
+    ofstream ofs(path, ios::out | ios::trunc);
+    if (!ofs) {
+        errs() << "Error: Could not write function cache '" << path << "'\n";
+        return false;
+    }
+    ofs << json{{"version", cacheVersion}, {"files", files}}.dump();
+    return true;
+}
+
+const json *FunctionCache::lookup(const FunctionDecl *func, const string &fileKey, const string &section) {
+    const string key = functionKey(func);
+    analysedFiles.insert(fileKey);
+    seen.insert({fileKey, key});
+
+    auto &[reused, analysed] = statistics[section];
+    const auto file = functions.find(fileKey);
+    if (file != functions.end()) {
+        const auto entry = file->find(key);
+        if (entry != file->end()) {
+            const auto results = entry->find(section);
+            if (results != entry->end()) {
+                reused++;
+                return &*results;
+            }
+        }
+    }
+    analysed++;
+    return nullptr;
+}
+
+void FunctionCache::store(const FunctionDecl *func, const string &fileKey, const string &section, json results) {
+    const string key = functionKey(func);
+    analysedFiles.insert(fileKey);
+    seen.insert({fileKey, key});
+    functions[fileKey][key][section] = std::move(results);
+}
+
+json FunctionCache::report() const {
+    json result = json::object();
+    for (const auto &[section, counts]: statistics) {
+        result[section] = {{"reused", counts.first}, {"analysed", counts.second}};
+    }
+    return result;
+}
@@ -0,0 +1,75 @@
+#ifndef RUIANALYSIS_FUNCTIONCACHE_H
+#define RUIANALYSIS_FUNCTIONCACHE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <nlohmann/json.hpp>
+#include "clang/AST/Decl.h"
+
+/**
+ * Keep the per-function results of the analyses between runs, keyed by a structural hash of the body
+ *
+ * Functions are identified by file, name and the ODR hash of their definition. The hash covers the
+ * signature and the body as written and refers to other declarations by name only, so it is stable
+ * between runs and unchanged by edits elsewhere in the file. Each analysis stores its results in its own
+ * section; locations are stored relative to the first line of the function so that a function moved by an
+ * edit above it is still reused.
+ */
+class FunctionCache {
+public:
+    /**
+     * Read the cache of previous runs, a missing or outdated file is an empty cache
+     *
+     * @param path
+     * @return false if the file exists but cannot be parsed
+     */
+    bool load(const std::string &path);
+
+    /**
+     * Write the cache, functions of the analysed files that no longer exist are dropped
+     *
+     * @param path
+     * @return false if the file cannot be written
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * Stored results of an analysis for an unchanged function
+     *
+     * @param func
+     * @param fileKey
+     * @param section name of the analysis
+     * @return nullptr when the function is new or edited, or the analysis did not store results
+     */
+    const nlohmann::json *lookup(const clang::FunctionDecl *func, const std::string &fileKey,
+                                 const std::string &section);
+
+    void store(const clang::FunctionDecl *func, const std::string &fileKey, const std::string &section,
+               nlohmann::json results);
+
+    /**
+     * Line cached locations are relative to
+     *
+     * @param func
+     * @return
+     */
+    static unsigned firstLine(const clang::FunctionDecl *func);
+
+    /**
+     * @return {section: {"reused": n, "analysed": n}}
+     */
+    nlohmann::json report() const;
+
+private:
+    // {fileKey: {"name@hash": {section: results}}}
+    nlohmann::json functions = nlohmann::json::object();
+    std::set<std::string> analysedFiles;
+    std::set<std::pair<std::string, std::string>> seen;
+    std::map<std::string, std::pair<size_t, size_t>> statistics;
+
+    static std::string functionKey(const clang::FunctionDecl *func);
+};
+
+#endif // RUIANALYSIS_FUNCTIONCACHE_H
@@ -0,0 +1,326 @@
+#include "LazyCompilationDatabase.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace clang::tooling;
+using namespace llvm;
+using namespace std;
+
+// Bumped whenever the index file layout changes
+static constexpr const char *indexVersion = "RUIINDEX 1";
+
+/**
+ * Absolute, dot-free native form of a path in the database
+ *
+ * @param path
+ * @param directory base of relative paths
+ * @return
+ */
+static string normalisePath(StringRef path, StringRef directory) {
+    SmallString<256> absolute;
+    if (sys::path::is_absolute(path)) {
+        absolute = path;
+    } else {
+        absolute = directory;
+        sys::path::append(absolute, path);
+    }
+    sys::fs::make_absolute(absolute);
+    sys::path::remove_dots(absolute, true);
+    sys::path::native(absolute);
+    return string(absolute);
+}
+
+/**
+ * Undo the JSON escapes that can occur in paths
+ *
+ * @param text
+ * @return
+ */
+static string unescape(StringRef text) {
+    string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\\' && i + 1 < text.size()) {
+            const char next = text[++i];
+            result += next == 'n' ? '\n' : next == 't' ? '\t' : next;
+            continue;
+        }
+        result += text[i];
+    }
+    return result;
+}
+
+unique_ptr<LazyCompilationDatabase> LazyCompilationDatabase::load(StringRef databasePath, string &errorMessage) {
+    sys::fs::file_status status;
+    if (std::error_code ec = sys::fs::status(databasePath, status)) {
+        errorMessage = "Could not stat '" + databasePath.str() + "': " + ec.message();
+        return nullptr;
+    }
+    // Large files are memory-mapped, nothing is copied or parsed here
+    auto buffer = MemoryBuffer::getFile(databasePath, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+        errorMessage = "Could not read '" + databasePath.str() + "': " + buffer.getError().message();
+        return nullptr;
+    }
+
+    unique_ptr<LazyCompilationDatabase> database(new LazyCompilationDatabase());
+    database->databasePath = databasePath.str();
+    database->buffer = std::move(*buffer);
+
+    const string stamp = string(indexVersion) + " " + to_string(status.getSize()) + " " +
+                         to_string(status.getLastModificationTime().time_since_epoch().count());
+    if (!database->loadIndex(stamp)) {
+        database->buildIndex();
+        database->saveIndex(stamp);
+    }
+    return database;
+}
+
+void LazyCompilationDatabase::addEntry(const string &file, Entry entry) {
+    auto &entries = index[file];
+    if (entries.empty()) {
+        files.push_back(file);
+    }
+    entries.push_back(entry);
+}
+
+bool LazyCompilationDatabase::loadIndex(const string &stamp) {
+    auto cached = MemoryBuffer::getFile(databasePath + ".ruiindex");
+    if (!cached) return false;
+
+    auto [header, rest] = (*cached)->getBuffer().split('\n');
+    if (header != stamp) return false;
+
+    const uint64_t size = buffer->getBufferSize();
+    while (!rest.empty()) {
+        auto [line, next] = rest.split('\n');
+        rest = next;
+        if (line.empty()) continue;
+
+        // <offset> <length> <file>
+        SmallVector<StringRef, 3> fields;
+        line.split(fields, ' ', 2);
+        Entry entry{};
+        if (fields.size() != 3 || fields[0].getAsInteger(10, entry.offset) ||
+            fields[1].getAsInteger(10, entry.length) || entry.offset + entry.length > size) {
+            index.clear();
+            files.clear();
+            return false;
+        }
+        addEntry(fields[2].str(), entry);
+    }
+    return true;
+}
+
+void LazyCompilationDatabase::buildIndex() {
+    // Single pass over the array of entries, only "file" and "directory" of each entry are decoded
+    const StringRef data = buffer->getBuffer();
+    int depth = 0;
+    bool inString = false;
+    bool escaped = false;
+    bool afterColon = false;
+    size_t stringStart = 0;
+    size_t objectStart = 0;
+    string lastKey;
+    string file;
+    string directory;
+
+    for (size_t i = 0; i < data.size(); ++i) {
+        const char c = data[i];
+        if (inString) {
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == '"') {
+                inString = false;
+                if (depth != 2) continue;
+                string text = unescape(data.substr(stringStart, i - stringStart));
+                if (!afterColon) {
+                    lastKey = std::move(text);
+                    continue;
+                }
+                if (lastKey == "file") file = std::move(text);
+                if (lastKey == "directory") directory = std::move(text);
+                afterColon = false;
+            }
+            continue;
+        }
+
+        switch (c) {
+            case '"':
+                inString = true;
+                stringStart = i + 1;
+                break;
+            case '{':
+            case '[':
+                if (depth == 1 && c == '{') {
+                    objectStart = i;
+                    file.clear();
+                    directory.clear();
+                }
+                afterColon = false;
+                depth++;
+                break;
+            case '}':
+            case ']':
+                depth--;
+                if (depth == 1 && c == '}' && !file.empty()) {
+                    addEntry(normalisePath(file, directory), {objectStart, i + 1 - objectStart});
+                }
+                break;
+            case ':':
+                afterColon = depth == 2;
+                break;
+            case ',':
+                afterColon = false;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void LazyCompilationDatabase::saveIndex(const string &stamp) const {
+    // Written aside and renamed so concurrent runs never read a partial index
+    const string indexPath = databasePath + ".ruiindex";
+    const string temporaryPath = indexPath + ".tmp" + to_string(sys::Process::getProcessId());
+    {
+        std::error_code ec;
+        raw_fd_ostream os(temporaryPath, ec);
+        if (ec) return;
+        os << stamp << "\n";
+        for (const string &file: files) {
+            for (const Entry &entry: index.find(file)->second) {
+                os << entry.offset << " " << entry.length << " " << file << "\n";
+            }
+        }
+    }
+    if (sys::fs::rename(temporaryPath, indexPath)) {
+        sys::fs::remove(temporaryPath);
+    }
+}
+
+optional<CompileCommand> LazyCompilationDatabase::parseEntry(const Entry &entry) const {
+    const StringRef text = buffer->getBuffer().substr(entry.offset, entry.length);
+    Expected<json::Value> value = json::parse(text);
+    if (!value) {
+        errs() << "Error: Invalid entry in '" << databasePath << "': " << toString(value.takeError()) << "\n";
+        return nullopt;
+    }
+    const json::Object *object = value->getAsObject();
+    if (!object) return nullopt;
+
+    const auto directory = object->getString("directory");
+    const auto file = object->getString("file");
+    if (!directory || !file) return nullopt;
+
+    vector<string> arguments;
+    if (const json::Array *argumentArray = object->getArray("arguments")) {
+        for (const json::Value &argument: *argumentArray) {
+            if (auto str = argument.getAsString()) {
+                arguments.push_back(str->str());
+            }
+        }
+    } else if (auto command = object->getString("command")) {
+        BumpPtrAllocator allocator;
+        StringSaver saver(allocator);
+        SmallVector<const char *, 64> argv;
+        cl::TokenizeGNUCommandLine(*command, saver, argv);
+        for (const char *argument: argv) {
+            if (argument) arguments.emplace_back(argument);
+        }
+    }
+    const auto output = object->getString("output");
+    return CompileCommand(*directory, *file, std::move(arguments), output ? *output : StringRef());
+}
+
+vector<CompileCommand> LazyCompilationDatabase::getCompileCommands(StringRef FilePath) const {
+    SmallString<256> currentDirectory;
+    sys::fs::current_path(currentDirectory);
+    auto found = index.find(normalisePath(FilePath, currentDirectory));
+    if (found == index.end()) {
+        // the database may name the file through a symlink
+        SmallString<256> realPath;
+        if (sys::fs::real_path(FilePath, realPath)) return {};
+        found = index.find(normalisePath(realPath, currentDirectory));
+        if (found == index.end()) return {};
+    }
+
+    vector<CompileCommand> commands;
+    for (const Entry &entry: found->second) {
+        if (optional<CompileCommand> command = parseEntry(entry)) {
+            commands.push_back(std::move(*command));
+        }
+    }
+    return commands;
+}
+
+vector<string> LazyCompilationDatabase::getAllFiles() const {
+    return files;
+}
+
+vector<CompileCommand> LazyCompilationDatabase::getAllCompileCommands() const {
+    vector<CompileCommand> commands;
+    for (const string &file: files) {
+        for (const Entry &entry: index.find(file)->second) {
+            if (optional<CompileCommand> command = parseEntry(entry)) {
+                commands.push_back(std::move(*command));
+            }
+        }
+    }
+    return commands;
+}
+
+/**
+ * Add the adjustments the Clang JSON plugin applies to its databases
+ *
+ * @param database
+ * @return
+ */
+static unique_ptr<CompilationDatabase> withInference(unique_ptr<CompilationDatabase> database) {
+    return inferTargetAndDriverMode(
+        inferMissingCompileCommands(expandResponseFiles(std::move(database), vfs::getRealFileSystem())));
+}
+
+unique_ptr<CompilationDatabase> loadCompilationDatabase(StringRef buildPath, StringRef firstSource,
+                                                        string &errorMessage) {
+    if (!buildPath.empty()) {
+        SmallString<256> databasePath(buildPath);
+        sys::path::append(databasePath, "compile_commands.json");
+        if (sys::fs::exists(databasePath)) {
+            if (auto database = LazyCompilationDatabase::load(databasePath, errorMessage)) {
+                return withInference(std::move(database));
+            }
+            return nullptr;
+        }
+        return CompilationDatabase::autoDetectFromDirectory(buildPath, errorMessage);
+    }
+
+    // Same search as CompilationDatabase::autoDetectFromSource
+    SmallString<256> directory(firstSource);
+    sys::fs::make_absolute(directory);
+    sys::path::remove_dots(directory, true);
+    for (StringRef current = sys::path::parent_path(directory); !current.empty();
+         current = sys::path::parent_path(current)) {
+        SmallString<256> databasePath(current);
+        sys::path::append(databasePath, "compile_commands.json");
+        if (!sys::fs::exists(databasePath)) continue;
+        if (auto database = LazyCompilationDatabase::load(databasePath, errorMessage)) {
+            return withInference(std::move(database));
+        }
+        return nullptr;
+    }
+    return CompilationDatabase::autoDetectFromSource(firstSource, errorMessage);
+}
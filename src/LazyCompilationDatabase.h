@@ -0,0 +1,76 @@
+#ifndef RUIANALYSIS_LAZYCOMPILATIONDATABASE_H
+#define RUIANALYSIS_LAZYCOMPILATIONDATABASE_H
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+/**
+ * compile_commands.json loader which only parses the entries that are asked for
+ *
+ * The database is memory-mapped and scanned once for the byte range and file of every entry. That
+ * index is cached next to the database as <database>.ruiindex and reused while the database keeps its
+ * size and modification time, so a run over a few files parses only their entries.
+ */
+class LazyCompilationDatabase : public clang::tooling::CompilationDatabase {
+public:
+    /**
+     * Open a compile_commands.json file
+     *
+     * @param databasePath
+     * @param errorMessage set when nullptr is returned
+     * @return
+     */
+    static std::unique_ptr<LazyCompilationDatabase> load(llvm::StringRef databasePath, std::string &errorMessage);
+
+    std::vector<clang::tooling::CompileCommand> getCompileCommands(llvm::StringRef FilePath) const override;
+
+    std::vector<std::string> getAllFiles() const override;
+
+    std::vector<clang::tooling::CompileCommand> getAllCompileCommands() const override;
+
+private:
+    // byte range of one entry of the database
+    struct Entry {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    std::string databasePath;
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    llvm::StringMap<std::vector<Entry>> index;
+    // files in database order
+    std::vector<std::string> files;
+
+    void addEntry(const std::string &file, Entry entry);
+
+    bool loadIndex(const std::string &stamp);
+
+    void buildIndex();
+
+    void saveIndex(const std::string &stamp) const;
+
+    std::optional<clang::tooling::CompileCommand> parseEntry(const Entry &entry) const;
+};
+
+/**
+ * Find the compilation database for the sources being analysed
+ *
+ * compile_commands.json files found in the build path, or in a parent directory of the first source,
+ * are opened lazily. Other formats are left to the Clang plugins.
+ *
+ * @param buildPath directory given with -p, may be empty
+ * @param firstSource
+ * @param errorMessage
+ * @return
+ */
+std::unique_ptr<clang::tooling::CompilationDatabase> loadCompilationDatabase(llvm::StringRef buildPath,
+                                                                            llvm::StringRef firstSource,
+                                                                            std::string &errorMessage);
+
+#endif // RUIANALYSIS_LAZYCOMPILATIONDATABASE_H
@@ -0,0 +1,502 @@
+#include "LockIOChecker.h"
+
+#include <deque>
+#include <optional>
+#include "FFmpegUtils.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+// Helpers calling each other are resolved within this many passes over a TU
+static constexpr unsigned maxSummaryPasses = 8;
+
+static const set<string> acquireFunctions = {
+    "pthread_mutex_lock", "pthread_mutex_trylock", "pthread_mutex_timedlock",
+    "pthread_rwlock_rdlock", "pthread_rwlock_wrlock", "pthread_rwlock_tryrdlock", "pthread_rwlock_trywrlock",
+    "pthread_spin_lock", "pthread_spin_trylock",
+    "mtx_lock", "mtx_trylock", "mtx_timedlock",
+    "EnterCriticalSection", "TryEnterCriticalSection", "AcquireSRWLockExclusive", "AcquireSRWLockShared",
+};
+
+static const set<string> releaseFunctions = {
+    "pthread_mutex_unlock", "pthread_rwlock_unlock", "pthread_spin_unlock", "mtx_unlock",
+    "LeaveCriticalSection", "ReleaseSRWLockExclusive", "ReleaseSRWLockShared",
+};
+
+// Methods of std::mutex like classes and std::unique_lock
+static const set<string> lockMethods = {
+    "lock", "lock_shared", "try_lock", "try_lock_shared", "try_lock_for", "try_lock_until",
+};
+static const set<string> unlockMethods = {"unlock", "unlock_shared"};
+static const set<string> scopedLockTypes = {"lock_guard", "unique_lock", "shared_lock", "scoped_lock"};
+
+// FFmpeg APIs that may block on file, network or pipe I/O
+static const set<string> blockingIOFunctions = {
+    "avformat_open_input", "avformat_find_stream_info", "av_read_frame", "av_seek_frame", "avformat_seek_file",
+    "avformat_flush", "avformat_write_header", "av_write_frame", "av_interleaved_write_frame", "av_write_trailer",
+    "avio_open", "avio_open2", "avio_close", "avio_closep", "avio_accept", "avio_handshake",
+    "avio_read", "avio_read_partial", "avio_write", "avio_flush", "avio_seek", "avio_skip", "avio_size",
+    "avio_r8", "avio_rl16", "avio_rl32", "avio_rl64", "avio_rb16", "avio_rb32", "avio_rb64",
+    "avio_w8", "avio_wl16", "avio_wl32", "avio_wl64", "avio_wb16", "avio_wb32", "avio_wb64",
+    "avio_put_str", "avio_printf", "avio_read_to_bprint",
+};
+
+/**
+ * Strip casts, parentheses and a leading address-of from a lock expression
+ *
+ * @param lockExpr
+ * @param addressTaken set when an address-of was removed
+ * @return
+ */
+static const Expr *stripAddressOf(const Expr *lockExpr, bool &addressTaken) {
+    const Expr *expr = lockExpr->IgnoreParenImpCasts();
+    addressTaken = false;
+    if (const auto *unary = dyn_cast<UnaryOperator>(expr)) {
+        if (unary->getOpcode() == UO_AddrOf) {
+            addressTaken = true;
+            expr = unary->getSubExpr()->IgnoreParenImpCasts();
+        }
+    }
+    return expr;
+}
+
+/**
+ * Name a lock by its expression, locks reached through a parameter are written as $<index>
+ *
+ * @param lockExpr
+ * @param Context
+ * @return
+ */
+static string lockKey(const Expr *lockExpr, const ASTContext &Context) {
+    bool addressTaken = false;
+    const Expr *expr = stripAddressOf(lockExpr, addressTaken);
+    string key = exprToString(expr, Context);
+
+    // Find the variable the lock expression is rooted at
+    const Expr *root = expr;
+    while (true) {
+        root = root->IgnoreParenImpCasts();
+        if (const auto *member = dyn_cast<MemberExpr>(root)) {
+            root = member->getBase();
+        } else if (const auto *subscript = dyn_cast<ArraySubscriptExpr>(root)) {
+            root = subscript->getBase();
+        } else {
+            break;
+        }
+    }
+    const auto *ref = dyn_cast<DeclRefExpr>(root);
+    if (!ref) return key;
+    const auto *param = dyn_cast<ParmVarDecl>(ref->getDecl());
+    if (!param) return key;
+
+    const string name = param->getNameAsString();
+    if (name.empty() || key.rfind(name, 0) != 0) return key;
+    if (key.size() > name.size() && (isalnum(static_cast<unsigned char>(key[name.size()])) || key[name.size()] == '_')) {
+        return key;
+    }
+    return "$" + to_string(param->getFunctionScopeIndex()) + key.substr(name.size());
+}
+
+/**
+ * Translate a summary lock key of a callee into the lock named by the caller's arguments
+ *
+ * @param key
+ * @param call
+ * @param Context
+ * @return
+ */
+static optional<string> bindSummaryKey(const string &key, const CallExpr *call, const ASTContext &Context) {
+    if (key.empty() || key[0] != '$') return key;
+    size_t end = 1;
+    while (end < key.size() && isdigit(static_cast<unsigned char>(key[end]))) {
+        ++end;
+    }
+    const unsigned index = stoul(key.substr(1, end - 1));
+    if (index >= call->getNumArgs()) return nullopt;
+
+    bool addressTaken = false;
+    stripAddressOf(call->getArg(index), addressTaken);
+    string rest = key.substr(end);
+    // helper(&obj) locking $0->mutex locks obj.mutex
+    if (addressTaken && rest.rfind("->", 0) == 0) {
+        rest = "." + rest.substr(2);
+    }
+    return lockKey(call->getArg(index), Context) + rest;
+}
+
+static void releaseLock(const string &key, set<string> &held, set<string> &releasedUnheld) {
+    if (!held.erase(key)) {
+        releasedUnheld.insert(key);
+    }
+}
+
+static void addFinding(json &results, const string &fileKey, const string &function, const json &finding) {
+    if (!results.contains(fileKey)) {
+        results[fileKey] = json::object();
+    }
+    if (!results[fileKey].contains(function)) {
+        results[fileKey][function] = json::array();
+    }
+    results[fileKey][function].push_back(finding);
+}
+
+json LockIOChecker::summaryToJson(const LockSummary &summary) {
+    return {{"acquires", summary.acquires}, {"releases", summary.releases}};
+}
+
+LockIOChecker::LockSummary LockIOChecker::summaryFromJson(const json &summary) {
+    return {summary.at("acquires").get<LockSet>(), summary.at("releases").get<LockSet>()};
+}
+
+void LockIOChecker::addReportedFinding(const string &fileKey, const string &function, const json &finding) {
+    const string id = fileKey + ":" + function + ":" + finding.dump();
+    if (reported.insert(id).second) {
+        addFinding(findings, fileKey, function, finding);
+    }
+}
+
+void LockIOChecker::replayCached(const json &cached, const FunctionDecl *func, const string &fileKey) {
+    const string name = getMethodFullName(func);
+    const string usr = getFunctionUSR(func);
+    functionNames[usr] = name;
+    for (const auto &api: cached.at("blocking")) {
+        directBlockingCalls[usr].insert(api.get<string>());
+    }
+    for (const auto &[callee, calleeName]: cached.at("callees").items()) {
+        projectCallees[usr].insert(callee);
+        functionNames[callee] = calleeName.get<string>();
+    }
+    const unsigned base = FunctionCache::firstLine(func);
+    for (json finding: cached.at("findings")) {
+        finding["line"] = base + finding["line"].get<unsigned>();
+        addReportedFinding(fileKey, name, finding);
+    }
+    for (const auto &pending: cached.at("pending")) {
+        json location = pending.at("location");
+        location["line"] = base + location["line"].get<unsigned>();
+        pendingCalls.push_back({fileKey, name, pending.at("callee").get<string>(), location,
+                                pending.at("locks").get<LockSet>()});
+    }
+}
+
+void LockIOChecker::analyseTranslationUnit(ASTContext &Context, const string &fileName) {
+    const string fileKey = toDisplayPath(fileName);
+    vector<const FunctionDecl *> functions = collectFunctionDefinitions(Context);
+
+    // Cached results hold while the callee summaries they were computed with are unchanged
+    map<const FunctionDecl *, const json *> cached;
+    if (cache) {
+        for (const FunctionDecl *func: functions) {
+            if (const json *results = cache->lookup(func, fileKey, "lockIO")) {
+                cached[func] = results;
+            }
+        }
+    }
+    auto reusable = [&](const FunctionDecl *func) -> const json * {
+        auto entry = cached.find(func);
+        if (entry == cached.end()) return nullptr;
+        for (const auto &[callee, summary]: entry->second->at("consumed").items()) {
+            auto current = lockSummaries.find(callee);
+            if (!((current == lockSummaries.end() ? LockSummary() : current->second) == summaryFromJson(summary))) {
+                return nullptr;
+            }
+        }
+        return entry->second;
+    };
+
+    // Summaries of lock helpers feed their callers, iterate until they are stable
+    for (unsigned pass = 0; pass < maxSummaryPasses; ++pass) {
+        bool changed = false;
+        for (const FunctionDecl *func: functions) {
+            const json *results = reusable(func);
+            LockSummary summary = results ? summaryFromJson(results->at("summary"))
+                                          : analyseFunction(func, Context, fileKey, false);
+            LockSummary &stored = lockSummaries[getFunctionUSR(func)];
+            if (!(stored == summary)) {
+                stored = summary;
+                changed = true;
+            }
+        }
+        if (!changed) break;
+    }
+
+    for (const FunctionDecl *func: functions) {
+        if (const json *results = reusable(func)) {
+            replayCached(*results, func, fileKey);
+        } else {
+            analyseFunction(func, Context, fileKey, true);
+        }
+    }
+}
+
+LockIOChecker::LockSummary LockIOChecker::analyseFunction(const FunctionDecl *func, ASTContext &Context,
+                                                          const string &fileKey, bool report) {
+    LockSummary summary;
+    Stmt *body = func->getBody();
+    if (!body) return summary;
+
+    CFG::BuildOptions options;
+    options.AddImplicitDtors = true;
+    unique_ptr<CFG> cfg = CFG::buildCFG(func, body, &Context, options);
+    if (!cfg) return summary;
+
+    FunctionState state{func, getMethodFullName(func), getFunctionUSR(func), fileKey, Context, false, {}, {}, {}, {},
+                        {}, {}, {}};
+    functionNames[state.usr] = state.name;
+
+    // Forward may-hold analysis: a lock is held at a block if it is held along any path reaching it
+    vector<optional<LockSet>> blockEntry(cfg->getNumBlockIDs());
+    deque<const CFGBlock *> worklist;
+    blockEntry[cfg->getEntry().getBlockID()] = LockSet();
+    worklist.push_back(&cfg->getEntry());
+    while (!worklist.empty()) {
+        const CFGBlock *block = worklist.front();
+        worklist.pop_front();
+
+        LockSet held = *blockEntry[block->getBlockID()];
+        for (const CFGElement &elem: *block) {
+            transfer(elem, held, state);
+        }
+        for (const CFGBlock *succ: block->succs()) {
+            if (!succ) continue;
+            optional<LockSet> &entry = blockEntry[succ->getBlockID()];
+            if (!entry) {
+                entry = held;
+                worklist.push_back(succ);
+                continue;
+            }
+            const size_t before = entry->size();
+            entry->insert(held.begin(), held.end());
+            if (entry->size() != before) {
+                worklist.push_back(succ);
+            }
+        }
+    }
+
+    // Replay every reachable block once with its final entry state
+    state.report = report;
+    state.releasedUnheld.clear();
+    for (const CFGBlock *block: *cfg) {
+        if (!blockEntry[block->getBlockID()]) continue;
+        LockSet held = *blockEntry[block->getBlockID()];
+        for (const CFGElement &elem: *block) {
+            transfer(elem, held, state);
+        }
+    }
+
+    const optional<LockSet> &atExit = blockEntry[cfg->getExit().getBlockID()];
+    if (atExit) {
+        summary.acquires = *atExit;
+    }
+    summary.releases = state.releasedUnheld;
+    if (!report) return summary;
+
+    for (const json &finding: state.findings) {
+        addReportedFinding(fileKey, state.name, finding);
+    }
+    pendingCalls.insert(pendingCalls.end(), state.pendingCalls.begin(), state.pendingCalls.end());
+    if (cache) {
+        // locations relative to the function, an edit above it does not invalidate them
+        const unsigned base = FunctionCache::firstLine(func);
+        json consumed = json::object();
+        for (const auto &[callee, calleeSummary]: state.consumedSummaries) {
+            consumed[callee] = summaryToJson(calleeSummary);
+        }
+        json relativeFindings = json::array();
+        for (json finding: state.findings) {
+            finding["line"] = finding["line"].get<unsigned>() - base;
+            relativeFindings.push_back(finding);
+        }
+        json pending = json::array();
+        for (const PendingCall &call: state.pendingCalls) {
+            json location = call.location;
+            location["line"] = location["line"].get<unsigned>() - base;
+            pending.push_back({{"callee", call.callee}, {"location", location}, {"locks", call.locks}});
+        }
+        cache->store(func, fileKey, "lockIO",
+                     {{"summary", summaryToJson(summary)}, {"consumed", consumed}, {"blocking", state.blockingCalls},
+                      {"callees", state.callees}, {"findings", relativeFindings}, {"pending", pending}});
+    }
+    return summary;
+}
+
+void LockIOChecker::transfer(const CFGElement &elem, LockSet &held, FunctionState &state) {
+    // End of scope of a lock_guard/unique_lock
+    if (optional<CFGAutomaticObjDtor> dtor = elem.getAs<CFGAutomaticObjDtor>()) {
+        auto it = state.scopedLocks.find(dtor->getVarDecl());
+        if (it != state.scopedLocks.end()) {
+            for (const string &key: it->second) {
+                held.erase(key);
+            }
+        }
+        return;
+    }
+
+    optional<CFGStmt> cfgStmt = elem.getAs<CFGStmt>();
+    if (!cfgStmt) return;
+    const Stmt *stmt = cfgStmt->getStmt();
+
+    if (const auto *call = dyn_cast<CallExpr>(stmt)) {
+        transferCall(call, held, state);
+        return;
+    }
+
+    // Construction of a lock_guard/unique_lock
+    const auto *declStmt = dyn_cast<DeclStmt>(stmt);
+    if (!declStmt) return;
+    for (const Decl *decl: declStmt->decls()) {
+        const auto *var = dyn_cast<VarDecl>(decl);
+        if (!var || !var->getInit()) continue;
+        const CXXRecordDecl *record = var->getType()->getAsCXXRecordDecl();
+        if (!record || !scopedLockTypes.count(record->getNameAsString())) continue;
+        const auto *construct = dyn_cast<CXXConstructExpr>(var->getInit()->IgnoreImplicit());
+        if (!construct) continue;
+
+        vector<string> keys;
+        bool deferred = false;
+        for (const Expr *arg: construct->arguments()) {
+            const string argType = arg->getType().getAsString();
+            if (argType.find("defer_lock_t") != string::npos) {
+                deferred = true;
+                continue;
+            }
+            if (argType.find("adopt_lock_t") != string::npos || argType.find("try_to_lock_t") != string::npos) {
+                continue;
+            }
+            keys.push_back(lockKey(arg, state.Context));
+        }
+        if (!deferred) {
+            held.insert(keys.begin(), keys.end());
+        }
+        state.scopedLocks[var] = keys;
+    }
+}
+
+void LockIOChecker::transferCall(const CallExpr *call, LockSet &held, FunctionState &state) {
+    const FunctionDecl *callee = call->getDirectCallee();
+    if (!callee) return;
+    const string calleeName = callee->getNameAsString();
+
+    // std::mutex style objects, and unique_lock guards locked or unlocked by hand
+    if (const auto *memberCall = dyn_cast<CXXMemberCallExpr>(call)) {
+        const CXXRecordDecl *record = memberCall->getRecordDecl();
+        const Expr *object = memberCall->getImplicitObjectArgument();
+        if (record && object && (lockMethods.count(calleeName) || unlockMethods.count(calleeName))) {
+            vector<string> keys;
+            if (scopedLockTypes.count(record->getNameAsString())) {
+                if (const auto *ref = dyn_cast<DeclRefExpr>(object->IgnoreParenImpCasts())) {
+                    auto it = state.scopedLocks.find(dyn_cast<VarDecl>(ref->getDecl()));
+                    if (it != state.scopedLocks.end()) keys = it->second;
+                }
+            } else if (StringRef(record->getName()).ends_with("mutex")) {
+                keys.push_back(lockKey(object, state.Context));
+            }
+            for (const string &key: keys) {
+                if (lockMethods.count(calleeName)) {
+                    held.insert(key);
+                } else {
+                    releaseLock(key, held, state.releasedUnheld);
+                }
+            }
+            if (!keys.empty()) return;
+        }
+    }
+
+    if (acquireFunctions.count(calleeName) && call->getNumArgs() > 0) {
+        held.insert(lockKey(call->getArg(0), state.Context));
+        return;
+    }
+    if (releaseFunctions.count(calleeName) && call->getNumArgs() > 0) {
+        releaseLock(lockKey(call->getArg(0), state.Context), held, state.releasedUnheld);
+        return;
+    }
+
+    const SourceManager &SM = state.Context.getSourceManager();
+    if (blockingIOFunctions.count(calleeName)) {
+        directBlockingCalls[state.usr].insert(calleeName);
+        state.blockingCalls.insert(calleeName);
+        if (state.report && !held.empty()) {
+            json finding = {{"api", calleeName}, {"locks", held}, {"via", json::array()}};
+            finding.update(describeLocation(call->getBeginLoc(), SM));
+            state.findings.push_back(finding);
+        }
+        return;
+    }
+
+    const string calleeUSR = getFunctionUSR(callee);
+    functionNames[calleeUSR] = getMethodFullName(callee);
+    projectCallees[state.usr].insert(calleeUSR);
+    state.callees[calleeUSR] = functionNames[calleeUSR];
+    if (state.report && !held.empty()) {
+        state.pendingCalls.push_back({state.fileKey, state.name, calleeUSR,
+                                      describeLocation(call->getBeginLoc(), SM), held});
+    }
+
+    // Apply the lock effect of summarised callees
+    auto summary = lockSummaries.find(calleeUSR);
+    state.consumedSummaries[calleeUSR] = summary == lockSummaries.end() ? LockSummary() : summary->second;
+    if (summary == lockSummaries.end()) return;
+    for (const string &key: summary->second.releases) {
+        if (optional<string> bound = bindSummaryKey(key, call, state.Context)) {
+            releaseLock(*bound, held, state.releasedUnheld);
+        }
+    }
+    for (const string &key: summary->second.acquires) {
+        if (optional<string> bound = bindSummaryKey(key, call, state.Context)) {
+            held.insert(*bound);
+        }
+    }
+}
+
+json LockIOChecker::report() const {
+    json results = findings;
+    set<string> seen;
+
+    for (const PendingCall &pending: pendingCalls) {
+        // Breadth-first search gives the shortest call chain to each blocking API
+        map<string, vector<string>> paths{{pending.callee, {functionNames.at(pending.callee)}}};
+        deque<string> queue{pending.callee};
+        while (!queue.empty()) {
+            const string current = queue.front();
+            queue.pop_front();
+            const vector<string> path = paths[current];
+
+            auto blocking = directBlockingCalls.find(current);
+            if (blocking != directBlockingCalls.end()) {
+                for (const string &api: blocking->second) {
+                    json finding = {{"api", api}, {"locks", pending.locks}, {"via", path}};
+                    finding.update(pending.location);
+                    const string id = pending.fileKey + ":" + pending.function + ":" + finding.dump();
+                    if (!seen.insert(id).second) continue;
+                    addFinding(results, pending.fileKey, pending.function, finding);
+                }
+            }
+
+            auto callees = projectCallees.find(current);
+            if (callees == projectCallees.end()) continue;
+            for (const string &next: callees->second) {
+                if (paths.count(next)) continue;
+                vector<string> nextPath = path;
+                nextPath.push_back(functionNames.at(next));
+                paths.emplace(next, nextPath);
+                queue.push_back(next);
+            }
+        }
+    }
+
+    for (const auto &[file, functions]: results.items()) {
+        for (const auto &[function, functionFindings]: functions.items()) {
+            for (const auto &finding: functionFindings) {
+                outs() << file << ":" << finding["line"].get<unsigned>() << " " << function << " calls "
+                        << finding["api"].get<string>() << " while holding a lock\n";
+            }
+        }
+    }
+    return results;
+}
@@ -0,0 +1,113 @@
+#ifndef RUIANALYSIS_LOCKIOCHECKER_H
+#define RUIANALYSIS_LOCKIOCHECKER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/Analysis/CFG.h"
+#include "FunctionCache.h"
+
+/**
+ * Detect blocking FFmpeg I/O reachable while a lock is held
+ *
+ * Lock acquire/release calls are tracked along the CFG of every function. Helpers that take or drop a
+ * lock are summarised so their callers see the effect, and project functions called under a lock are
+ * resolved against the project-wide call graph once all TUs have been analysed.
+ */
+class LockIOChecker {
+public:
+    /**
+     * Reuse the results of unchanged functions, as long as the lock summaries of their callees are unchanged
+     *
+     * @param functionCache
+     */
+    void useCache(FunctionCache *functionCache) {
+        cache = functionCache;
+    }
+
+    /**
+     * Analyse all function definitions of a translation unit
+     *
+     * @param Context
+     * @param fileName
+     */
+    void analyseTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Build the findings of all analysed TUs
+     *
+     * @return {file: {function: [finding, ...]}}
+     */
+    nlohmann::json report() const;
+
+private:
+    using LockSet = std::set<std::string>;
+
+    // Net lock effect of a function on its caller, parameters are written as $<index>
+    struct LockSummary {
+        LockSet acquires;
+        LockSet releases;
+
+        bool operator==(const LockSummary &other) const = default;
+    };
+
+    // Call to a project function while a lock is held
+    struct PendingCall {
+        std::string fileKey;
+        std::string function;
+        // USR of the callee
+        std::string callee;
+        nlohmann::json location;
+        LockSet locks;
+    };
+
+    // State while walking one function
+    struct FunctionState {
+        const clang::FunctionDecl *func;
+        std::string name;
+        std::string usr;
+        std::string fileKey;
+        clang::ASTContext &Context;
+        bool report;
+        std::map<const clang::VarDecl *, std::vector<std::string>> scopedLocks;
+        LockSet releasedUnheld;
+        // what the function read and produced, for the cache
+        std::map<std::string, LockSummary> consumedSummaries;
+        std::set<std::string> blockingCalls;
+        std::map<std::string, std::string> callees;
+        std::vector<nlohmann::json> findings;
+        std::vector<PendingCall> pendingCalls;
+    };
+
+    // functions are keyed by USR, static functions of the same name in different files are distinct
+    std::map<std::string, LockSummary> lockSummaries;
+    std::map<std::string, std::set<std::string>> directBlockingCalls;
+    std::map<std::string, std::set<std::string>> projectCallees;
+    std::map<std::string, std::string> functionNames;
+    std::set<std::string> reported;
+    nlohmann::json findings = nlohmann::json::object();
+    std::vector<PendingCall> pendingCalls;
+    FunctionCache *cache = nullptr;
+
+    static nlohmann::json summaryToJson(const LockSummary &summary);
+
+    static LockSummary summaryFromJson(const nlohmann::json &summary);
+
+    void addReportedFinding(const std::string &fileKey, const std::string &function, const nlohmann::json &finding);
+
+    void replayCached(const nlohmann::json &cached, const clang::FunctionDecl *func, const std::string &fileKey);
+
+    LockSummary analyseFunction(const clang::FunctionDecl *func, clang::ASTContext &Context,
+                                const std::string &fileKey, bool report);
+
+    void transfer(const clang::CFGElement &elem, LockSet &held, FunctionState &state);
+
+    void transferCall(const clang::CallExpr *call, LockSet &held, FunctionState &state);
+};
+
+#endif // RUIANALYSIS_LOCKIOCHECKER_H
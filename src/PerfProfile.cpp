@@ -0,0 +1,260 @@
+#include "PerfProfile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+static bool isNumber(const string &token) {
+    return !token.empty() && all_of(token.begin(), token.end(), [](unsigned char c) { return isdigit(c) || c == '.'; });
+}
+
+static bool isHexAddress(const string &token) {
+    return !token.empty() && all_of(token.begin(), token.end(), [](unsigned char c) { return isxdigit(c); });
+}
+
+static string trim(const string &text) {
+    const size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == string::npos) return "";
+    const size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+PerfProfile::PerfProfile(const json &callMap) {
+    for (const auto &[file, functions]: callMap.items()) {
+        for (const auto &[function, apis]: functions.items()) {
+            FunctionKey key{file, function};
+            functionsByName[function].push_back(key);
+            for (const auto &api: apis) {
+                apisByFunction[key].insert(api.get<string>());
+            }
+        }
+    }
+}
+
+string PerfProfile::normaliseSymbol(const string &symbol) {
+    string name = symbol;
+    // func+0x1f
+    const size_t offset = name.rfind("+0x");
+    if (offset != string::npos) {
+        name = name.substr(0, offset);
+    }
+    // folded stack annotations: func_[k], func_[j]
+    if (name.size() > 4 && name[name.size() - 4] == '_' && name[name.size() - 3] == '[' && name.back() == ']') {
+        name = name.substr(0, name.size() - 4);
+    }
+    if (name.size() > 6 && name.compare(name.size() - 6, 6, " const") == 0) {
+        name = name.substr(0, name.size() - 6);
+    }
+    // demangled parameter list
+    if (!name.empty() && name.back() == ')') {
+        int depth = 0;
+        for (size_t i = name.size(); i-- > 0;) {
+            if (name[i] == ')') depth++;
+            if (name[i] == '(' && --depth == 0) {
+                name = name.substr(0, i);
+                break;
+            }
+        }
+    }
+    // compiler clones: func.isra.0, func.part.1, func.cold
+    const size_t clone = name.find('.');
+    if (clone != string::npos && clone > 0) {
+        name = name.substr(0, clone);
+    }
+    return name;
+}
+
+vector<PerfProfile::FunctionKey> PerfProfile::resolve(const Frame &frame) const {
+    string name = normaliseSymbol(frame.symbol);
+    auto found = functionsByName.end();
+    // ns::Class::method is stored as Class::method
+    while (true) {
+        found = functionsByName.find(name);
+        if (found != functionsByName.end()) break;
+        const size_t scope = name.find("::");
+        if (scope == string::npos) return {};
+        name = name.substr(scope + 2);
+    }
+
+    const vector<FunctionKey> &candidates = found->second;
+    if (candidates.size() == 1 || frame.sourceFile.empty()) return candidates;
+
+    // Static functions of the same name are told apart by the source file of the frame
+    vector<FunctionKey> matching;
+    for (const FunctionKey &candidate: candidates) {
+        const string &file = candidate.first;
+        if (frame.sourceFile.size() >= file.size() &&
+            frame.sourceFile.compare(frame.sourceFile.size() - file.size(), file.size(), file) == 0) {
+            matching.push_back(candidate);
+        }
+    }
+    return matching.empty() ? candidates : matching;
+}
+
+void PerfProfile::addStack(const vector<Frame> &frames, double weight) {
+    if (frames.empty() || weight <= 0) return;
+    totalWeight += weight;
+
+    set<FunctionKey> sampledFunctions;
+    set<pair<FunctionKey, string>> sampledEdges;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        vector<FunctionKey> callers = resolve(frames[i]);
+        if (callers.empty()) continue;
+        sampledFunctions.insert(callers.begin(), callers.end());
+        if (i + 1 == frames.size()) {
+            for (const FunctionKey &caller: callers) {
+                selfWeight[caller] += weight;
+            }
+            continue;
+        }
+        const string callee = normaliseSymbol(frames[i + 1].symbol);
+        for (const FunctionKey &caller: callers) {
+            auto apis = apisByFunction.find(caller);
+            if (apis != apisByFunction.end() && apis->second.count(callee)) {
+                sampledEdges.insert({caller, callee});
+            }
+        }
+    }
+    // recursion must not count a sample twice
+    for (const FunctionKey &function: sampledFunctions) {
+        inclusiveWeight[function] += weight;
+    }
+    for (const auto &edge: sampledEdges) {
+        edgeWeight[edge] += weight;
+    }
+}
+
+void PerfProfile::parse(istream &is) {
+    string line;
+    vector<Frame> leafFirst;
+    double sampleWeight = 0;
+    bool inSample = false;
+
+    auto flushSample = [&]() {
+        if (inSample) {
+            addStack(vector<Frame>(leafFirst.rbegin(), leafFirst.rend()), sampleWeight);
+        }
+        leafFirst.clear();
+        inSample = false;
+    };
+
+    while (getline(is, line)) {
+        if (trim(line).empty()) {
+            flushSample();
+            continue;
+        }
+        if (line[0] == '#') continue;
+
+        if (line[0] == ' ' || line[0] == '\t') {
+            // perf script frame: "\t    7f3a2b  avcodec_send_frame+0x1f (/usr/lib/libavcodec.so.60)"
+            istringstream tokens(line);
+            string address;
+            tokens >> address;
+            if (isHexAddress(address)) {
+                string rest;
+                getline(tokens, rest);
+                rest = trim(rest);
+                const size_t dso = rest.rfind(" (");
+                if (dso != string::npos && rest.back() == ')') {
+                    rest = trim(rest.substr(0, dso));
+                }
+                leafFirst.push_back({rest, ""});
+                continue;
+            }
+            // srcline of the previous frame: "  /src/obs/ffmpeg-mux.c:123"
+            const string srcline = trim(line);
+            const size_t colon = srcline.rfind(':');
+            if (!leafFirst.empty() && colon != string::npos && isNumber(srcline.substr(colon + 1))) {
+                leafFirst.back().sourceFile = srcline.substr(0, colon);
+            }
+            continue;
+        }
+
+        // folded stack: "main;encode;avcodec_send_frame 42"
+        const size_t space = line.find_last_of(" \t");
+        const string last = space == string::npos ? "" : trim(line.substr(space + 1));
+        if (isNumber(last) && (line.find(';') != string::npos || line.find(':') == string::npos)) {
+            flushSample();
+            vector<Frame> rootFirst;
+            stringstream stack(line.substr(0, space));
+            string symbol;
+            while (getline(stack, symbol, ';')) {
+                rootFirst.push_back({trim(symbol), ""});
+            }
+            addStack(rootFirst, stod(last));
+            continue;
+        }
+
+        // perf script sample header: "x264 1234 [001] 12.345678:     250000 cycles:"
+        flushSample();
+        inSample = true;
+        sampleWeight = 1;
+        istringstream tokens(line);
+        string token;
+        bool afterTime = false;
+        while (tokens >> token) {
+            if (afterTime) {
+                if (isNumber(token)) sampleWeight = stod(token);
+                break;
+            }
+            afterTime = token.back() == ':' && isNumber(token.substr(0, token.size() - 1));
+        }
+    }
+    flushSample();
+}
+
+bool PerfProfile::load(const string &path) {
+    ifstream ifs(path);
+    if (!ifs) {
+        errs() << "Error: Could not read profile '" << path << "'\n";
+        return false;
+    }
+    parse(ifs);
+    return true;
+}
+
+json PerfProfile::report() const {
+    json callSites = json::array();
+    json unseen = json::array();
+    for (const auto &[function, apis]: apisByFunction) {
+        for (const string &api: apis) {
+            auto it = edgeWeight.find({function, api});
+            if (it == edgeWeight.end()) {
+                unseen.push_back({{"file", function.first}, {"function", function.second}, {"api", api}});
+                continue;
+            }
+            callSites.push_back({
+                {"file", function.first}, {"function", function.second}, {"api", api}, {"weight", it->second},
+                {"share", totalWeight > 0 ? it->second / totalWeight : 0}
+            });
+        }
+    }
+    stable_sort(callSites.begin(), callSites.end(), [](const json &a, const json &b) {
+        return a["weight"].get<double>() > b["weight"].get<double>();
+    });
+
+    json functions = json::array();
+    for (const auto &[function, weight]: inclusiveWeight) {
+        auto self = selfWeight.find(function);
+        functions.push_back({
+            {"file", function.first}, {"function", function.second}, {"inclusive", weight},
+            {"self", self == selfWeight.end() ? 0 : self->second}
+        });
+    }
+    stable_sort(functions.begin(), functions.end(), [](const json &a, const json &b) {
+        return a["inclusive"].get<double>() > b["inclusive"].get<double>();
+    });
+
+    for (const auto &site: callSites) {
+        outs() << llvm::format("%.0f", site["weight"].get<double>()) << "\t" << site["file"].get<string>()
+                << " " << site["function"].get<string>() << " -> " << site["api"].get<string>() << "\n";
+    }
+    outs() << unseen.size() << " FFmpeg call sites never sampled\n";
+    return json{{"totalWeight", totalWeight}, {"callSites", callSites}, {"unseen", unseen}, {"functions", functions}};
+}
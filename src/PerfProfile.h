@@ -0,0 +1,72 @@
+#ifndef RUIANALYSIS_PERFPROFILE_H
+#define RUIANALYSIS_PERFPROFILE_H
+
+#include <istream>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * Join sampled call stacks with the FFmpeg call map
+ *
+ * Accepts `perf script` output (optionally with `-F +srcline`) or folded stacks (`a;b;c 42`). Stacks are
+ * streamed and only the weights of sampled functions and caller->API edges are kept.
+ */
+class PerfProfile {
+public:
+    /**
+     * @param callMap {file: {function: [api, ...]}} as written to ffmpeg_calls.json
+     */
+    explicit PerfProfile(const nlohmann::json &callMap);
+
+    /**
+     * Read a profile, the format is detected per record
+     *
+     * @param path
+     * @return false if the file cannot be read
+     */
+    bool load(const std::string &path);
+
+    /**
+     * Rank FFmpeg call edges by sample weight and list the ones never sampled
+     *
+     * @return {"totalWeight": ..., "callSites": [...], "unseen": [...], "functions": [...]}
+     */
+    nlohmann::json report() const;
+
+private:
+    // function of the call map: (file, function)
+    using FunctionKey = std::pair<std::string, std::string>;
+
+    struct Frame {
+        std::string symbol;
+        std::string sourceFile;
+    };
+
+    std::map<std::string, std::vector<FunctionKey>> functionsByName;
+    std::map<FunctionKey, std::set<std::string>> apisByFunction;
+
+    double totalWeight = 0;
+    std::map<FunctionKey, double> inclusiveWeight;
+    std::map<FunctionKey, double> selfWeight;
+    std::map<std::pair<FunctionKey, std::string>, double> edgeWeight;
+
+    static std::string normaliseSymbol(const std::string &symbol);
+
+    std::vector<FunctionKey> resolve(const Frame &frame) const;
+
+    /**
+     * Account one sampled stack
+     *
+     * @param frames root first
+     * @param weight
+     */
+    void addStack(const std::vector<Frame> &frames, double weight);
+
+    void parse(std::istream &is);
+};
+
+#endif // RUIANALYSIS_PERFPROFILE_H
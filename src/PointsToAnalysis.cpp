@@ -0,0 +1,327 @@
+#include "PointsToAnalysis.h"
+
+#include <set>
+#include <utility>
+#include "FFmpegUtils.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Index/USRGeneration.h"
+#include "llvm/ADT/SmallString.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+/**
+ * Visitor class: turn assignments, initialisers, calls and returns into unifications
+ */
+class PointsToVisitor : public RecursiveASTVisitor<PointsToVisitor> {
+    PointsToAnalysis &analysis;
+    const ASTContext &Context;
+    string fileKey;
+    const FunctionDecl *current = nullptr;
+
+public:
+    PointsToVisitor(PointsToAnalysis &analysis, const ASTContext &Context, string fileKey)
+        : analysis(analysis), Context(Context), fileKey(std::move(fileKey)) {
+    }
+
+    bool TraverseDecl(Decl *decl) {
+        auto *func = dyn_cast_or_null<FunctionDecl>(decl);
+        if (!func || !func->doesThisDeclarationHaveABody()) {
+            return RecursiveASTVisitor::TraverseDecl(decl);
+        }
+        // bodies in system headers do not store project callbacks
+        if (Context.getSourceManager().isInSystemHeader(func->getLocation())) return true;
+        const FunctionDecl *outer = current;
+        current = func;
+        const bool result = RecursiveASTVisitor::TraverseDecl(decl);
+        current = outer;
+        return result;
+    }
+
+    bool VisitVarDecl(VarDecl *var) {
+        if (isa<ParmVarDecl>(var) || !var->getInit()) return true;
+        analysis.initialise(analysis.variableNode(var, Context), var->getInit(), Context);
+        return true;
+    }
+
+    bool VisitBinaryOperator(BinaryOperator *op) {
+        if (op->getOpcode() != BO_Assign || op->isInstantiationDependent()) return true;
+        analysis.join(analysis.pointeeOf(analysis.location(op->getLHS(), Context)),
+                      analysis.value(op->getRHS(), Context));
+        return true;
+    }
+
+    bool VisitCallExpr(CallExpr *call) {
+        if (call->isInstantiationDependent()) return true;
+        const FunctionDecl *callee = call->getDirectCallee();
+        const size_t target = callee ? analysis.functionNode(callee, Context) : analysis.value(call->getCallee(), Context);
+
+        // the object of an operator method is its first argument
+        const unsigned skipped = isa<CXXOperatorCallExpr>(call) && isa_and_nonnull<CXXMethodDecl>(callee) ? 1 : 0;
+        for (unsigned i = skipped; i < call->getNumArgs(); ++i) {
+            analysis.join(analysis.parameterOf(target, i - skipped), analysis.value(call->getArg(i), Context));
+        }
+        if (!callee && current) {
+            analysis.indirectCalls.push_back({fileKey, getMethodFullName(current), target});
+        }
+        return true;
+    }
+
+    bool VisitReturnStmt(ReturnStmt *ret) {
+        if (!current || !ret->getRetValue() || ret->getRetValue()->isInstantiationDependent()) return true;
+        analysis.join(analysis.returnOf(analysis.functionNode(current, Context)),
+                      analysis.value(ret->getRetValue(), Context));
+        return true;
+    }
+};
+
+size_t PointsToAnalysis::makeNode() {
+    const size_t node = parent.size();
+    parent.push_back(node);
+    rank.push_back(0);
+    pointee.push_back(none);
+    parameters.emplace_back();
+    returns.push_back(none);
+    functions.emplace_back();
+    return node;
+}
+
+size_t PointsToAnalysis::find(size_t node) {
+    // path halving
+    while (parent[node] != node) {
+        parent[node] = parent[parent[node]];
+        node = parent[node];
+    }
+    return node;
+}
+
+void PointsToAnalysis::join(size_t a, size_t b) {
+    // unifying two classes unifies what they point to and their signatures, without recursion
+    vector<pair<size_t, size_t>> pending{{a, b}};
+    while (!pending.empty()) {
+        auto [x, y] = pending.back();
+        pending.pop_back();
+        x = find(x);
+        y = find(y);
+        if (x == y) continue;
+        if (rank[x] < rank[y]) swap(x, y);
+        parent[y] = x;
+        if (rank[x] == rank[y]) rank[x]++;
+
+        if (functions[x].size() < functions[y].size()) swap(functions[x], functions[y]);
+        functions[x].insert(functions[x].end(), functions[y].begin(), functions[y].end());
+        vector<size_t>().swap(functions[y]);
+
+        for (vector<size_t> *slots: {&pointee, &returns}) {
+            if ((*slots)[y] == none) continue;
+            if ((*slots)[x] == none) {
+                (*slots)[x] = (*slots)[y];
+            } else {
+                pending.push_back({(*slots)[x], (*slots)[y]});
+            }
+        }
+        for (size_t i = 0; i < parameters[y].size(); ++i) {
+            if (i < parameters[x].size()) {
+                pending.push_back({parameters[x][i], parameters[y][i]});
+            } else {
+                parameters[x].push_back(parameters[y][i]);
+            }
+        }
+        vector<size_t>().swap(parameters[y]);
+    }
+}
+
+size_t PointsToAnalysis::pointeeOf(size_t node) {
+    const size_t root = find(node);
+    if (pointee[root] == none) {
+        const size_t fresh = makeNode();
+        pointee[root] = fresh;
+    }
+    return pointee[root];
+}
+
+size_t PointsToAnalysis::parameterOf(size_t function, size_t index) {
+    const size_t root = find(function);
+    while (parameters[root].size() <= index) {
+        const size_t fresh = makeNode();
+        parameters[root].push_back(fresh);
+    }
+    return parameters[root][index];
+}
+
+size_t PointsToAnalysis::returnOf(size_t function) {
+    const size_t root = find(function);
+    if (returns[root] == none) {
+        const size_t fresh = makeNode();
+        returns[root] = fresh;
+    }
+    return returns[root];
+}
+
+size_t PointsToAnalysis::namedNode(const string &key) {
+    auto [entry, inserted] = named.emplace(key, none);
+    if (inserted) {
+        entry->second = makeNode();
+    }
+    return entry->second;
+}
+
+string PointsToAnalysis::declarationKey(const Decl *decl) const {
+    SmallString<128> usr;
+    if (!index::generateUSRForDecl(decl, usr)) return string(usr);
+    return currentFile + "@" + to_string(reinterpret_cast<uintptr_t>(decl->getCanonicalDecl()));
+}
+
+size_t PointsToAnalysis::functionNode(const FunctionDecl *func, const ASTContext &Context) {
+    const string key = "F:" + declarationKey(func);
+    const bool known = named.count(key);
+    const size_t node = namedNode(key);
+    if (!known) {
+        functions[node].push_back(targets.size());
+        targets.push_back({getMethodFullName(func), isFFmpegAPIDecl(func, Context)});
+    }
+    return node;
+}
+
+size_t PointsToAnalysis::variableNode(const ValueDecl *decl, const ASTContext &Context) {
+    if (const auto *indirect = dyn_cast<IndirectFieldDecl>(decl)) {
+        decl = indirect->getAnonField();
+    }
+    // a parameter is the slot the arguments of every call flow into
+    if (const auto *param = dyn_cast<ParmVarDecl>(decl)) {
+        if (const auto *func = dyn_cast<FunctionDecl>(param->getDeclContext())) {
+            const string key = "P:" + declarationKey(func) + "#" + to_string(param->getFunctionScopeIndex());
+            const bool known = named.count(key);
+            const size_t node = namedNode(key);
+            if (!known) {
+                join(pointeeOf(node), parameterOf(functionNode(func, Context), param->getFunctionScopeIndex()));
+            }
+            return node;
+        }
+    }
+    return namedNode("V:" + declarationKey(decl));
+}
+
+size_t PointsToAnalysis::location(const Expr *expr, const ASTContext &Context) {
+    expr = expr->IgnoreParens();
+    if (const auto *ref = dyn_cast<DeclRefExpr>(expr)) {
+        if (const auto *func = dyn_cast<FunctionDecl>(ref->getDecl())) return functionNode(func, Context);
+        if (isa<VarDecl>(ref->getDecl())) return variableNode(ref->getDecl(), Context);
+        return makeNode();
+    }
+    if (const auto *member = dyn_cast<MemberExpr>(expr)) {
+        // field-based: one location per field of a type, whatever the object
+        const ValueDecl *decl = member->getMemberDecl();
+        if (isa<FieldDecl, IndirectFieldDecl, VarDecl>(decl)) return variableNode(decl, Context);
+        return makeNode();
+    }
+    if (const auto *unary = dyn_cast<UnaryOperator>(expr)) {
+        if (unary->getOpcode() == UO_Deref) return value(unary->getSubExpr(), Context);
+        return makeNode();
+    }
+    // array elements are collapsed into the array
+    if (const auto *subscript = dyn_cast<ArraySubscriptExpr>(expr)) return value(subscript->getBase(), Context);
+    if (const auto *cast = dyn_cast<CastExpr>(expr)) return location(cast->getSubExpr(), Context);
+    if (const auto *literal = dyn_cast<CompoundLiteralExpr>(expr)) {
+        const size_t slot = makeNode();
+        initialise(slot, literal->getInitializer(), Context);
+        return slot;
+    }
+    return makeNode();
+}
+
+size_t PointsToAnalysis::value(const Expr *expr, const ASTContext &Context) {
+    expr = expr->IgnoreParens();
+    if (const auto *cast = dyn_cast<CastExpr>(expr)) {
+        switch (cast->getCastKind()) {
+            case CK_LValueToRValue:
+                return pointeeOf(location(cast->getSubExpr(), Context));
+            case CK_ArrayToPointerDecay:
+            case CK_FunctionToPointerDecay:
+            case CK_BuiltinFnToFnPtr:
+                return location(cast->getSubExpr(), Context);
+            default:
+                return value(cast->getSubExpr(), Context);
+        }
+    }
+    if (const auto *unary = dyn_cast<UnaryOperator>(expr)) {
+        if (unary->getOpcode() == UO_AddrOf) return location(unary->getSubExpr(), Context);
+        if (unary->getOpcode() == UO_Deref) return pointeeOf(value(unary->getSubExpr(), Context));
+        return value(unary->getSubExpr(), Context);
+    }
+    if (const auto *binary = dyn_cast<BinaryOperator>(expr)) {
+        if (binary->isAssignmentOp() || binary->getOpcode() == BO_Comma) return value(binary->getRHS(), Context);
+        if (binary->isAdditiveOp()) {
+            return value(binary->getLHS()->getType()->isPointerType() ? binary->getLHS() : binary->getRHS(), Context);
+        }
+        return makeNode();
+    }
+    if (const auto *conditional = dyn_cast<ConditionalOperator>(expr)) {
+        const size_t result = value(conditional->getTrueExpr(), Context);
+        join(result, value(conditional->getFalseExpr(), Context));
+        return result;
+    }
+    if (const auto *call = dyn_cast<CallExpr>(expr)) {
+        const FunctionDecl *callee = call->getDirectCallee();
+        return returnOf(callee ? functionNode(callee, Context) : value(call->getCallee(), Context));
+    }
+    if (expr->isGLValue()) return pointeeOf(location(expr, Context));
+    return makeNode();
+}
+
+void PointsToAnalysis::initialise(size_t slot, const Expr *init, const ASTContext &Context) {
+    init = init->IgnoreParens();
+    if (isa<ImplicitValueInitExpr>(init)) return;
+    const auto *list = dyn_cast<InitListExpr>(init);
+    if (!list) {
+        join(pointeeOf(slot), value(init, Context));
+        return;
+    }
+
+    if (const RecordDecl *record = list->getType()->getAsRecordDecl()) {
+        if (record->isUnion()) {
+            const FieldDecl *field = list->getInitializedFieldInUnion();
+            if (field && list->getNumInits() > 0) {
+                initialise(variableNode(field, Context), list->getInit(0), Context);
+            }
+            return;
+        }
+        // aggregate bases come before the fields
+        unsigned i = 0;
+        if (const auto *cxxRecord = dyn_cast<CXXRecordDecl>(record)) {
+            i = cxxRecord->getNumBases();
+        }
+        for (const FieldDecl *field: record->fields()) {
+            if (i >= list->getNumInits()) break;
+            initialise(variableNode(field, Context), list->getInit(i++), Context);
+        }
+        return;
+    }
+    // arrays are collapsed into one location, a scalar in braces initialises the slot itself
+    for (const Expr *element: list->inits()) {
+        initialise(slot, element, Context);
+    }
+}
+
+void PointsToAnalysis::addTranslationUnit(ASTContext &Context, const string &fileName) {
+    currentFile = fileName;
+    PointsToVisitor visitor(*this, Context, toDisplayPath(fileName));
+    visitor.TraverseDecl(Context.getTranslationUnitDecl());
+}
+
+json PointsToAnalysis::resolve() {
+    json result = json::object();
+    set<string> seen;
+    for (const IndirectCall &call: indirectCalls) {
+        for (const size_t target: functions[find(call.callee)]) {
+            const Target &function = targets[target];
+            if (!seen.insert(call.fileKey + "\n" + call.function + "\n" + function.name).second) continue;
+            result[call.fileKey][call.function].push_back({{"callee", function.name}, {"ffmpeg", function.ffmpeg}});
+        }
+    }
+    return result;
+}
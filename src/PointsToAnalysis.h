@@ -0,0 +1,101 @@
+#ifndef RUIANALYSIS_POINTSTOANALYSIS_H
+#define RUIANALYSIS_POINTSTOANALYSIS_H
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+
+/**
+ * Resolve calls through function pointers with a unification-based points-to analysis
+ *
+ * Flow-insensitive and field-based in the style of Steensgaard: every assignment, initialiser, argument
+ * and return unifies the abstract locations on both sides, so the analysis runs in near-linear time in
+ * the number of statements. Locations are keyed by USR, which makes globals, struct fields and functions
+ * the same location in every translation unit; a callback stored in a field in one file resolves a call
+ * through that field in another. All fields of a struct type share one location per field, whatever
+ * the instance, which is what callback tables need.
+ */
+class PointsToAnalysis {
+public:
+    /**
+     * Add the assignments of a translation unit and record its indirect calls
+     *
+     * @param Context
+     * @param fileName
+     */
+    void addTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Targets of the recorded indirect calls
+     *
+     * @return {file: {function: [{"callee": ..., "ffmpeg": bool}]}}
+     */
+    nlohmann::json resolve();
+
+    size_t size() const {
+        return parent.size();
+    }
+
+private:
+    static constexpr size_t none = static_cast<size_t>(-1);
+
+    struct Target {
+        std::string name;
+        bool ffmpeg;
+    };
+
+    struct IndirectCall {
+        std::string fileKey;
+        std::string function;
+        size_t callee;
+    };
+
+    // union-find over abstract locations, the data of a class is kept at its representative
+    std::vector<size_t> parent;
+    std::vector<unsigned char> rank;
+    std::vector<size_t> pointee;
+    std::vector<std::vector<size_t>> parameters;
+    std::vector<size_t> returns;
+    std::vector<std::vector<size_t>> functions;
+
+    std::unordered_map<std::string, size_t> named;
+    // declarations without a USR are only known within the current translation unit
+    std::string currentFile;
+    std::vector<Target> targets;
+    std::vector<IndirectCall> indirectCalls;
+
+    size_t makeNode();
+
+    size_t find(size_t node);
+
+    void join(size_t a, size_t b);
+
+    size_t pointeeOf(size_t node);
+
+    size_t parameterOf(size_t function, size_t index);
+
+    size_t returnOf(size_t function);
+
+    size_t namedNode(const std::string &key);
+
+    std::string declarationKey(const clang::Decl *decl) const;
+
+    size_t functionNode(const clang::FunctionDecl *func, const clang::ASTContext &Context);
+
+    size_t variableNode(const clang::ValueDecl *decl, const clang::ASTContext &Context);
+
+    size_t location(const clang::Expr *expr, const clang::ASTContext &Context);
+
+    size_t value(const clang::Expr *expr, const clang::ASTContext &Context);
+
+    void initialise(size_t slot, const clang::Expr *init, const clang::ASTContext &Context);
+
+    friend class PointsToVisitor;
+};
+
+#endif // RUIANALYSIS_POINTSTOANALYSIS_H
@@ -0,0 +1,321 @@
+#include "ProbeRewriter.h"
+
+#include <filesystem>
+#include <fstream>
+#include "CallSites.h"
+#include "FFmpegUtils.h"
+#include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+
+static const char *const probeHeader = R"(#ifndef RUI_PROBE_H
+#define RUI_PROBE_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t rui_probe_ticks(void)
+{
+	return __rdtsc();
+}
+#elif defined(__aarch64__)
+static inline uint64_t rui_probe_ticks(void)
+{
+	uint64_t ticks;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+}
+#else
+#include <time.h>
+static inline uint64_t rui_probe_ticks(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void rui_probe_record(uint32_t site, uint64_t ticks);
+#ifdef __cplusplus
+}
+#endif
+
+#define RUI_PROBE(site, ...)                                                   \
+	({                                                                     \
+		uint64_t rui_probe_start_ = rui_probe_ticks();                 \
+		__typeof__(__VA_ARGS__) rui_probe_result_ = (__VA_ARGS__);     \
+		rui_probe_record((site), rui_probe_ticks() - rui_probe_start_); \
+		rui_probe_result_;                                             \
+	})
+
+#define RUI_PROBE_VOID(site, ...)                                              \
+	({                                                                     \
+		uint64_t rui_probe_start_ = rui_probe_ticks();                 \
+		__VA_ARGS__;                                                   \
+		rui_probe_record((site), rui_probe_ticks() - rui_probe_start_); \
+	})
+
+#endif
+)";
+
+// Runtime library, appended after the site table
+static const char *const probeRuntime = R"(
+/* events per thread ring, power of two */
+#ifndef RUI_PROBE_RING_SIZE
+#define RUI_PROBE_RING_SIZE 16384
+#endif
+/* drain interval of the aggregator thread */
+#ifndef RUI_PROBE_DRAIN_NANOS
+#define RUI_PROBE_DRAIN_NANOS 5000000
+#endif
+#define RUI_PROBE_BUCKETS 64
+
+struct rui_probe_event {
+	uint32_t site;
+	uint64_t ticks;
+};
+
+/* single producer (owning thread), single consumer (aggregator) */
+struct rui_probe_ring {
+	_Atomic uint64_t head;
+	_Atomic uint64_t tail;
+	_Atomic uint64_t dropped;
+	struct rui_probe_event events[RUI_PROBE_RING_SIZE];
+	struct rui_probe_ring *next;
+};
+
+static _Atomic(struct rui_probe_ring *) rui_probe_rings;
+static _Thread_local struct rui_probe_ring *rui_probe_local;
+static pthread_once_t rui_probe_once = PTHREAD_ONCE_INIT;
+
+/* aggregated histograms, only touched with rui_probe_lock held */
+static pthread_mutex_t rui_probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t rui_probe_histogram[RUI_PROBE_SITE_COUNT][RUI_PROBE_BUCKETS];
+static uint64_t rui_probe_calls[RUI_PROBE_SITE_COUNT];
+static uint64_t rui_probe_total[RUI_PROBE_SITE_COUNT];
+static uint64_t rui_probe_dropped;
+static uint64_t rui_probe_start_ticks;
+static uint64_t rui_probe_start_nanos;
+
+static uint64_t rui_probe_nanos(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void rui_probe_drain(void)
+{
+	pthread_mutex_lock(&rui_probe_lock);
+	for (struct rui_probe_ring *ring = atomic_load(&rui_probe_rings); ring; ring = ring->next) {
+		uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		for (; tail < head; tail++) {
+			const struct rui_probe_event *event = &ring->events[tail & (RUI_PROBE_RING_SIZE - 1)];
+			if (event->site >= RUI_PROBE_SITE_COUNT)
+				continue;
+			unsigned bucket = 63 - (unsigned)__builtin_clzll(event->ticks | 1);
+			rui_probe_histogram[event->site][bucket]++;
+			rui_probe_calls[event->site]++;
+			rui_probe_total[event->site] += event->ticks;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		rui_probe_dropped += atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&rui_probe_lock);
+}
+
+static void *rui_probe_drain_thread(void *unused)
+{
+	(void)unused;
+	const struct timespec interval = {0, RUI_PROBE_DRAIN_NANOS};
+	for (;;) {
+		nanosleep(&interval, NULL);
+		rui_probe_drain();
+	}
+	return NULL;
+}
+
+static void rui_probe_start(void)
+{
+	rui_probe_start_ticks = rui_probe_ticks();
+	rui_probe_start_nanos = rui_probe_nanos();
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, rui_probe_drain_thread, NULL) == 0)
+		pthread_detach(thread);
+}
+
+static struct rui_probe_ring *rui_probe_register(void)
+{
+	pthread_once(&rui_probe_once, rui_probe_start);
+
+	struct rui_probe_ring *ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	struct rui_probe_ring *head = atomic_load(&rui_probe_rings);
+	do {
+		ring->next = head;
+	} while (!atomic_compare_exchange_weak(&rui_probe_rings, &head, ring));
+	rui_probe_local = ring;
+	return ring;
+}
+
+void rui_probe_record(uint32_t site, uint64_t ticks)
+{
+	struct rui_probe_ring *ring = rui_probe_local ? rui_probe_local : rui_probe_register();
+	if (!ring)
+		return;
+
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail >= RUI_PROBE_RING_SIZE) {
+		/* never block the probed thread, the aggregator counts the loss */
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	ring->events[head & (RUI_PROBE_RING_SIZE - 1)] = (struct rui_probe_event){site, ticks};
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+__attribute__((destructor)) static void rui_probe_report(void)
+{
+	rui_probe_drain();
+
+	pthread_mutex_lock(&rui_probe_lock);
+	double ticks_per_nano = 1;
+	uint64_t elapsed_nanos = rui_probe_nanos() - rui_probe_start_nanos;
+	if (rui_probe_start_nanos && elapsed_nanos)
+		ticks_per_nano = (double)(rui_probe_ticks() - rui_probe_start_ticks) / (double)elapsed_nanos;
+
+	const char *path = getenv("RUI_PROBE_OUTPUT");
+	FILE *out = path ? fopen(path, "w") : NULL;
+	if (!out)
+		out = stderr;
+
+	fprintf(out, "{\n  \"ticksPerNano\": %f,\n  \"dropped\": %llu,\n  \"sites\": [", ticks_per_nano,
+		(unsigned long long)rui_probe_dropped);
+	int first_site = 1;
+	for (uint32_t site = 0; site < RUI_PROBE_SITE_COUNT; site++) {
+		if (!rui_probe_calls[site])
+			continue;
+		const struct rui_probe_site *info = &rui_probe_sites[site];
+		fprintf(out,
+			"%s\n    {\"site\": %u, \"file\": \"%s\", \"line\": %u, \"function\": \"%s\", \"api\": \"%s\", "
+			"\"calls\": %llu, \"ticks\": %llu, \"nanos\": %.0f, \"histogram\": {",
+			first_site ? "" : ",", site, info->file, info->line, info->function, info->api,
+			(unsigned long long)rui_probe_calls[site], (unsigned long long)rui_probe_total[site],
+			(double)rui_probe_total[site] / ticks_per_nano);
+		first_site = 0;
+		/* bucket k holds calls of [2^k, 2^(k+1)) ticks */
+		int first_bucket = 1;
+		for (unsigned bucket = 0; bucket < RUI_PROBE_BUCKETS; bucket++) {
+			if (!rui_probe_histogram[site][bucket])
+				continue;
+			fprintf(out, "%s\"%llu\": %llu", first_bucket ? "" : ", ", 1ull << bucket,
+				(unsigned long long)rui_probe_histogram[site][bucket]);
+			first_bucket = 0;
+		}
+		fprintf(out, "}}");
+	}
+	fprintf(out, "\n  ]\n}\n");
+	pthread_mutex_unlock(&rui_probe_lock);
+
+	if (out != stderr)
+		fclose(out);
+}
+)";
+
+static string escapeCString(const string &text) {
+    string escaped;
+    for (char c: text) {
+        if (c == '\\' || c == '"') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+void ProbeRewriter::rewriteTranslationUnit(ASTContext &Context, const string &fileName) {
+    const string fileKey = toDisplayPath(fileName);
+    if (!rewrittenFiles.insert(fileKey).second) return;
+
+    SourceManager &SM = Context.getSourceManager();
+    Rewriter rewriter(SM, Context.getLangOpts());
+    const FileID mainFile = SM.getMainFileID();
+
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        for (const CallSite &site: collectCallSites(func, Context)) {
+            if (!site.ffmpeg) continue;
+            // Calls spelled inside macros cannot be wrapped textually
+            const SourceLocation begin = site.expr->getBeginLoc();
+            const SourceLocation end = site.expr->getEndLoc();
+            if (!begin.isFileID() || !end.isFileID() || SM.getFileID(begin) != mainFile) continue;
+
+            const unsigned id = sites.size();
+            sites.push_back({fileKey, getMethodFullName(func), site.callee, SM.getSpellingLineNumber(begin)});
+            const string macro = site.expr->getType()->isVoidType() ? "RUI_PROBE_VOID(" : "RUI_PROBE(";
+            rewriter.InsertTextBefore(begin, macro + to_string(id) + ", ");
+            rewriter.InsertTextAfterToken(end, ")");
+        }
+    }
+
+    const auto *buffer = rewriter.getRewriteBufferFor(mainFile);
+    if (!buffer) return;
+
+    const filesystem::path target = filesystem::path(outputDir) / fileKey;
+    std::error_code ec;
+    filesystem::create_directories(target.parent_path(), ec);
+    ofstream ofs(target, ios::out | ios::trunc);
+    if (!ofs) {
+        errs() << "Error: Could not write '" << target.string() << "'\n";
+        return;
+    }
+    ofs << "#include \"rui_probe.h\"\n" << string(buffer->begin(), buffer->end());
+    outs() << "Probed " << fileKey << " -> " << target.string() << "\n";
+}
+
+bool ProbeRewriter::writeRuntime() const {
+    std::error_code ec;
+    filesystem::create_directories(outputDir, ec);
+
+    ofstream header(filesystem::path(outputDir) / "rui_probe.h", ios::out | ios::trunc);
+    ofstream runtime(filesystem::path(outputDir) / "rui_probe.c", ios::out | ios::trunc);
+    if (!header || !runtime) {
+        errs() << "Error: Could not write probe runtime to '" << outputDir << "'\n";
+        return false;
+    }
+    header << probeHeader;
+
+    runtime << "/* Probe runtime generated by RuiAnalysis, build it into the probed program */\n"
+            << "#include \"rui_probe.h\"\n"
+            << "#include <pthread.h>\n"
+            << "#include <stdatomic.h>\n"
+            << "#include <stdio.h>\n"
+            << "#include <stdlib.h>\n"
+            << "#include <time.h>\n\n"
+            << "#define RUI_PROBE_SITE_COUNT " << (sites.empty() ? 1 : sites.size()) << "\n\n"
+            << "struct rui_probe_site {\n"
+            << "\tconst char *file;\n"
+            << "\tconst char *function;\n"
+            << "\tconst char *api;\n"
+            << "\tunsigned line;\n"
+            << "};\n\n"
+            << "static const struct rui_probe_site rui_probe_sites[RUI_PROBE_SITE_COUNT] = {\n";
+    for (const ProbeSite &site: sites) {
+        runtime << "\t{\"" << escapeCString(site.file) << "\", \"" << escapeCString(site.function) << "\", \""
+                << escapeCString(site.api) << "\", " << site.line << "},\n";
+    }
+    if (sites.empty()) {
+        runtime << "\t{\"\", \"\", \"\", 0},\n";
+    }
+    runtime << "};\n" << probeRuntime;
+    return true;
+}
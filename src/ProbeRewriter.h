@@ -0,0 +1,47 @@
+#ifndef RUIANALYSIS_PROBEREWRITER_H
+#define RUIANALYSIS_PROBEREWRITER_H
+
+#include <set>
+#include <string>
+#include <vector>
+#include "clang/AST/ASTContext.h"
+
+/**
+ * Wrap FFmpeg call sites in timing probes
+ *
+ * Every FFmpeg call of a main file becomes RUI_PROBE(<site>, call) and the rewritten file is written
+ * below the output directory. rui_probe.h/rui_probe.c provide the probes: the elapsed TSC ticks of each
+ * call go into a per-thread ring buffer which a drain thread folds into per-site log2 histograms.
+ */
+class ProbeRewriter {
+public:
+    explicit ProbeRewriter(std::string outputDir) : outputDir(std::move(outputDir)) {
+    }
+
+    void rewriteTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Write rui_probe.h and rui_probe.c with the table of all probed sites
+     *
+     * @return false if the files cannot be written
+     */
+    bool writeRuntime() const;
+
+    size_t size() const {
+        return sites.size();
+    }
+
+private:
+    struct ProbeSite {
+        std::string file;
+        std::string function;
+        std::string api;
+        unsigned line;
+    };
+
+    std::string outputDir;
+    std::vector<ProbeSite> sites;
+    std::set<std::string> rewrittenFiles;
+};
+
+#endif // RUIANALYSIS_PROBEREWRITER_H
@@ -0,0 +1,279 @@
+#include "QueryServer.h"
+
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <optional>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "llvm/Support/Errno.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+// JSON-RPC 2.0 error codes
+static constexpr int parseError = -32700;
+static constexpr int invalidRequest = -32600;
+static constexpr int methodNotFound = -32601;
+static constexpr int invalidParams = -32602;
+
+static json rpcError(const json &id, int code, const string &message) {
+    return {{"jsonrpc", "2.0"}, {"id", id}, {"error", {{"code", code}, {"message", message}}}};
+}
+
+static json describeFunction(const pair<string, string> &function) {
+    return {{"file", function.first}, {"function", function.second}};
+}
+
+void QueryServer::update(const json &ffmpegCalls, const json &callGraph, const json &indirectCalls) {
+    auto next = make_shared<Index>();
+    for (const auto &[file, functions]: indirectCalls.items()) {
+        for (const auto &[function, callees]: functions.items()) {
+            for (const auto &callee: callees) {
+                next->indirect[{file, function}].insert(callee.get<string>());
+            }
+        }
+    }
+    for (const auto &[file, functions]: ffmpegCalls.items()) {
+        for (const auto &[function, apis]: functions.items()) {
+            for (const auto &api: apis) {
+                next->ffmpegApis.insert(api.get<string>());
+            }
+        }
+    }
+    // the call graph holds every callee, the FFmpeg calls are merged for functions missing from it
+    for (const json *source: {&callGraph, &ffmpegCalls}) {
+        for (const auto &[file, functions]: source->items()) {
+            for (const auto &[function, callees]: functions.items()) {
+                FunctionKey key{file, function};
+                if (next->callees.count(key)) continue;
+                vector<string> &targets = next->callees[key];
+                set<string> seen;
+                for (const auto &callee: callees) {
+                    const string name = callee.get<string>();
+                    if (!seen.insert(name).second) continue;
+                    targets.push_back(name);
+                    next->callers[name].push_back(key);
+                }
+                next->functionsByName[function].push_back(key);
+                next->functionsByFile[file].push_back(function);
+            }
+        }
+    }
+    lock_guard<mutex> guard(indexMutex);
+    index = std::move(next);
+}
+
+vector<QueryServer::FunctionKey> QueryServer::lookup(const Index &snapshot, const json &params) {
+    const string function = params.at("function").get<string>();
+    auto found = snapshot.functionsByName.find(function);
+    if (found == snapshot.functionsByName.end()) return {};
+    if (!params.contains("file")) return found->second;
+
+    const string file = params["file"].get<string>();
+    vector<FunctionKey> matches;
+    for (const FunctionKey &key: found->second) {
+        if (key.first == file) matches.push_back(key);
+    }
+    return matches;
+}
+
+optional<json> QueryServer::call(const Index &snapshot, const string &method, const json &params) const {
+    if (method == "callersOf") {
+        json result = json::array();
+        auto found = snapshot.callers.find(params.at("name").get<string>());
+        if (found != snapshot.callers.end()) {
+            for (const FunctionKey &caller: found->second) {
+                result.push_back(describeFunction(caller));
+            }
+        }
+        return result;
+    }
+    if (method == "calleesOf") {
+        json result = json::array();
+        for (const FunctionKey &key: lookup(snapshot, params)) {
+            json entry = describeFunction(key);
+            json ffmpeg = json::array();
+            json project = json::array();
+            for (const string &callee: snapshot.callees.at(key)) {
+                (snapshot.ffmpegApis.count(callee) ? ffmpeg : project).push_back(callee);
+            }
+            entry["ffmpeg"] = ffmpeg;
+            entry["project"] = project;
+            auto indirect = snapshot.indirect.find(key);
+            entry["indirect"] = indirect == snapshot.indirect.end() ? json::array() : json(indirect->second);
+            result.push_back(entry);
+        }
+        return result;
+    }
+    if (method == "fileSummary") {
+        const string file = params.at("file").get<string>();
+        json functions = json::object();
+        set<string> apis;
+        auto found = snapshot.functionsByFile.find(file);
+        if (found != snapshot.functionsByFile.end()) {
+            for (const string &function: found->second) {
+                json used = json::array();
+                for (const string &callee: snapshot.callees.at({file, function})) {
+                    if (!snapshot.ffmpegApis.count(callee)) continue;
+                    used.push_back(callee);
+                    apis.insert(callee);
+                }
+                functions[function] = used;
+            }
+        }
+        return json{{"file", file}, {"functions", functions}, {"apis", apis}};
+    }
+    if (method == "reachable") {
+        // breadth-first over project functions, callees are resolved by name like the perf join
+        set<FunctionKey> visited;
+        set<string> apis;
+        deque<FunctionKey> queue;
+        for (const FunctionKey &key: lookup(snapshot, params)) {
+            if (visited.insert(key).second) queue.push_back(key);
+        }
+        while (!queue.empty()) {
+            const FunctionKey key = queue.front();
+            queue.pop_front();
+            for (const string &callee: snapshot.callees.at(key)) {
+                if (snapshot.ffmpegApis.count(callee)) {
+                    apis.insert(callee);
+                }
+                auto targets = snapshot.functionsByName.find(callee);
+                if (targets == snapshot.functionsByName.end()) continue;
+                for (const FunctionKey &target: targets->second) {
+                    if (visited.insert(target).second) queue.push_back(target);
+                }
+            }
+        }
+        json functions = json::array();
+        for (const FunctionKey &key: visited) {
+            functions.push_back(describeFunction(key));
+        }
+        return json{{"functions", functions}, {"apis", apis}};
+    }
+    return nullopt;
+}
+
+json QueryServer::handle(const json &request) const {
+    if (request.is_array()) {
+        json responses = json::array();
+        for (const json &single: request) {
+            json response = handle(single);
+            if (!response.is_null()) responses.push_back(std::move(response));
+        }
+        return responses.empty() ? json() : responses;
+    }
+    if (!request.is_object() || !request.contains("method") || !request["method"].is_string()) {
+        return rpcError(nullptr, invalidRequest, "Invalid request");
+    }
+    const json id = request.value("id", json());
+    const string method = request["method"].get<string>();
+    const json params = request.value("params", json::object());
+
+    // one snapshot per request, concurrent updates do not change it underneath
+    shared_ptr<const Index> snapshot;
+    {
+        lock_guard<mutex> guard(indexMutex);
+        snapshot = index;
+    }
+    optional<json> result;
+    try {
+        result = call(*snapshot, method, params);
+    } catch (const json::exception &e) {
+        return request.contains("id") ? rpcError(id, invalidParams, e.what()) : json();
+    }
+    if (!request.contains("id")) return json();
+    if (!result) return rpcError(id, methodNotFound, "Unknown method " + method);
+    return {{"jsonrpc", "2.0"}, {"id", id}, {"result", *result}};
+}
+
+// A client closing early must fail the write with EPIPE rather than kill the process with SIGPIPE: Linux
+// takes MSG_NOSIGNAL per call, macOS SO_NOSIGPIPE per socket
+#ifdef MSG_NOSIGNAL
+static constexpr int sendFlags = MSG_NOSIGNAL;
+#else
+static constexpr int sendFlags = 0;
+#endif
+
+void QueryServer::serveConnection(int fd) const {
+    string pending;
+    char buffer[4096];
+    while (true) {
+        const ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) break;
+        pending.append(buffer, length);
+
+        // one request per line
+        size_t newline;
+        while ((newline = pending.find('\n')) != string::npos) {
+            const string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (line.find_first_not_of(" \t\r") == string::npos) continue;
+
+            json response;
+            try {
+                response = handle(json::parse(line));
+            } catch (const json::parse_error &e) {
+                response = rpcError(nullptr, parseError, e.what());
+            }
+            if (response.is_null()) continue;
+            const string text = response.dump() + "\n";
+            for (size_t written = 0; written < text.size();) {
+                const ssize_t count = send(fd, text.data() + written, text.size() - written, sendFlags);
+                if (count < 0 && errno == EINTR) continue;
+                if (count <= 0) {
+                    close(fd);
+                    return;
+                }
+                written += count;
+            }
+        }
+    }
+    close(fd);
+}
+
+int QueryServer::run() const {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        errs() << "Error: Could not listen on '" << socketPath << "': path too long\n";
+        return 1;
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    // SOCK_CLOEXEC and accept4 are missing on macOS
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener >= 0) {
+        fcntl(listener, F_SETFD, FD_CLOEXEC);
+    }
+    unlink(socketPath.c_str());
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        errs() << "Error: Could not listen on '" << socketPath << "': " << sys::StrError() << "\n";
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+    outs() << "Serving queries on " << socketPath << "\n";
+    outs().flush();
+
+    while (true) {
+        const int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR) continue;
+            errs() << "Error: Could not accept a connection: " << sys::StrError() << "\n";
+            close(listener);
+            return 1;
+        }
+        fcntl(connection, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        const int noSigPipe = 1;
+        setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+        thread(&QueryServer::serveConnection, this, connection).detach();
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef RUIANALYSIS_QUERYSERVER_H
+#define RUIANALYSIS_QUERYSERVER_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * Answer call map queries over a Unix domain socket
+ *
+ * Requests are JSON-RPC 2.0 objects, one per line: callersOf {"name"}, calleesOf {"function", "file"?},
+ * fileSummary {"file"} and reachable {"function", "file"?}. calleesOf also lists the callees resolved through
+ * function pointers as "indirect". The results are indexed once into an immutable snapshot; update() builds a
+ * new one and swaps it in, so connections keep reading a consistent snapshot while new results are merged and
+ * only hold the lock to copy the pointer.
+ */
+class QueryServer {
+public:
+    explicit QueryServer(std::string socketPath) : socketPath(std::move(socketPath)) {
+    }
+
+    /**
+     * Index new results and make them visible to the following requests
+     *
+     * @param ffmpegCalls {file: {function: [api, ...]}}
+     * @param callGraph {file: {function: [callee, ...]}}
+     * @param indirectCalls {file: {function: [callee, ...]}}, the callees resolved through function pointers
+     */
+    void update(const nlohmann::json &ffmpegCalls, const nlohmann::json &callGraph,
+                const nlohmann::json &indirectCalls = nlohmann::json::object());
+
+    /**
+     * Answer one request or batch
+     *
+     * @param request
+     * @return the response, null for notifications
+     */
+    nlohmann::json handle(const nlohmann::json &request) const;
+
+    /**
+     * Accept connections until the process is stopped, every connection is served by its own thread
+     *
+     * @return non-zero if the socket cannot be created
+     */
+    int run() const;
+
+private:
+    // function of the call map: (file, function)
+    using FunctionKey = std::pair<std::string, std::string>;
+
+    struct Index {
+        std::map<FunctionKey, std::vector<std::string>> callees;
+        std::map<std::string, std::vector<FunctionKey>> callers;
+        std::map<std::string, std::vector<FunctionKey>> functionsByName;
+        std::set<std::string> ffmpegApis;
+        std::map<std::string, std::vector<std::string>> functionsByFile;
+        std::map<FunctionKey, std::set<std::string>> indirect;
+    };
+
+    std::string socketPath;
+    // std::atomic<std::shared_ptr> is missing from libc++
+    mutable std::mutex indexMutex;
+    std::shared_ptr<const Index> index = std::make_shared<const Index>();
+
+    static std::vector<FunctionKey> lookup(const Index &snapshot, const nlohmann::json &params);
+
+    std::optional<nlohmann::json> call(const Index &snapshot, const std::string &method,
+                                       const nlohmann::json &params) const;
+
+    void serveConnection(int fd) const;
+};
+
+#endif // RUIANALYSIS_QUERYSERVER_H
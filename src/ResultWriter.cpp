@@ -0,0 +1,72 @@
+#include "ResultWriter.h"
+
+#include "ShardMerge.h"
+
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+// finished files waiting to be formatted before the analysis is held back
+static constexpr size_t pendingFiles = 256;
+
+ResultWriter::ResultWriter(const string &streamPath)
+    : queue(pendingFiles), stream(streamPath, ios::out | ios::trunc) {
+    if (!stream) {
+        errs() << "Error: Could not write '" << streamPath << "'\n";
+    }
+    writer = thread(&ResultWriter::serialise, this);
+}
+
+ResultWriter::~ResultWriter() {
+    queue.close();
+    if (writer.joinable()) writer.join();
+}
+
+void ResultWriter::add(string fileKey, json functions) {
+    queue.push({std::move(fileKey), std::move(functions)});
+}
+
+void ResultWriter::serialise() {
+    pair<string, json> result;
+    while (queue.pop(result)) {
+        auto &[fileKey, functions] = result;
+        if (stream) {
+            // flushed per file, readers follow the file while the run continues
+            stream << json::array({fileKey, functions}).dump() << endl;
+        }
+        auto [entry, inserted] = files.emplace(fileKey, "");
+        if (!inserted) {
+            // rare: two translation units with the same display path, or bitcode naming other files
+            json merged = json::parse(entry->second);
+            merged.update(functions);
+            functions = std::move(merged);
+        }
+        entry->second = formatCallMapValue(functions);
+    }
+}
+
+bool ResultWriter::finish(const string &outputPath, raw_ostream *echo) {
+    queue.close();
+    if (writer.joinable()) writer.join();
+    stream.close();
+
+    ofstream ofs(outputPath, ios::out | ios::trunc);
+    if (!ofs) {
+        errs() << "Error: Could not write '" << outputPath << "'\n";
+        return false;
+    }
+    auto write = [&ofs, echo](const string &text) {
+        ofs << text;
+        if (echo) *echo << text;
+    };
+    bool first = true;
+    write("{");
+    for (const auto &[fileKey, text]: files) {
+        write((first ? "\n  " : ",\n  ") + json(fileKey).dump() + ": ");
+        write(text);
+        first = false;
+    }
+    write(first ? "}" : "\n}");
+    if (echo) *echo << "\n";
+    return bool(ofs);
+}
@@ -0,0 +1,58 @@
+#ifndef RUIANALYSIS_RESULTWRITER_H
+#define RUIANALYSIS_RESULTWRITER_H
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <nlohmann/json.hpp>
+#include "llvm/Support/raw_ostream.h"
+#include "BoundedQueue.h"
+
+/**
+ * Serialise the call map of finished translation units while the analysis continues
+ *
+ * A writer thread formats the results of every file as they are handed over and appends them to a stream
+ * file, one line per file, so that the first results are readable while the run is still going. At the end
+ * the formatted files are only concatenated into ffmpeg_calls.json; the handed-over results need not be
+ * kept by the caller.
+ */
+class ResultWriter {
+public:
+    /**
+     * @param streamPath file receiving [file, {function: [api, ...]}] per line, a later line for the same
+     *                   file supersedes the earlier ones
+     */
+    explicit ResultWriter(const std::string &streamPath);
+
+    ~ResultWriter();
+
+    /**
+     * Hand over the results of a file, merged into the ones handed over before for the same file
+     *
+     * @param fileKey
+     * @param functions {function: [api, ...]}
+     */
+    void add(std::string fileKey, nlohmann::json functions);
+
+    /**
+     * Wait for the results handed over and write the call map as json::dump(2) would
+     *
+     * @param outputPath
+     * @param echo also receives the call map when set
+     * @return false if the file cannot be written
+     */
+    bool finish(const std::string &outputPath, llvm::raw_ostream *echo = nullptr);
+
+private:
+    BoundedQueue<std::pair<std::string, nlohmann::json>> queue;
+    // formatted functions by file
+    std::map<std::string, std::string> files;
+    std::ofstream stream;
+    std::thread writer;
+
+    void serialise();
+};
+
+#endif // RUIANALYSIS_RESULTWRITER_H
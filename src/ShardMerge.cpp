@@ -0,0 +1,192 @@
+#include "ShardMerge.h"
+
+#include <fstream>
+#include <memory>
+#include <queue>
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+string shardFileName(unsigned index, unsigned count) {
+    return "ffmpeg_calls." + to_string(index) + "-of-" + to_string(count) + ".shard";
+}
+
+string formatCallMapValue(const json &functions) {
+    const string text = functions.dump(2);
+    string result;
+    result.reserve(text.size());
+    for (char c: text) {
+        result += c;
+        // strings are escaped, every newline is formatting
+        if (c == '\n') result += "  ";
+    }
+    return result;
+}
+
+bool writeShard(const string &path, const json &ffmpegCalls, unsigned index, unsigned count) {
+    ofstream ofs(path, ios::out | ios::trunc);
+    if (!ofs) {
+        errs() << "Error: Could not write shard '" << path << "'\n";
+        return false;
+    }
+    ofs << json{{"shard", index}, {"shards", count}, {"files", ffmpegCalls.size()}}.dump() << "\n";
+    // object keys are sorted, which is the order the merge expects
+    for (const auto &[fileKey, functions]: ffmpegCalls.items()) {
+        ofs << json::array({fileKey, functions}).dump() << "\n";
+    }
+    return bool(ofs);
+}
+
+/**
+ * Reader of the file entries of a shard, one at a time
+ */
+struct ShardReader {
+    string path;
+    ifstream ifs;
+    string fileKey;
+    json functions;
+    size_t remaining = 0;
+    // set when the shard is malformed
+    string error;
+
+    /**
+     * Read the next entry
+     *
+     * @return false at the end of the shard or on error
+     */
+    bool next() {
+        if (remaining == 0) return false;
+        string line;
+        if (!getline(ifs, line)) {
+            error = "truncated";
+            return false;
+        }
+        try {
+            json entry = json::parse(line);
+            string key = entry.at(0).get<string>();
+            if (!fileKey.empty() && key <= fileKey) {
+                error = "files out of order at '" + key + "'";
+                return false;
+            }
+            fileKey = std::move(key);
+            functions = std::move(entry.at(1));
+        } catch (const json::exception &e) {
+            error = e.what();
+            return false;
+        }
+        remaining--;
+        return true;
+    }
+
+    bool failed() const {
+        return !error.empty();
+    }
+};
+
+bool mergeShards(const vector<string> &shards, const string &outputPath) {
+    vector<unique_ptr<ShardReader>> readers;
+    vector<bool> present;
+    unsigned count = 0;
+    for (const string &path: shards) {
+        auto reader = make_unique<ShardReader>();
+        reader->path = path;
+        reader->ifs.open(path);
+        string line;
+        if (!reader->ifs || !getline(reader->ifs, line)) {
+            errs() << "Error: Could not read shard '" << path << "'\n";
+            return false;
+        }
+        unsigned index;
+        try {
+            const json header = json::parse(line);
+            index = header.at("shard").get<unsigned>();
+            if (!count) {
+                count = header.at("shards").get<unsigned>();
+                present.assign(count, false);
+            } else if (header.at("shards").get<unsigned>() != count) {
+                errs() << "Error: Shard '" << path << "' belongs to a run with " << header.at("shards").get<unsigned>()
+                        << " shards, not " << count << "\n";
+                return false;
+            }
+            reader->remaining = header.at("files").get<size_t>();
+        } catch (const json::exception &e) {
+            errs() << "Error: Invalid shard '" << path << "': " << e.what() << "\n";
+            return false;
+        }
+        if (index >= count || present[index]) {
+            errs() << "Error: Shard '" << path << "' is shard " << index << " of " << count << " again\n";
+            return false;
+        }
+        present[index] = true;
+        readers.push_back(std::move(reader));
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        if (!present[i]) {
+            errs() << "Error: Shard " << i << " of " << count << " is missing\n";
+            return false;
+        }
+    }
+
+    const string temporaryPath = outputPath + ".tmp" + to_string(sys::Process::getProcessId());
+    error_code ec;
+    raw_fd_ostream os(temporaryPath, ec);
+    if (ec) {
+        errs() << "Error: Could not write '" << outputPath << "': " << ec.message() << "\n";
+        return false;
+    }
+
+    // k-way merge by file key, the smallest pending key first
+    using Pending = pair<string, size_t>;
+    priority_queue<Pending, vector<Pending>, greater<>> pending;
+    auto advance = [&readers, &pending](size_t i) {
+        if (readers[i]->next()) {
+            pending.push({readers[i]->fileKey, i});
+            return true;
+        }
+        return !readers[i]->failed();
+    };
+    bool ok = true;
+    for (size_t i = 0; i < readers.size() && ok; ++i) {
+        ok = advance(i);
+    }
+    size_t files = 0;
+    os << "{";
+    while (ok && !pending.empty()) {
+        const string fileKey = pending.top().first;
+        json functions = json::object();
+        while (ok && !pending.empty() && pending.top().first == fileKey) {
+            const size_t i = pending.top().second;
+            pending.pop();
+            functions.update(readers[i]->functions);
+            ok = advance(i);
+        }
+        os << (files++ ? ",\n  " : "\n  ") << json(fileKey).dump() << ": " << formatCallMapValue(functions);
+    }
+    os << (files ? "\n}" : "}");
+    os.close();
+
+    for (const auto &reader: readers) {
+        if (reader->failed()) {
+            errs() << "Error: Invalid shard '" << reader->path << "': " << reader->error << "\n";
+        }
+    }
+    if (!ok || os.has_error()) {
+        if (os.has_error()) {
+            errs() << "Error: Could not write '" << outputPath << "': " << os.error().message() << "\n";
+            os.clear_error();
+        }
+        sys::fs::remove(temporaryPath);
+        return false;
+    }
+    if (error_code renameError = sys::fs::rename(temporaryPath, outputPath)) {
+        sys::fs::remove(temporaryPath);
+        errs() << "Error: Could not write '" << outputPath << "': " << renameError.message() << "\n";
+        return false;
+    }
+    outs() << "Merged " << files << " files of " << count << " shards into " << outputPath << "\n";
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef RUIANALYSIS_SHARDMERGE_H
+#define RUIANALYSIS_SHARDMERGE_H
+
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * Results file of one shard of a sharded run
+ *
+ * @param index shard, from 0
+ * @param count number of shards
+ * @return ffmpeg_calls.<index>-of-<count>.shard
+ */
+std::string shardFileName(unsigned index, unsigned count);
+
+/**
+ * Text of the functions of a file as json::dump(2) formats them inside the call map
+ *
+ * @param functions {function: [api, ...]}
+ * @return
+ */
+std::string formatCallMapValue(const nlohmann::json &functions);
+
+/**
+ * Save the call map of a shard for merging
+ *
+ * A header line names the shard, followed by one line per file in key order: [file, {function: [api, ...]}].
+ *
+ * @param path
+ * @param ffmpegCalls {file: {function: [api, ...]}} of the files of the shard
+ * @param index shard, from 0
+ * @param count number of shards
+ * @return false if the file cannot be written
+ */
+bool writeShard(const std::string &path, const nlohmann::json &ffmpegCalls, unsigned index, unsigned count);
+
+/**
+ * Combine the files of all shards of a run into the ffmpeg_calls.json of a single run, byte for byte
+ *
+ * The shards are merged by file key as they are read, so only one file entry per shard is held in memory
+ * and the output is written as it is produced. Entries of a file found in several shards are combined.
+ *
+ * @param shards one file per shard, in any order
+ * @param outputPath
+ * @return false if a shard is missing, malformed or out of order, or the output cannot be written
+ */
+bool mergeShards(const std::vector<std::string> &shards, const std::string &outputPath);
+
+#endif // RUIANALYSIS_SHARDMERGE_H
@@ -0,0 +1,320 @@
+#include "ShimGenerator.h"
+
+#include <filesystem>
+#include "CallSites.h"
+#include "FFmpegUtils.h"
+#include "clang/AST/DeclCXX.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+
+// Runtime part of the interposer, the wrappers are appended after it
+static const char *const shimRuntime = R"(#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* open addressing table of (api, caller) counters, power of two */
+#define SHIM_TABLE_BITS 12
+#define SHIM_TABLE_SIZE (1u << SHIM_TABLE_BITS)
+#define SHIM_MAX_PROBES 16
+
+struct shim_entry {
+	void *caller;
+	uint32_t api;
+	uint64_t calls;
+	uint64_t nanos;
+};
+
+struct shim_thread {
+	uint64_t calls[SHIM_API_COUNT];
+	uint64_t nanos[SHIM_API_COUNT];
+	struct shim_entry entries[SHIM_TABLE_SIZE];
+	struct shim_thread *next;
+};
+
+/* tables of all threads, threads are only ever added */
+static _Atomic(struct shim_thread *) shim_threads;
+static _Thread_local struct shim_thread *shim_local;
+
+static inline uint64_t shim_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void *shim_resolve(const char *name)
+{
+	void *symbol = dlsym(RTLD_NEXT, name);
+	if (!symbol) {
+		fprintf(stderr, "ffmpeg shim: cannot resolve %s\n", name);
+		abort();
+	}
+	return symbol;
+}
+
+static struct shim_thread *shim_register(void)
+{
+	struct shim_thread *thread = calloc(1, sizeof(*thread));
+	if (!thread)
+		return NULL;
+
+	struct shim_thread *head = atomic_load(&shim_threads);
+	do {
+		thread->next = head;
+	} while (!atomic_compare_exchange_weak(&shim_threads, &head, thread));
+	shim_local = thread;
+	return thread;
+}
+
+static void shim_record(uint32_t api, void *caller, uint64_t nanos)
+{
+	struct shim_thread *thread = shim_local ? shim_local : shim_register();
+	if (!thread)
+		return;
+
+	thread->calls[api]++;
+	thread->nanos[api] += nanos;
+
+	uint64_t hash = ((uint64_t)(uintptr_t)caller ^ ((uint64_t)api << 48)) * 0x9E3779B97F4A7C15ull;
+	uint32_t index = (uint32_t)(hash >> (64 - SHIM_TABLE_BITS));
+	for (uint32_t probe = 0; probe < SHIM_MAX_PROBES; probe++) {
+		struct shim_entry *entry = &thread->entries[(index + probe) & (SHIM_TABLE_SIZE - 1)];
+		if (entry->calls == 0) {
+			entry->caller = caller;
+			entry->api = api;
+		}
+		if (entry->caller == caller && entry->api == api) {
+			entry->calls++;
+			entry->nanos += nanos;
+			return;
+		}
+	}
+	/* neighbourhood full: the call only counts towards the API totals */
+}
+
+static void shim_caller_name(void *caller, char *buffer, size_t size)
+{
+	Dl_info info;
+	if (dladdr(caller, &info) && info.dli_sname)
+		snprintf(buffer, size, "%s+0x%lx", info.dli_sname,
+			 (unsigned long)((char *)caller - (char *)info.dli_saddr));
+	else if (dladdr(caller, &info) && info.dli_fname)
+		snprintf(buffer, size, "%s+0x%lx", info.dli_fname,
+			 (unsigned long)((char *)caller - (char *)info.dli_fbase));
+	else
+		snprintf(buffer, size, "%p", caller);
+}
+
+/* caller names hold file paths, which may contain any byte */
+static void shim_write_string(FILE *out, const char *text)
+{
+	fputc('"', out);
+	for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(out, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(out, "\\u%04x", *c);
+		else
+			fputc(*c, out);
+	}
+	fputc('"', out);
+}
+
+__attribute__((destructor)) static void shim_report(void)
+{
+	uint64_t calls[SHIM_API_COUNT] = {0};
+	uint64_t nanos[SHIM_API_COUNT] = {0};
+	struct shim_entry *merged = NULL;
+	size_t merged_count = 0;
+	size_t merged_capacity = 0;
+
+	for (struct shim_thread *thread = atomic_load(&shim_threads); thread; thread = thread->next) {
+		for (uint32_t api = 0; api < SHIM_API_COUNT; api++) {
+			calls[api] += thread->calls[api];
+			nanos[api] += thread->nanos[api];
+		}
+		for (uint32_t i = 0; i < SHIM_TABLE_SIZE; i++) {
+			const struct shim_entry *entry = &thread->entries[i];
+			if (!entry->calls)
+				continue;
+			size_t j = 0;
+			while (j < merged_count &&
+			       (merged[j].caller != entry->caller || merged[j].api != entry->api))
+				j++;
+			if (j == merged_count) {
+				if (merged_count == merged_capacity) {
+					size_t capacity = merged_capacity ? merged_capacity * 2 : 256;
+					struct shim_entry *grown = realloc(merged, capacity * sizeof(*merged));
+					if (!grown)
+						continue;
+					merged = grown;
+					merged_capacity = capacity;
+				}
+				merged[merged_count++] = (struct shim_entry){entry->caller, entry->api, 0, 0};
+			}
+			merged[j].calls += entry->calls;
+			merged[j].nanos += entry->nanos;
+		}
+	}
+
+	const char *path = getenv("RUIANALYSIS_SHIM_OUTPUT");
+	FILE *out = path ? fopen(path, "w") : NULL;
+	if (!out)
+		out = stderr;
+
+	fprintf(out, "{");
+	int first_api = 1;
+	for (uint32_t api = 0; api < SHIM_API_COUNT; api++) {
+		if (!calls[api])
+			continue;
+		fprintf(out, "%s\n  \"%s\": {\"calls\": %llu, \"nanos\": %llu, \"callers\": {",
+			first_api ? "" : ",", shim_api_names[api], (unsigned long long)calls[api],
+			(unsigned long long)nanos[api]);
+		first_api = 0;
+		int first_caller = 1;
+		for (size_t j = 0; j < merged_count; j++) {
+			if (merged[j].api != api)
+				continue;
+			char name[512];
+			shim_caller_name(merged[j].caller, name, sizeof(name));
+			fputs(first_caller ? "" : ", ", out);
+			shim_write_string(out, name);
+			fprintf(out, ": {\"calls\": %llu, \"nanos\": %llu}", (unsigned long long)merged[j].calls,
+				(unsigned long long)merged[j].nanos);
+			first_caller = 0;
+		}
+		fprintf(out, "}}");
+	}
+	fprintf(out, "\n}\n");
+
+	if (out != stderr)
+		fclose(out);
+	free(merged);
+}
+)";
+
+/**
+ * Include path of an FFmpeg header, e.g. /usr/include/libavcodec/avcodec.h -> libavcodec/avcodec.h
+ *
+ * @param path
+ * @return
+ */
+static string headerInclude(const string &path) {
+    for (const char *library: {"libavcodec/", "libavformat/", "libavutil/", "libavfilter/", "libavdevice/",
+                               "libswscale/", "libswresample/", "libpostproc/"}) {
+        const size_t pos = path.rfind(library);
+        if (pos != string::npos) return path.substr(pos);
+    }
+    return filesystem::path(path).filename().string();
+}
+
+string renderShimSource(const vector<ShimApi> &apis) {
+    string source;
+    raw_string_ostream os(source);
+
+    os << "/*\n"
+            << " * LD_PRELOAD interposer for the FFmpeg APIs called by the analysed project, generated by RuiAnalysis.\n"
+            << " *\n"
+            << " * Build: cc -O2 -shared -fPIC -o ffmpeg_shim.so ffmpeg_shim.c -ldl\n"
+            << " * Run:   RUIANALYSIS_SHIM_OUTPUT=shim.json LD_PRELOAD=./ffmpeg_shim.so <program>\n"
+            << " */\n";
+
+    set<string> headers;
+    for (const ShimApi &api: apis) {
+        headers.insert(api.header);
+    }
+    os << "#define SHIM_API_COUNT " << (apis.empty() ? 1 : apis.size()) << "\n\n";
+    os << "static const char *const shim_api_names[SHIM_API_COUNT] = {\n";
+    for (const ShimApi &api: apis) {
+        os << "\t\"" << api.name << "\",\n";
+    }
+    if (apis.empty()) {
+        os << "\t0,\n";
+    }
+    os << "};\n\n";
+    os << shimRuntime << "\n";
+    for (const string &header: headers) {
+        os << "#include <" << header << ">\n";
+    }
+
+    for (size_t index = 0; index < apis.size(); ++index) {
+        const ShimApi &api = apis[index];
+        const bool returnsVoid = api.returnType == "void";
+
+        string parameters;
+        string arguments;
+        for (size_t i = 0; i < api.parameters.size(); ++i) {
+            parameters += (i ? ", " : "") + api.parameters[i];
+            arguments += (i ? ", a" : "a") + to_string(i);
+        }
+        if (parameters.empty()) {
+            parameters = "void";
+        }
+
+        os << "\nstatic __typeof__(" << api.name << ") *shim_real_" << api.name << ";\n\n";
+        os << api.returnType << " " << api.name << "(" << parameters << ")\n{\n";
+        os << "\tif (!shim_real_" << api.name << ")\n";
+        os << "\t\tshim_real_" << api.name << " = (__typeof__(shim_real_" << api.name << "))shim_resolve(\""
+                << api.name << "\");\n";
+        os << "\tuint64_t start = shim_now();\n";
+        os << "\t" << (returnsVoid ? "" : api.returnType + " result = ") << "shim_real_" << api.name << "("
+                << arguments << ");\n";
+        os << "\tshim_record(" << index << ", __builtin_return_address(0), shim_now() - start);\n";
+        if (!returnsVoid) {
+            os << "\treturn result;\n";
+        }
+        os << "}\n";
+    }
+    return os.str();
+}
+
+void ShimGenerator::analyseTranslationUnit(ASTContext &Context) {
+    const SourceManager &SM = Context.getSourceManager();
+    PrintingPolicy policy = Context.getPrintingPolicy();
+
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        for (const CallSite &site: collectCallSites(func, Context)) {
+            if (!site.ffmpeg) continue;
+            const FunctionDecl *callee = site.expr->getDirectCallee()->getFirstDecl();
+            const string name = callee->getNameAsString();
+            if (apis.count(name) || skipped.count(name)) continue;
+
+            // Only exported C functions can be interposed, inline header functions have no symbol
+            if (isa<CXXMethodDecl>(callee) || !callee->isExternC() || callee->isDefined()) continue;
+            if (callee->isVariadic() || callee->getReturnType()->isFunctionPointerType()) {
+                skipped.insert(name);
+                continue;
+            }
+
+            ShimApi api;
+            api.name = name;
+            api.header = headerInclude(SM.getFilename(SM.getSpellingLoc(callee->getLocation())).str());
+            api.returnType = callee->getReturnType().getAsString(policy);
+            for (unsigned i = 0; i < callee->getNumParams(); ++i) {
+                string parameter;
+                raw_string_ostream os(parameter);
+                callee->getParamDecl(i)->getType().print(os, policy, "a" + to_string(i));
+                api.parameters.push_back(os.str());
+            }
+            apis[name] = api;
+        }
+    }
+}
+
+string ShimGenerator::render() const {
+    for (const string &name: skipped) {
+        outs() << "Shim: cannot forward " << name << ", skipped\n";
+    }
+    vector<ShimApi> ordered;
+    for (const auto &[name, api]: apis) {
+        ordered.push_back(api);
+    }
+    return renderShimSource(ordered);
+}
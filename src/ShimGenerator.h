@@ -0,0 +1,53 @@
+#ifndef RUIANALYSIS_SHIMGENERATOR_H
+#define RUIANALYSIS_SHIMGENERATOR_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "clang/AST/ASTContext.h"
+
+/**
+ * Prototype of an FFmpeg API to interpose
+ */
+struct ShimApi {
+    std::string name;
+    // header declaring the API, e.g. libavcodec/avcodec.h
+    std::string header;
+    std::string returnType;
+    // parameter declarations with generated names, e.g. "AVCodecContext *a0"
+    std::vector<std::string> parameters;
+};
+
+/**
+ * Render the C source of an LD_PRELOAD interposer
+ *
+ * Each wrapper counts calls and cumulative latency per API and per calling address in per-thread
+ * tables. Threads register their table once with a lock-free push, and the tables are merged and
+ * written at exit to $RUIANALYSIS_SHIM_OUTPUT (stderr when unset).
+ *
+ * @param apis
+ * @return
+ */
+std::string renderShimSource(const std::vector<ShimApi> &apis);
+
+/**
+ * Collect the prototypes of the FFmpeg APIs called by the project
+ */
+class ShimGenerator {
+public:
+    void analyseTranslationUnit(clang::ASTContext &Context);
+
+    std::string render() const;
+
+    size_t size() const {
+        return apis.size();
+    }
+
+private:
+    std::map<std::string, ShimApi> apis;
+    // APIs that cannot be forwarded, e.g. variadic ones
+    std::set<std::string> skipped;
+};
+
+#endif // RUIANALYSIS_SHIMGENERATOR_H
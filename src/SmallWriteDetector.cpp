@@ -0,0 +1,245 @@
+#include "SmallWriteDetector.h"
+
+#include <algorithm>
+#include "CallSites.h"
+#include "FFmpegUtils.h"
+#include "StronglyConnectedComponents.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/StringRef.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+/**
+ * Arguments of a write function, -1 where there is none
+ */
+struct WriteAPI {
+    int buffer;
+    int size;
+    // fwrite writes size * count bytes
+    int count;
+    // bytes written by the fixed-size helpers
+    uint64_t fixed;
+};
+
+static const map<string, WriteAPI> writeAPIs = {
+    {"avio_write", {1, 2, -1, 0}}, {"write", {1, 2, -1, 0}}, {"pwrite", {1, 2, -1, 0}},
+    {"send", {1, 2, -1, 0}}, {"os_process_pipe_write", {1, 2, -1, 0}}, {"fwrite", {0, 1, 2, 0}},
+    {"fwrite_unlocked", {0, 1, 2, 0}}, {"fputc", {-1, -1, -1, 1}}, {"putc", {-1, -1, -1, 1}},
+    {"avio_w8", {-1, -1, -1, 1}}, {"avio_wl16", {-1, -1, -1, 2}}, {"avio_wb16", {-1, -1, -1, 2}},
+    {"avio_wl24", {-1, -1, -1, 3}}, {"avio_wb24", {-1, -1, -1, 3}}, {"avio_wl32", {-1, -1, -1, 4}},
+    {"avio_wb32", {-1, -1, -1, 4}}, {"avio_wl64", {-1, -1, -1, 8}}, {"avio_wb64", {-1, -1, -1, 8}},
+};
+
+// writes collected through helpers per call, deeper call trees are cut off
+static constexpr size_t maxWritesPerCall = 256;
+
+/**
+ * Visitor class: find uses of packets inside a loop
+ */
+class PacketUseVisitor : public RecursiveASTVisitor<PacketUseVisitor> {
+public:
+    bool found = false;
+
+    bool VisitExpr(Expr *expr) {
+        QualType type = expr->getType();
+        while (!type.isNull() && (type->isPointerType() || type->isReferenceType())) {
+            type = type->getPointeeType();
+        }
+        if (type.isNull()) return true;
+        if (const RecordDecl *record = type->getAsRecordDecl()) {
+            if (StringRef(record->getName()).contains_insensitive("packet")) {
+                found = true;
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * Size of the object a buffer argument points to: an array, or a single object whose address is taken
+ *
+ * @param buffer
+ * @param Context
+ * @return
+ */
+static optional<uint64_t> bufferBytes(const Expr *buffer, const ASTContext &Context) {
+    const Expr *expr = buffer->IgnoreParenCasts();
+    QualType type;
+    if (const auto *unary = dyn_cast<UnaryOperator>(expr); unary && unary->getOpcode() == UO_AddrOf) {
+        type = unary->getSubExpr()->getType();
+    } else if (isa<ConstantArrayType>(expr->getType())) {
+        type = expr->getType();
+    } else {
+        return nullopt;
+    }
+    if (type->isIncompleteType() || type->isDependentType() || type->isVoidType()) return nullopt;
+    return Context.getTypeSizeInChars(type).getQuantity();
+}
+
+static optional<uint64_t> constantArgument(const CallExpr *call, int index, const ASTContext &Context) {
+    if (index < 0 || static_cast<unsigned>(index) >= call->getNumArgs()) return nullopt;
+    Expr::EvalResult result;
+    if (!call->getArg(index)->EvaluateAsInt(result, Context) || result.Val.getInt().isNegative()) return nullopt;
+    return result.Val.getInt().getZExtValue();
+}
+
+/**
+ * Upper bound of the bytes a write call writes
+ *
+ * @param call
+ * @param api
+ * @param Context
+ * @return nothing if the size depends on run-time values
+ */
+static optional<uint64_t> writeBytes(const CallExpr *call, const WriteAPI &api, const ASTContext &Context) {
+    if (api.fixed) return api.fixed;
+    optional<uint64_t> bytes = constantArgument(call, api.size, Context);
+    if (bytes && api.count >= 0) {
+        const optional<uint64_t> count = constantArgument(call, api.count, Context);
+        bytes = count ? optional<uint64_t>(*bytes * *count) : nullopt;
+    }
+    if (api.buffer >= 0 && static_cast<unsigned>(api.buffer) < call->getNumArgs()) {
+        if (const optional<uint64_t> object = bufferBytes(call->getArg(api.buffer), Context)) {
+            bytes = bytes ? min(*bytes, *object) : *object;
+        }
+    }
+    return bytes;
+}
+
+void SmallWriteDetector::analyseTranslationUnit(ASTContext &Context, const string &fileName) {
+    const SourceManager &SM = Context.getSourceManager();
+    const string fileKey = toDisplayPath(fileName);
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        // the writes of a header function are counted once, with the first translation unit including it
+        auto [inserted, added] = functions.try_emplace(getFunctionUSR(func));
+        if (!added) continue;
+
+        const string name = getMethodFullName(func);
+        FunctionWrites &entry = inserted->second;
+        entry.name = name;
+        entry.fileKey = fileKey;
+        map<const Stmt *, size_t> loopIndex;
+        for (const CallSite &site: collectCallSites(func, Context)) {
+            size_t loop = none;
+            if (site.loop) {
+                auto [known, inserted] = loopIndex.emplace(site.loop, entry.loops.size());
+                if (inserted) {
+                    PacketUseVisitor packets;
+                    packets.TraverseStmt(const_cast<Stmt *>(site.loop));
+                    entry.loops.push_back({describeLocation(site.loop->getBeginLoc(), SM), site.loopDepth,
+                                           packets.found});
+                }
+                loop = known->second;
+            }
+            auto api = writeAPIs.find(site.callee);
+            if (api != writeAPIs.end()) {
+                entry.calls.push_back({loop, Write{site.callee, name, fileKey,
+                                                   describeLocation(site.expr->getBeginLoc(), SM),
+                                                   writeBytes(site.expr, api->second, Context)}, "", ""});
+            } else if (!site.ffmpeg) {
+                entry.calls.push_back({loop, nullopt, site.callee, getFunctionUSR(site.expr->getDirectCallee())});
+            }
+        }
+    }
+}
+
+map<string, vector<SmallWriteDetector::Write>> SmallWriteDetector::writesPerCall() const {
+    // only calls outside loops run once per call, loops of the callee are reported on their own
+    vector<const FunctionWrites *> nodes;
+    vector<string> usrs;
+    map<string, size_t> nodeIndex;
+    for (const auto &[usr, function]: functions) {
+        nodeIndex[usr] = nodes.size();
+        nodes.push_back(&function);
+        usrs.push_back(usr);
+    }
+    vector<vector<size_t>> edges(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (const LoopCall &call: nodes[i]->calls) {
+            if (call.loop != none || call.write) continue;
+            auto target = nodeIndex.find(call.calleeUSR);
+            if (target != nodeIndex.end()) {
+                edges[i].push_back(target->second);
+            }
+        }
+    }
+
+    const StronglyConnectedComponents scc = stronglyConnectedComponents(edges);
+    const vector<size_t> &component = scc.component;
+    const vector<vector<size_t>> &components = scc.members;
+
+    // Bottom-up: a call into another component adds all of its writes, calls within the component are recursion
+    vector<vector<Write>> componentWrites(components.size());
+    for (size_t c = 0; c < components.size(); ++c) {
+        vector<Write> &writes = componentWrites[c];
+        for (const size_t member: components[c]) {
+            for (const LoopCall &call: nodes[member]->calls) {
+                if (call.loop != none || writes.size() >= maxWritesPerCall) continue;
+                if (call.write) {
+                    writes.push_back(*call.write);
+                    continue;
+                }
+                auto target = nodeIndex.find(call.calleeUSR);
+                if (target == nodeIndex.end() || component[target->second] == c) continue;
+                const vector<Write> &calleeWrites = componentWrites[component[target->second]];
+                writes.insert(writes.end(), calleeWrites.begin(),
+                              calleeWrites.begin() + min(calleeWrites.size(), maxWritesPerCall - writes.size()));
+            }
+        }
+    }
+
+    map<string, vector<Write>> result;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        result[usrs[i]] = componentWrites[component[i]];
+    }
+    return result;
+}
+
+json SmallWriteDetector::report() const {
+    const map<string, vector<Write>> perCall = writesPerCall();
+    json result = json::object();
+    for (const auto &[usr, entry]: functions) {
+        for (size_t loop = 0; loop < entry.loops.size(); ++loop) {
+            json calls = json::array();
+            size_t smallWrites = 0;
+            auto addWrite = [&](const Write &write, const string &via) {
+                json call = {{"api", write.api}, {"function", write.function}, {"file", write.fileKey},
+                             {"line", write.location["line"]}, {"column", write.location["column"]},
+                             {"bytes", write.bytes ? json(*write.bytes) : json()}};
+                if (!via.empty()) {
+                    call["via"] = via;
+                }
+                calls.push_back(call);
+                if (write.bytes && *write.bytes <= limit) {
+                    smallWrites++;
+                }
+            };
+            for (const LoopCall &call: entry.calls) {
+                if (call.loop != loop) continue;
+                if (call.write) {
+                    addWrite(*call.write, "");
+                } else if (perCall.count(call.calleeUSR)) {
+                    for (const Write &write: perCall.at(call.calleeUSR)) {
+                        addWrite(write, call.callee);
+                    }
+                }
+            }
+            if (smallWrites == 0) continue;
+
+            const Loop &info = entry.loops[loop];
+            result[entry.fileKey][entry.name].push_back({
+                {"loop", info.location},
+                {"loopDepth", info.depth},
+                {"perPacket", info.perPacket},
+                {"smallWrites", smallWrites},
+                {"writes", calls.size()},
+                {"calls", calls},
+            });
+        }
+    }
+    return result;
+}
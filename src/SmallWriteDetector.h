@@ -0,0 +1,87 @@
+#ifndef RUIANALYSIS_SMALLWRITEDETECTOR_H
+#define RUIANALYSIS_SMALLWRITEDETECTOR_H
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+
+/**
+ * Find small writes repeated per loop iteration, each a system call that could be batched
+ *
+ * Writes are avio_write and the avio_w* helpers, fwrite, write, send and pipe writes. The size of a write
+ * is bounded statically by a constant size argument or by the size of the buffer object written. Writes
+ * done once per call of a project function count for every loop calling it, in any translation unit, so
+ * a loop calling a write_packet helper is reported with the writes of the helper.
+ */
+class SmallWriteDetector {
+public:
+    /**
+     * @param limit writes of at most this many bytes are small
+     */
+    explicit SmallWriteDetector(uint64_t limit) : limit(limit) {
+    }
+
+    void analyseTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Loops doing small writes, with the estimated writes per iteration
+     *
+     * @return {file: {function: [{"loop", "loopDepth", "perPacket", "smallWrites", "writes", "calls": [...]}]}}
+     */
+    nlohmann::json report() const;
+
+private:
+    struct Write {
+        std::string api;
+        std::string function;
+        std::string fileKey;
+        nlohmann::json location;
+        // upper bound of the bytes written, nothing if unbounded
+        std::optional<uint64_t> bytes;
+    };
+
+    struct LoopCall {
+        // index into the loops of the function, none outside loops
+        size_t loop;
+        // write done by the call itself, or project function called
+        std::optional<Write> write;
+        std::string callee;
+        std::string calleeUSR;
+    };
+
+    struct Loop {
+        nlohmann::json location;
+        unsigned depth;
+        // the loop works on packets, e.g. an AVPacket or encoder_packet is used in it
+        bool perPacket;
+    };
+
+    struct FunctionWrites {
+        std::string name;
+        std::string fileKey;
+        std::vector<Loop> loops;
+        std::vector<LoopCall> calls;
+    };
+
+    static constexpr size_t none = static_cast<size_t>(-1);
+
+    uint64_t limit;
+    // keyed by USR, static functions of the same name in different files stay apart
+    std::map<std::string, FunctionWrites> functions;
+
+    /**
+     * Writes done once per call of every function, by itself and the project functions it calls outside loops
+     *
+     * Computed bottom-up over the strongly connected components of those calls: the functions of a recursive
+     * cycle share the writes of all its members, whichever of them is called first.
+     *
+     * @return USR -> writes
+     */
+    std::map<std::string, std::vector<Write>> writesPerCall() const;
+};
+
+#endif // RUIANALYSIS_SMALLWRITEDETECTOR_H
@@ -0,0 +1,433 @@
+#include "SourceDiscovery.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <thread>
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+
+// Bumped whenever the snapshot layout changes
+static constexpr const char *snapshotVersion = "RUISNAPSHOT 1";
+// Directories modified this close to the previous scan may have changed during it
+static constexpr int64_t racyMarginNanos = 2'000'000'000;
+// Differences printed by crossCheck per kind
+static constexpr size_t maxListedDifferences = 10;
+
+/**
+ * Absolute, dot-free native form of a path
+ *
+ * @param path
+ * @return
+ */
+static string absolutePath(StringRef path) {
+    SmallString<256> absolute(path);
+    sys::fs::make_absolute(absolute);
+    sys::path::remove_dots(absolute, true);
+    sys::path::native(absolute);
+    return string(absolute);
+}
+
+/**
+ * Match a gitignore glob: * and ? stop at slashes, ** crosses them
+ *
+ * @param pattern
+ * @param text
+ * @return
+ */
+static bool globMatch(StringRef pattern, StringRef text) {
+    if (pattern.empty()) return text.empty();
+
+    if (pattern.starts_with("**")) {
+        StringRef rest = pattern.drop_front(2);
+        if (rest.starts_with("/")) {
+            // "**/" stands for zero or more whole directories
+            rest = rest.drop_front();
+            if (globMatch(rest, text)) return true;
+            for (size_t i = 0; i < text.size(); ++i) {
+                if (text[i] == '/' && globMatch(rest, text.drop_front(i + 1))) return true;
+            }
+            return false;
+        }
+        for (size_t i = 0; i <= text.size(); ++i) {
+            if (globMatch(rest, text.drop_front(i))) return true;
+        }
+        return false;
+    }
+
+    switch (pattern.front()) {
+        case '*':
+            for (size_t i = 0; i <= text.size(); ++i) {
+                if (globMatch(pattern.drop_front(), text.drop_front(i))) return true;
+                if (i < text.size() && text[i] == '/') return false;
+            }
+            return false;
+        case '?':
+            return !text.empty() && text.front() != '/' && globMatch(pattern.drop_front(), text.drop_front());
+        case '[': {
+            const size_t end = pattern.find(']', 2);
+            if (end == StringRef::npos) break;
+            if (text.empty() || text.front() == '/') return false;
+            StringRef set = pattern.slice(1, end);
+            const bool negated = set.front() == '!' || set.front() == '^';
+            if (negated) set = set.drop_front();
+            bool found = false;
+            for (size_t i = 0; i < set.size(); ++i) {
+                if (i + 2 < set.size() && set[i + 1] == '-') {
+                    found |= text.front() >= set[i] && text.front() <= set[i + 2];
+                    i += 2;
+                } else {
+                    found |= text.front() == set[i];
+                }
+            }
+            return found != negated && globMatch(pattern.drop_front(end + 1), text.drop_front());
+        }
+        case '\\':
+            if (pattern.size() > 1) pattern = pattern.drop_front();
+            break;
+        default:
+            break;
+    }
+    return !text.empty() && text.front() == pattern.front() && globMatch(pattern.drop_front(), text.drop_front());
+}
+
+/**
+ * Parse one line of a .gitignore
+ *
+ * @param line
+ * @param negated
+ * @param directoryOnly
+ * @param anchored
+ * @return the pattern, nullopt for blank lines and comments
+ */
+static optional<string> parseIgnoreLine(StringRef line, bool &negated, bool &directoryOnly, bool &anchored) {
+    line = line.rtrim(" \t\r");
+    if (line.empty() || line.starts_with("#")) return nullopt;
+
+    negated = line.consume_front("!");
+    if (line.starts_with("\\!") || line.starts_with("\\#")) {
+        line = line.drop_front();
+    }
+    directoryOnly = line.consume_back("/");
+    anchored = line.contains('/');
+    line.consume_front("/");
+    if (line.empty()) return nullopt;
+    return line.str();
+}
+
+SourceDiscovery::SourceDiscovery(const vector<string> &extensions, const vector<string> &excludes,
+                                 unsigned threads)
+    : threads(threads ? threads : max(1u, thread::hardware_concurrency())) {
+    for (const string &extension: extensions) {
+        if (extension.empty()) continue;
+        this->extensions.push_back(extension.front() == '.' ? extension : "." + extension);
+    }
+    if (this->extensions.empty()) {
+        this->extensions = {".c", ".cc", ".cpp", ".cxx", ".m", ".mm"};
+    }
+
+    // exclude patterns rank below every .gitignore, like .git/info/exclude
+    auto frame = make_shared<IgnoreFrame>();
+    for (const string &exclude: excludes) {
+        IgnoreRule rule{};
+        if (optional<string> pattern = parseIgnoreLine(exclude, rule.negated, rule.directoryOnly, rule.anchored)) {
+            rule.pattern = std::move(*pattern);
+            frame->rules.push_back(std::move(rule));
+        }
+    }
+    excludeFrame = std::move(frame);
+}
+
+void SourceDiscovery::loadSnapshot(const string &path) {
+    auto buffer = MemoryBuffer::getFile(path);
+    if (!buffer) return;
+
+    auto [header, rest] = (*buffer)->getBuffer().split('\n');
+    if (!header.consume_front(snapshotVersion) || header.trim().getAsInteger(10, previousScanTime)) return;
+
+    Listing *listing = nullptr;
+    while (!rest.empty()) {
+        auto [line, next] = rest.split('\n');
+        rest = next;
+        if (line.size() < 2 || line[1] != ' ') continue;
+
+        const StringRef value = line.drop_front(2);
+        if (line[0] == 'D') {
+            // D <inode> <mtime> <path>
+            SmallVector<StringRef, 3> fields;
+            value.split(fields, ' ', 2);
+            Listing entry;
+            if (fields.size() != 3 || fields[0].getAsInteger(10, entry.inode) ||
+                fields[1].getAsInteger(10, entry.mtime)) {
+                previous.clear();
+                return;
+            }
+            listing = &(previous[fields[2]] = std::move(entry));
+        } else if (listing && line[0] == 'f') {
+            listing->files.push_back(value.str());
+        } else if (listing && line[0] == 'd') {
+            listing->directories.push_back(value.str());
+        }
+    }
+}
+
+bool SourceDiscovery::saveSnapshot(const string &path) const {
+    // Written aside and renamed so concurrent runs never read a partial snapshot
+    const string temporaryPath = path + ".tmp" + to_string(sys::Process::getProcessId());
+    {
+        error_code ec;
+        raw_fd_ostream os(temporaryPath, ec);
+        if (ec) {
+            errs() << "Error: Could not write '" << path << "': " << ec.message() << "\n";
+            return false;
+        }
+        auto write = [&os](StringRef directory, const Listing &listing) {
+            os << "D " << listing.inode << " " << listing.mtime << " " << directory << "\n";
+            for (const string &file: listing.files) {
+                os << "f " << file << "\n";
+            }
+            for (const string &child: listing.directories) {
+                os << "d " << child << "\n";
+            }
+        };
+
+        lock_guard<mutex> guard(currentMutex);
+        os << snapshotVersion << " " << scanTime << "\n";
+        for (const auto &[directory, listing]: current) {
+            write(directory, listing);
+        }
+        // keep the directories of other inputs, drop the ones that vanished below the crawled roots
+        for (const auto &entry: previous) {
+            const StringRef directory = entry.getKey();
+            if (current.count(directory.str())) continue;
+            const bool crawled = any_of(roots.begin(), roots.end(), [&](const string &root) {
+                return directory == root || (directory.starts_with(root) &&
+                                             sys::path::is_separator(directory[root.size()]));
+            });
+            if (!crawled) {
+                write(directory, entry.getValue());
+            }
+        }
+    }
+    if (error_code ec = sys::fs::rename(temporaryPath, path)) {
+        sys::fs::remove(temporaryPath);
+        errs() << "Error: Could not write '" << path << "': " << ec.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool SourceDiscovery::isIgnored(const IgnoreFrame *frame, StringRef relative, bool isDirectory) {
+    // The deepest .gitignore decides, and within one file the last matching rule
+    for (; frame; frame = frame->parent.get()) {
+        StringRef path = relative;
+        if (!frame->base.empty()) {
+            if (!path.consume_front(frame->base) || !path.consume_front("/")) continue;
+        }
+        const StringRef name = path.substr(path.rfind('/') + 1);
+        for (auto rule = frame->rules.rbegin(); rule != frame->rules.rend(); ++rule) {
+            if (rule->directoryOnly && !isDirectory) continue;
+            if (globMatch(rule->pattern, rule->anchored ? path : name)) {
+                return !rule->negated;
+            }
+        }
+    }
+    return false;
+}
+
+bool SourceDiscovery::readListing(const string &path, Listing &listing) const {
+    error_code ec;
+    filesystem::directory_iterator it(path, filesystem::directory_options::skip_permission_denied, ec);
+    if (ec) {
+        errs() << "Error: Could not read directory '" << path << "': " << ec.message() << "\n";
+        return false;
+    }
+    // the type comes with the directory entry, files behind symlinks are followed but directories are not
+    for (const filesystem::directory_entry &entry: it) {
+        const string name = entry.path().filename().string();
+        if (entry.is_symlink(ec)) {
+            if (entry.is_regular_file(ec)) listing.files.push_back(name);
+        } else if (entry.is_directory(ec)) {
+            listing.directories.push_back(name);
+        } else if (entry.is_regular_file(ec)) {
+            listing.files.push_back(name);
+        }
+    }
+    std::sort(listing.files.begin(), listing.files.end());
+    std::sort(listing.directories.begin(), listing.directories.end());
+    return true;
+}
+
+void SourceDiscovery::crawlDirectory(const Task &task, vector<Task> &children, vector<string> &files) {
+    sys::fs::file_status status;
+    if (error_code ec = sys::fs::status(task.path, status)) {
+        errs() << "Error: Could not read directory '" << task.path << "': " << ec.message() << "\n";
+        return;
+    }
+
+    const string key = absolutePath(task.path);
+    Listing listing;
+    listing.inode = status.getUniqueID().getFile();
+    listing.mtime = status.getLastModificationTime().time_since_epoch().count();
+
+    // An unchanged directory keeps its entries, only its subdirectories are visited again
+    auto cached = previous.find(key);
+    if (cached != previous.end() && cached->second.inode == listing.inode &&
+        cached->second.mtime == listing.mtime && listing.mtime + racyMarginNanos < previousScanTime) {
+        listing.files = cached->second.files;
+        listing.directories = cached->second.directories;
+    } else if (!readListing(task.path, listing)) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(currentMutex);
+        current[key] = listing;
+    }
+
+    auto has = [](const vector<string> &names, const char *name) {
+        return binary_search(names.begin(), names.end(), name);
+    };
+    // nested build trees hold generated sources and copies of the project
+    if (!task.relative.empty() && has(listing.files, "CMakeCache.txt")) return;
+
+    shared_ptr<const IgnoreFrame> frame = task.frame;
+    if (has(listing.files, ".gitignore")) {
+        if (auto buffer = MemoryBuffer::getFile(task.path + "/.gitignore")) {
+            auto gitignore = make_shared<IgnoreFrame>();
+            gitignore->parent = frame;
+            gitignore->base = task.relative;
+            SmallVector<StringRef, 32> lines;
+            (*buffer)->getBuffer().split(lines, '\n');
+            for (StringRef line: lines) {
+                IgnoreRule rule{};
+                if (optional<string> pattern = parseIgnoreLine(line, rule.negated, rule.directoryOnly,
+                                                               rule.anchored)) {
+                    rule.pattern = std::move(*pattern);
+                    gitignore->rules.push_back(std::move(rule));
+                }
+            }
+            frame = std::move(gitignore);
+        }
+    }
+
+    const string prefix = task.relative.empty() ? "" : task.relative + "/";
+    for (const string &file: listing.files) {
+        const StringRef extension = sys::path::extension(file);
+        if (find(extensions.begin(), extensions.end(), extension) == extensions.end()) continue;
+        if (isIgnored(frame.get(), prefix + file, false)) continue;
+        files.push_back(task.path + "/" + file);
+    }
+    for (const string &directory: listing.directories) {
+        if (directory == ".git" || directory == ".hg" || directory == ".svn") continue;
+        if (isIgnored(frame.get(), prefix + directory, true)) continue;
+        children.push_back({task.path + "/" + directory, prefix + directory, frame});
+    }
+}
+
+void SourceDiscovery::discover(const string &root, const function<void(const string &)> &onFile) {
+    if (!scanTime) {
+        scanTime = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    }
+    roots.push_back(absolutePath(root));
+
+    mutex queueMutex;
+    condition_variable wake;
+    deque<Task> queue;
+    size_t active = 0;
+    // files are handed over outside the queue lock, a waiting consumer does not stop the other crawlers
+    mutex deliverMutex;
+
+    StringRef base = root;
+    while (base.size() > 1 && sys::path::is_separator(base.back())) {
+        base = base.drop_back();
+    }
+    queue.push_back({base.str(), "", excludeFrame});
+
+    // Workers take directories from the queue until it is empty and no directory is in progress
+    auto worker = [&]() {
+        unique_lock<mutex> guard(queueMutex);
+        while (true) {
+            wake.wait(guard, [&]() { return !queue.empty() || active == 0; });
+            if (queue.empty()) return;
+            Task task = std::move(queue.front());
+            queue.pop_front();
+            active++;
+            guard.unlock();
+
+            vector<Task> children;
+            vector<string> files;
+            crawlDirectory(task, children, files);
+
+            // subdirectories are queued first so that other crawlers can start on them
+            guard.lock();
+            for (Task &child: children) {
+                queue.push_back(std::move(child));
+            }
+            wake.notify_all();
+            guard.unlock();
+            {
+                lock_guard<mutex> deliverGuard(deliverMutex);
+                for (const string &file: files) {
+                    discovered.push_back(absolutePath(file));
+                    onFile(file);
+                }
+            }
+            guard.lock();
+            active--;
+            wake.notify_all();
+        }
+    };
+    vector<thread> pool;
+    for (unsigned i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (thread &t: pool) {
+        t.join();
+    }
+}
+
+void SourceDiscovery::crossCheck(const vector<string> &databaseFiles) const {
+    if (databaseFiles.empty() || roots.empty()) return;
+
+    const set<string> found(discovered.begin(), discovered.end());
+    set<string> compiled;
+    for (const string &file: databaseFiles) {
+        const string path = absolutePath(file);
+        const bool inRoot = any_of(roots.begin(), roots.end(), [&](const string &root) {
+            return StringRef(path).starts_with(root) && sys::path::is_separator(path[root.size()]);
+        });
+        if (inRoot) compiled.insert(path);
+    }
+
+    vector<string> uncompiled;
+    vector<string> missed;
+    set_difference(found.begin(), found.end(), compiled.begin(), compiled.end(), back_inserter(uncompiled));
+    set_difference(compiled.begin(), compiled.end(), found.begin(), found.end(), back_inserter(missed));
+
+    auto print = [](const vector<string> &files, const char *what) {
+        if (files.empty()) return;
+        outs() << "Discovery: " << files.size() << " " << what << "\n";
+        for (size_t i = 0; i < files.size() && i < maxListedDifferences; ++i) {
+            outs() << "  " << files[i] << "\n";
+        }
+        if (files.size() > maxListedDifferences) {
+            outs() << "  ...\n";
+        }
+    };
+    print(uncompiled, "discovered sources have no compile command, their flags are inferred");
+    print(missed, "sources of the compilation database were not discovered (excluded or other extension)");
+}
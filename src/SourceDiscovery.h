@@ -0,0 +1,116 @@
+#ifndef RUIANALYSIS_SOURCEDISCOVERY_H
+#define RUIANALYSIS_SOURCEDISCOVERY_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+/**
+ * Find the sources below the input directories
+ *
+ * Directories are crawled by a pool of threads. .gitignore files and the exclude patterns are applied with
+ * gitignore semantics, VCS metadata and build trees (directories holding a CMakeCache.txt) are skipped.
+ * The listing of every directory can be kept in a snapshot file together with its inode and modification
+ * time; on the next run an unchanged directory costs one stat instead of a full read.
+ */
+class SourceDiscovery {
+public:
+    /**
+     * @param extensions file extensions to collect, with or without the dot; empty for the defaults
+     * @param excludes gitignore-style patterns relative to each input directory
+     * @param threads crawler threads, 0 for one per core
+     */
+    SourceDiscovery(const std::vector<std::string> &extensions, const std::vector<std::string> &excludes,
+                    unsigned threads);
+
+    /**
+     * Read the snapshot of a previous run, a missing or outdated file is ignored
+     *
+     * @param path
+     */
+    void loadSnapshot(const std::string &path);
+
+    /**
+     * Write the listings of this run and the untouched ones of the previous snapshot
+     *
+     * @param path
+     * @return false if the file cannot be written
+     */
+    bool saveSnapshot(const std::string &path) const;
+
+    /**
+     * Collect the sources below a directory, handing each over as soon as its directory is read
+     *
+     * @param root
+     * @param onFile called from the crawler threads, one file at a time; may block to hold the crawl back
+     */
+    void discover(const std::string &root, const std::function<void(const std::string &)> &onFile);
+
+    /**
+     * Compare the discovered sources with the files of the compilation database below the crawled
+     * directories and print the differences
+     *
+     * @param databaseFiles
+     */
+    void crossCheck(const std::vector<std::string> &databaseFiles) const;
+
+private:
+    struct IgnoreRule {
+        std::string pattern;
+        bool negated;
+        bool directoryOnly;
+        // pattern contains a slash and matches the path relative to its .gitignore
+        bool anchored;
+    };
+
+    // rules of one .gitignore, linked to the ones of the parent directories
+    struct IgnoreFrame {
+        std::shared_ptr<const IgnoreFrame> parent;
+        // directory of the .gitignore relative to the crawled root, "" for the root
+        std::string base;
+        std::vector<IgnoreRule> rules;
+    };
+
+    // unfiltered content of a directory
+    struct Listing {
+        uint64_t inode = 0;
+        int64_t mtime = 0;
+        std::vector<std::string> files;
+        std::vector<std::string> directories;
+    };
+
+    struct Task {
+        std::string path;
+        std::string relative;
+        std::shared_ptr<const IgnoreFrame> frame;
+    };
+
+    std::vector<std::string> extensions;
+    std::shared_ptr<const IgnoreFrame> excludeFrame;
+    unsigned threads;
+
+    // absolute crawled roots and the absolute paths of their sources
+    std::vector<std::string> roots;
+    std::vector<std::string> discovered;
+
+    // start of the scan that produced the previous snapshot, newer directories are read again
+    int64_t previousScanTime = 0;
+    int64_t scanTime = 0;
+    llvm::StringMap<Listing> previous;
+    mutable std::mutex currentMutex;
+    std::map<std::string, Listing> current;
+
+    static bool isIgnored(const IgnoreFrame *frame, llvm::StringRef relative, bool isDirectory);
+
+    bool readListing(const std::string &path, Listing &listing) const;
+
+    void crawlDirectory(const Task &task, std::vector<Task> &children, std::vector<std::string> &files);
+};
+
+#endif // RUIANALYSIS_SOURCEDISCOVERY_H
@@ -0,0 +1,59 @@
+#include "StronglyConnectedComponents.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+using namespace std;
+
+StronglyConnectedComponents stronglyConnectedComponents(const vector<vector<size_t>> &edges) {
+    constexpr size_t unvisited = SIZE_MAX;
+    const size_t nodes = edges.size();
+    StronglyConnectedComponents result;
+    result.component.assign(nodes, 0);
+    vector<size_t> order(nodes, unvisited);
+    vector<size_t> low(nodes, 0);
+    vector<bool> onStack(nodes, false);
+    vector<size_t> stack;
+    size_t counter = 0;
+    for (size_t root = 0; root < nodes; ++root) {
+        if (order[root] != unvisited) continue;
+        // node and index of its next edge
+        vector<pair<size_t, size_t>> frames{{root, 0}};
+        order[root] = low[root] = counter++;
+        stack.push_back(root);
+        onStack[root] = true;
+        while (!frames.empty()) {
+            auto &[node, next] = frames.back();
+            if (next < edges[node].size()) {
+                const size_t target = edges[node][next++];
+                if (order[target] == unvisited) {
+                    order[target] = low[target] = counter++;
+                    stack.push_back(target);
+                    onStack[target] = true;
+                    frames.push_back({target, 0});
+                } else if (onStack[target]) {
+                    low[node] = min(low[node], order[target]);
+                }
+                continue;
+            }
+            const size_t finished = node;
+            if (low[finished] == order[finished]) {
+                result.members.emplace_back();
+                size_t member;
+                do {
+                    member = stack.back();
+                    stack.pop_back();
+                    onStack[member] = false;
+                    result.component[member] = result.members.size() - 1;
+                    result.members.back().push_back(member);
+                } while (member != finished);
+            }
+            frames.pop_back();
+            if (!frames.empty()) {
+                low[frames.back().first] = min(low[frames.back().first], low[finished]);
+            }
+        }
+    }
+    return result;
+}
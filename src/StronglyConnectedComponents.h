@@ -0,0 +1,29 @@
+#ifndef RUIANALYSIS_STRONGLYCONNECTEDCOMPONENTS_H
+#define RUIANALYSIS_STRONGLYCONNECTEDCOMPONENTS_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Strongly connected components of a call graph
+ */
+struct StronglyConnectedComponents {
+    // component of every node
+    std::vector<size_t> component;
+    // nodes of every component, a component comes after all components it calls into
+    std::vector<std::vector<size_t>> members;
+};
+
+/**
+ * Find the strongly connected components with Tarjan's algorithm, without recursion so that deep call chains
+ * do not exhaust the stack
+ *
+ * Walking the components in order visits callees before their callers, so results can be propagated bottom-up
+ * in one pass; the functions of a recursive cycle share one component.
+ *
+ * @param edges callees of every node, by node index
+ * @return
+ */
+StronglyConnectedComponents stronglyConnectedComponents(const std::vector<std::vector<size_t>> &edges);
+
+#endif // RUIANALYSIS_STRONGLYCONNECTEDCOMPONENTS_H
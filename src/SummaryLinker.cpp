@@ -0,0 +1,174 @@
+#include "SummaryLinker.h"
+
+#include <fstream>
+#include <set>
+#include "CallSites.h"
+#include "FFmpegUtils.h"
+#include "StronglyConnectedComponents.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+json SummaryLinker::summarise(ASTContext &Context, const string &fileName) {
+    const string fileKey = toDisplayPath(fileName);
+    json functionSummaries = json::array();
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        const string usr = getFunctionUSR(func);
+        if (usr.empty()) continue;
+
+        json ffmpeg = json::array();
+        json calls = json::array();
+        for (const CallSite &site: collectCallSites(func, Context)) {
+            if (site.ffmpeg) {
+                ffmpeg.push_back({site.callee, site.loopDepth});
+                continue;
+            }
+            const string callee = getFunctionUSR(site.expr->getDirectCallee());
+            if (!callee.empty()) {
+                calls.push_back({callee, site.loopDepth});
+            }
+        }
+        functionSummaries.push_back({{"usr", usr}, {"name", getMethodFullName(func)}, {"file", fileKey},
+                                     {"ffmpeg", ffmpeg}, {"calls", calls}});
+    }
+    return {{"file", fileName}, {"functions", functionSummaries}};
+}
+
+bool SummaryLinker::write(const string &directory, const json &summary) {
+    // one file per translation unit, named after its path
+    const string file = summary["file"].get<string>();
+    MD5 hash;
+    hash.update(file);
+    MD5::MD5Result digest;
+    hash.final(digest);
+    SmallString<256> path(directory);
+    sys::path::append(path, sys::path::filename(file) + "-" + digest.digest().substr(0, 16) + ".json");
+
+    const string outputPath(path);
+    const string temporaryPath = outputPath + ".tmp" + to_string(sys::Process::getProcessId());
+    {
+        error_code ec;
+        raw_fd_ostream os(temporaryPath, ec);
+        if (ec) {
+            errs() << "Error: Could not write '" << outputPath << "': " << ec.message() << "\n";
+            return false;
+        }
+        os << summary.dump();
+    }
+    if (error_code ec = sys::fs::rename(temporaryPath, outputPath)) {
+        sys::fs::remove(temporaryPath);
+        errs() << "Error: Could not write '" << outputPath << "': " << ec.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool SummaryLinker::load(const string &directory) {
+    error_code ec;
+    for (sys::fs::directory_iterator it(directory, ec), end; it != end && !ec; it.increment(ec)) {
+        if (sys::path::extension(it->path()) != ".json") continue;
+        ifstream ifs(it->path());
+        try {
+            add(json::parse(ifs));
+        } catch (const json::exception &e) {
+            errs() << "Error: Invalid summary '" << it->path() << "': " << e.what() << "\n";
+        }
+    }
+    if (ec) {
+        errs() << "Error: Could not read summaries in '" << directory << "': " << ec.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+void SummaryLinker::add(const json &summary) {
+    translationUnits++;
+    for (const auto &function: summary.at("functions")) {
+        const string usr = function.at("usr").get<string>();
+        if (functions.count(usr)) continue;
+        FunctionSummary &entry = functions[usr];
+        entry.name = function.at("name").get<string>();
+        entry.fileKey = function.at("file").get<string>();
+        entry.ffmpegCalls = function.at("ffmpeg").get<vector<pair<string, unsigned>>>();
+        entry.calls = function.at("calls").get<vector<pair<string, unsigned>>>();
+    }
+}
+
+json SummaryLinker::link() const {
+    // calls to functions without a summary (system, external libraries) are dropped
+    vector<const FunctionSummary *> nodes;
+    map<string, size_t> nodeIndex;
+    for (const auto &[usr, function]: functions) {
+        nodeIndex[usr] = nodes.size();
+        nodes.push_back(&function);
+    }
+    vector<vector<pair<size_t, unsigned>>> edges(nodes.size());
+    vector<vector<size_t>> callees(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (const auto &[callee, loopDepth]: nodes[i]->calls) {
+            auto target = nodeIndex.find(callee);
+            if (target != nodeIndex.end()) {
+                edges[i].push_back({target->second, loopDepth});
+                callees[i].push_back(target->second);
+            }
+        }
+    }
+
+    // components are completed callees first
+    const StronglyConnectedComponents scc = stronglyConnectedComponents(callees);
+    const vector<size_t> &component = scc.component;
+    const vector<vector<size_t>> &components = scc.members;
+
+    // Bottom-up: the members of a component reach the same APIs, with the deepest loop nesting on the way
+    vector<map<string, unsigned>> reach(components.size());
+    auto deepen = [](map<string, unsigned> &apis, const string &api, unsigned loopDepth) {
+        auto [entry, inserted] = apis.emplace(api, loopDepth);
+        if (!inserted) {
+            entry->second = max(entry->second, loopDepth);
+        }
+    };
+    for (size_t c = 0; c < components.size(); ++c) {
+        map<string, unsigned> &apis = reach[c];
+        for (const size_t member: components[c]) {
+            for (const auto &[api, loopDepth]: nodes[member]->ffmpegCalls) {
+                deepen(apis, api, loopDepth);
+            }
+            for (const auto &[target, loopDepth]: edges[member]) {
+                if (component[target] == c) continue;
+                for (const auto &[api, calleeDepth]: reach[component[target]]) {
+                    deepen(apis, api, loopDepth + calleeDepth);
+                }
+            }
+        }
+    }
+
+    json result = json::object();
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const map<string, unsigned> &apis = reach[component[i]];
+        if (apis.empty()) continue;
+        set<string> direct;
+        for (const auto &[api, loopDepth]: nodes[i]->ffmpegCalls) {
+            direct.insert(api);
+        }
+        json &entry = result[nodes[i]->fileKey][nodes[i]->name];
+        for (const auto &[api, loopDepth]: apis) {
+            // overloads share a name, their entries are merged
+            unsigned deepest = loopDepth;
+            bool directCall = direct.count(api) > 0;
+            if (entry.contains(api)) {
+                deepest = max(deepest, entry[api]["loopDepth"].get<unsigned>());
+                directCall = directCall || entry[api]["direct"].get<bool>();
+            }
+            entry[api] = {{"loopDepth", deepest}, {"direct", directCall}};
+        }
+    }
+    return result;
+}
@@ -0,0 +1,74 @@
+#ifndef RUIANALYSIS_SUMMARYLINKER_H
+#define RUIANALYSIS_SUMMARYLINKER_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/ASTContext.h"
+
+/**
+ * Answer whole-program FFmpeg reachability from per-function summaries
+ *
+ * Every translation unit is reduced to compact summaries of its functions: the direct FFmpeg calls and
+ * the callees, both with the loop depth of the call. Callees are identified by USR, so a helper defined
+ * in another file is the same function. The summaries of all translation units are kept in a directory;
+ * the link phase reads them without parsing and propagates the FFmpeg calls bottom-up over the strongly
+ * connected components of the call graph, in time linear in the size of the summaries.
+ */
+class SummaryLinker {
+public:
+    /**
+     * Summarise the function definitions of a translation unit
+     *
+     * @param Context
+     * @param fileName
+     * @return {"file": ..., "functions": [{"usr", "name", "file", "ffmpeg": [[api, depth]], "calls": [[usr, depth]]}]}
+     */
+    static nlohmann::json summarise(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Write the summary of a translation unit into the directory, replacing the one of a previous run
+     *
+     * @param directory
+     * @param summary
+     * @return false if the file cannot be written
+     */
+    static bool write(const std::string &directory, const nlohmann::json &summary);
+
+    /**
+     * Read all summaries of a directory
+     *
+     * @param directory
+     * @return false if the directory cannot be read
+     */
+    bool load(const std::string &directory);
+
+    /**
+     * Combine the summaries, a function defined in several translation units (inline, templates) is
+     * taken from the first one
+     *
+     * @return {file: {function: {api: {"loopDepth": n, "direct": bool}}}} for the functions reaching FFmpeg
+     */
+    nlohmann::json link() const;
+
+    size_t translationUnitCount() const {
+        return translationUnits;
+    }
+
+private:
+    struct FunctionSummary {
+        std::string name;
+        std::string fileKey;
+        std::vector<std::pair<std::string, unsigned>> ffmpegCalls;
+        std::vector<std::pair<std::string, unsigned>> calls;
+    };
+
+    std::map<std::string, FunctionSummary> functions;
+    size_t translationUnits = 0;
+
+    void add(const nlohmann::json &summary);
+};
+
+#endif // RUIANALYSIS_SUMMARYLINKER_H
@@ -0,0 +1,110 @@
+#include "SymbolIndex.h"
+
+#include <fstream>
+#include "FFmpegUtils.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+static constexpr unsigned indexVersion = 2;
+
+bool SymbolIndex::load(const string &path) {
+    lock_guard<std::mutex> guard(mutex);
+    ifstream ifs(path);
+    if (!ifs) return true;
+    try {
+        json index = json::parse(ifs);
+        if (index.value("version", 0u) != indexVersion) return true;
+        files = index.value("files", json::object()).get<map<string, map<string, string>>>();
+    } catch (const json::exception &e) {
+        errs() << "Error: Invalid symbol index '" << path << "': " << e.what() << "\n";
+        files.clear();
+        return false;
+    }
+    definitions.clear();
+    usrs.clear();
+    for (const auto &[file, functions]: files) {
+        for (const auto &[usr, name]: functions) {
+            definitions[usr].insert(file);
+            usrs[name].insert(usr);
+        }
+    }
+    return true;
+}
+
+bool SymbolIndex::save(const string &path) const {
+    const string temporaryPath = path + ".tmp" + to_string(sys::Process::getProcessId());
+    {
+        error_code ec;
+        raw_fd_ostream os(temporaryPath, ec);
+        if (ec) {
+            errs() << "Error: Could not write symbol index '" << path << "': " << ec.message() << "\n";
+            return false;
+        }
+        lock_guard<std::mutex> guard(mutex);
+        os << json{{"version", indexVersion}, {"files", files}}.dump();
+    }
+    if (error_code ec = sys::fs::rename(temporaryPath, path)) {
+        sys::fs::remove(temporaryPath);
+        errs() << "Error: Could not write symbol index '" << path << "': " << ec.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+string SymbolIndex::indexKey(const string &fileName) {
+    SmallString<256> path(fileName);
+    sys::fs::make_absolute(path);
+    sys::path::remove_dots(path, true);
+    return string(path);
+}
+
+void SymbolIndex::addTranslationUnit(ASTContext &Context, const string &fileName) {
+    const string key = indexKey(fileName);
+    map<string, string> defined;
+    for (const FunctionDecl *func: collectFunctionDefinitions(Context)) {
+        defined.emplace(getFunctionUSR(func), getMethodFullName(func));
+    }
+
+    lock_guard<std::mutex> guard(mutex);
+    map<string, string> &functions = files[key];
+    for (const auto &[usr, name]: functions) {
+        auto entry = definitions.find(usr);
+        entry->second.erase(key);
+        if (entry->second.empty()) {
+            definitions.erase(entry);
+            // no other translation unit defines it
+            auto named = usrs.find(name);
+            named->second.erase(usr);
+            if (named->second.empty()) {
+                usrs.erase(named);
+            }
+        }
+    }
+    functions = std::move(defined);
+    for (const auto &[usr, name]: functions) {
+        definitions[usr].insert(key);
+        usrs[name].insert(usr);
+    }
+}
+
+vector<string> SymbolIndex::definingFiles(const string &usr) const {
+    lock_guard<std::mutex> guard(mutex);
+    auto entry = definitions.find(usr);
+    if (entry == definitions.end()) return {};
+    return vector<string>(entry->second.begin(), entry->second.end());
+}
+
+vector<string> SymbolIndex::functionUSRs(const string &name) const {
+    lock_guard<std::mutex> guard(mutex);
+    auto entry = usrs.find(name);
+    if (entry == usrs.end()) return {};
+    return vector<string>(entry->second.begin(), entry->second.end());
+}
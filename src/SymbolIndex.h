@@ -0,0 +1,85 @@
+#ifndef RUIANALYSIS_SYMBOLINDEX_H
+#define RUIANALYSIS_SYMBOLINDEX_H
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "clang/AST/ASTContext.h"
+
+/**
+ * Keep the translation units defining each function between runs
+ *
+ * Functions are keyed by USR, so static functions of the same name in different files stay apart; their
+ * names are kept to find the functions a name stands for. Every analysed translation unit replaces its own entry, so the index follows the project as files are
+ * edited, added and analysed again; translation units not analysed in a run keep the entries of the run
+ * that last did. Functions defined in headers are listed under every translation unit including them. Parse
+ * workers update and look up the index concurrently.
+ */
+class SymbolIndex {
+public:
+    /**
+     * Read the index of previous runs, a missing or outdated file is an empty index
+     *
+     * @param path
+     * @return false if the file exists but cannot be parsed
+     */
+    bool load(const std::string &path);
+
+    /**
+     * Write the index aside and rename it over the file, so concurrent runs never leave a torn file
+     *
+     * @param path
+     * @return false if the file cannot be written
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * Replace the functions defined by a translation unit
+     *
+     * @param Context
+     * @param fileName
+     */
+    void addTranslationUnit(clang::ASTContext &Context, const std::string &fileName);
+
+    /**
+     * Translation units defining a function, by absolute path
+     *
+     * @param usr
+     * @return
+     */
+    std::vector<std::string> definingFiles(const std::string &usr) const;
+
+    /**
+     * USRs of the indexed functions of a name, several for static functions of that name in different files
+     *
+     * @param name as in the call map
+     * @return
+     */
+    std::vector<std::string> functionUSRs(const std::string &name) const;
+
+    /**
+     * Absolute path a translation unit is indexed under
+     *
+     * @param fileName
+     * @return
+     */
+    static std::string indexKey(const std::string &fileName);
+
+    size_t size() const {
+        std::lock_guard<std::mutex> guard(mutex);
+        return files.size();
+    }
+
+private:
+    mutable std::mutex mutex;
+    // translation unit -> USR -> name of the functions defined, as persisted
+    std::map<std::string, std::map<std::string, std::string>> files;
+    // USR -> translation units defining it
+    std::map<std::string, std::set<std::string>> definitions;
+    // name -> USRs of the functions defined
+    std::map<std::string, std::set<std::string>> usrs;
+};
+
+#endif // RUIANALYSIS_SYMBOLINDEX_H
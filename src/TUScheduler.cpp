@@ -0,0 +1,523 @@
+#include "TUScheduler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <queue>
+#include <set>
+#include <thread>
+#include <unistd.h>
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+// Slowest translation units listed in the report
+static constexpr size_t reportedFiles = 10;
+// Resident memory of a Clang worker per byte of AST and source manager allocations
+static constexpr double residentPerTrackedByte = 2.0;
+// Interval at which the watchdog checks the running files
+static constexpr chrono::milliseconds watchdogInterval(100);
+
+// Phase of a running translation unit, shared by its worker and the watchdog
+enum JobPhase : int {
+    Parsing,
+    Cancelled,
+    Analysing,
+};
+
+static thread_local atomic<int> *currentPhase = nullptr;
+
+struct TUScheduler::RunState {
+    struct Job {
+        string file;
+        double seconds;
+        uint64_t memory;
+        Measurement shape;
+    };
+
+    struct Running {
+        size_t worker;
+        chrono::steady_clock::time_point start;
+        shared_ptr<atomic<int>> phase;
+        bool abandoned;
+    };
+
+    // longest expected first, then in order of arrival
+    struct Longer {
+        bool operator()(const pair<double, size_t> &a, const pair<double, size_t> &b) const {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        }
+    };
+
+    std::mutex mutex;
+    condition_variable wake;
+    function<int(const string &)> analyse;
+    // files in order of arrival, a deque keeps the jobs of running workers in place while files arrive
+    deque<Job> order;
+    set<pair<double, size_t>, Longer> waiting;
+    // no more files will arrive
+    bool closed = false;
+    // workers that are not abandoned
+    size_t activeWorkers = 0;
+    uint64_t availableMemory = 0;
+    uint64_t inFlightMemory = 0;
+    map<size_t, Running> running;
+    int status = 0;
+
+    /**
+     * Next file a worker may start: the longest waiting one that fits into the memory budget, or the
+     * longest one when nothing else runs
+     *
+     * @return nothing if no file is waiting or none fits
+     */
+    optional<size_t> admit() {
+        if (waiting.empty()) return nullopt;
+        const bool idle = none_of(running.begin(), running.end(),
+                                  [](const auto &entry) { return !entry.second.abandoned; });
+        if (idle || !availableMemory) return waiting.begin()->second;
+
+        for (const auto &[seconds, index]: waiting) {
+            if (inFlightMemory + order[index].memory <= availableMemory) {
+                return index;
+            }
+        }
+        return nullopt;
+    }
+};
+
+/**
+ * Key of a file in the profile
+ *
+ * @param file
+ * @return
+ */
+static string profileKey(const string &file) {
+    error_code ec;
+    filesystem::path absolute = filesystem::absolute(file, ec);
+    return (ec ? filesystem::path(file) : absolute).lexically_normal().string();
+}
+
+/**
+ * Number of #include directives of a file
+ *
+ * @param path
+ * @return
+ */
+static unsigned countIncludes(const string &path) {
+    ifstream ifs(path);
+    unsigned includes = 0;
+    string line;
+    while (getline(ifs, line)) {
+        const size_t hash = line.find_first_not_of(" \t");
+        if (hash == string::npos || line[hash] != '#') continue;
+        const size_t directive = line.find_first_not_of(" \t", hash + 1);
+        if (directive != string::npos && line.compare(directive, 7, "include") == 0) {
+            includes++;
+        }
+    }
+    return includes;
+}
+
+/**
+ * Resident memory of the process
+ *
+ * @return bytes, 0 where /proc is unavailable
+ */
+static uint64_t residentMemory() {
+    ifstream statm("/proc/self/statm");
+    uint64_t size = 0;
+    uint64_t resident = 0;
+    if (!(statm >> size >> resident)) return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Least squares fit of value = perByte * bytes + perInclude * includes
+ *
+ * Collinear samples or a negative coefficient scale the given coefficients to the observed total instead.
+ *
+ * @param samples (bytes, includes, value)
+ * @param perByte
+ * @param perInclude
+ */
+static void fitLinear(const vector<array<double, 3>> &samples, double &perByte, double &perInclude) {
+    if (samples.size() < 2) return;
+
+    double xx = 0, xy = 0, yy = 0, xv = 0, yv = 0;
+    for (const auto &[x, y, value]: samples) {
+        xx += x * x;
+        xy += x * y;
+        yy += y * y;
+        xv += x * value;
+        yv += y * value;
+    }
+    const double determinant = xx * yy - xy * xy;
+    if (determinant > 1e-9 * xx * yy) {
+        const double fittedPerByte = (xv * yy - yv * xy) / determinant;
+        const double fittedPerInclude = (yv * xx - xv * xy) / determinant;
+        if (fittedPerByte >= 0 && fittedPerInclude >= 0) {
+            perByte = fittedPerByte;
+            perInclude = fittedPerInclude;
+            return;
+        }
+    }
+    double estimated = 0, actual = 0;
+    for (const auto &[x, y, value]: samples) {
+        estimated += perByte * x + perInclude * y;
+        actual += value;
+    }
+    if (estimated > 0) {
+        perByte *= actual / estimated;
+        perInclude *= actual / estimated;
+    }
+}
+
+TUScheduler::TUScheduler(unsigned jobs, uint64_t memoryBudget, double timeLimit)
+    : jobs(jobs ? jobs : max(1u, thread::hardware_concurrency())), memoryBudget(memoryBudget),
+      timeLimit(timeLimit) {
+}
+
+bool TUScheduler::loadProfile(const string &path) {
+    ifstream ifs(path);
+    if (!ifs) return true;
+    try {
+        json profile = json::parse(ifs);
+        const json files = profile.value("files", json::object());
+        for (const auto &[file, entry]: files.items()) {
+            Measurement measurement;
+            measurement.seconds = entry.value("seconds", 0.0);
+            measurement.memory = entry.value("memory", uint64_t(0));
+            measurement.bytes = entry.value("bytes", uint64_t(0));
+            measurement.includes = entry.value("includes", 0u);
+            measurement.timedOut = entry.value("timedOut", false);
+            history[file] = measurement;
+        }
+    } catch (const json::exception &e) {
+        errs() << "Error: Invalid schedule profile '" << path << "': " << e.what() << "\n";
+        history.clear();
+        return false;
+    }
+    fitEstimate();
+    return true;
+}
+
+bool TUScheduler::saveProfile(const string &path) const {
+    lock_guard<std::mutex> guard(mutex);
+    auto entry = [](const Measurement &measurement, double seconds) {
+        json result = {{"seconds", seconds}, {"memory", measurement.memory},
+                       {"bytes", measurement.bytes}, {"includes", measurement.includes}};
+        if (measurement.timedOut) {
+            result["timedOut"] = true;
+        }
+        return result;
+    };
+
+    json files = json::object();
+    for (const auto &[file, measurement]: history) {
+        if (measured.count(file)) continue;
+        files[file] = entry(measurement, measurement.seconds);
+    }
+    for (const auto &[file, measurement]: measured) {
+        // smooth run-to-run noise with the previous measurement, a timeout is only a lower bound
+        double seconds = measurement.seconds;
+        auto previous = history.find(file);
+        if (previous != history.end() && !measurement.timedOut) {
+            seconds = (seconds + previous->second.seconds) / 2;
+        }
+        files[file] = entry(measurement, seconds);
+    }
+
+    ofstream ofs(path, ios::out | ios::trunc);
+    if (!ofs) {
+        errs() << "Error: Could not write schedule profile '" << path << "'\n";
+        return false;
+    }
+    ofs << json{{"files", files}}.dump(2);
+    return true;
+}
+
+void TUScheduler::fitEstimate() {
+    vector<array<double, 3>> times;
+    vector<array<double, 3>> memories;
+    for (const auto &[file, measurement]: history) {
+        if (!measurement.bytes) continue;
+        const double bytes = measurement.bytes;
+        const double includes = measurement.includes;
+        if (!measurement.timedOut) {
+            times.push_back({bytes, includes, measurement.seconds});
+        }
+        if (measurement.memory) {
+            memories.push_back({bytes, includes, double(measurement.memory)});
+        }
+    }
+    fitLinear(times, secondsPerByte, secondsPerInclude);
+    fitLinear(memories, memoryPerByte, memoryPerInclude);
+}
+
+double TUScheduler::predict(const string &file, Measurement &shape) {
+    auto known = history.find(profileKey(file));
+    if (known != history.end()) {
+        shape = known->second;
+        if (!shape.memory) {
+            shape.memory = uint64_t(memoryPerByte * shape.bytes + memoryPerInclude * shape.includes);
+        }
+        return known->second.seconds;
+    }
+    error_code ec;
+    shape.bytes = filesystem::file_size(file, ec);
+    if (ec) shape.bytes = 0;
+    shape.includes = countIncludes(file);
+    shape.memory = uint64_t(memoryPerByte * shape.bytes + memoryPerInclude * shape.includes);
+    estimatedFiles++;
+    return secondsPerByte * shape.bytes + secondsPerInclude * shape.includes;
+}
+
+double TUScheduler::simulateMakespan(const vector<double> &durations) const {
+    // greedy list scheduling: every file goes to the worker that becomes idle first
+    priority_queue<double, vector<double>, greater<>> workers;
+    for (unsigned i = 0; i < jobs; ++i) {
+        workers.push(0);
+    }
+    double makespan = 0;
+    for (double duration: durations) {
+        const double finish = workers.top() + duration;
+        workers.pop();
+        workers.push(finish);
+        makespan = max(makespan, finish);
+    }
+    return makespan;
+}
+
+void TUScheduler::recordRun(const string &file, double seconds, const Measurement &shape, bool timedOut) {
+    lock_guard<std::mutex> guard(mutex);
+    Measurement &measurement = measured[profileKey(file)];
+    measurement.seconds = seconds;
+    measurement.bytes = shape.bytes;
+    measurement.includes = shape.includes;
+    measurement.timedOut = timedOut;
+}
+
+void TUScheduler::work(shared_ptr<RunState> state, size_t worker) {
+    unique_lock<std::mutex> guard(state->mutex);
+    while (true) {
+        optional<size_t> next;
+        state->wake.wait(guard, [&]() {
+            next = state->admit();
+            return next || (state->closed && state->waiting.empty());
+        });
+        if (!next) break;
+
+        const RunState::Job &job = state->order[*next];
+        state->waiting.erase({job.seconds, *next});
+        state->inFlightMemory += job.memory;
+        auto phase = make_shared<atomic<int>>(Parsing);
+        state->running[*next] = {worker, chrono::steady_clock::now(), phase, false};
+        guard.unlock();
+
+        currentPhase = phase.get();
+        const int result = state->analyse(job.file);
+        currentPhase = nullptr;
+
+        guard.lock();
+        state->status = max(state->status, result);
+        state->inFlightMemory -= job.memory;
+        const RunState::Running running = state->running[*next];
+        state->running.erase(*next);
+        state->wake.notify_all();
+        // a replacement took over, the scheduler may be gone
+        if (running.abandoned) return;
+        recordRun(job.file, secondsSince(running.start), job.shape, phase->load() == Cancelled);
+    }
+    state->activeWorkers--;
+    state->wake.notify_all();
+}
+
+vector<string> TUScheduler::shard(const vector<string> &files, unsigned index, unsigned count) {
+    vector<pair<uint64_t, size_t>> costs;
+    for (size_t i = 0; i < files.size(); ++i) {
+        error_code ec;
+        const uint64_t bytes = filesystem::file_size(files[i], ec);
+        costs.push_back({ec ? 0 : bytes, i});
+    }
+    // ties are broken by path, not by input order, which depends on the directory traversal
+    std::sort(costs.begin(), costs.end(), [&files](const auto &a, const auto &b) {
+        if (a.first != b.first) return a.first > b.first;
+        return files[a.second] < files[b.second];
+    });
+
+    vector<uint64_t> load(count, 0);
+    vector<bool> selected(files.size(), false);
+    for (const auto &[bytes, i]: costs) {
+        const size_t target = min_element(load.begin(), load.end()) - load.begin();
+        load[target] += bytes;
+        selected[i] = target == index;
+    }
+    vector<string> result;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (selected[i]) result.push_back(files[i]);
+    }
+    return result;
+}
+
+void TUScheduler::enqueue(RunState &state, const string &file) {
+    RunState::Job job{file, 0, 0, {}};
+    job.seconds = predict(file, job.shape);
+    job.memory = uint64_t(job.shape.memory * residentPerTrackedByte);
+    predicted[profileKey(file)] = job.seconds;
+    lock_guard<std::mutex> guard(state.mutex);
+    state.waiting.insert({job.seconds, state.order.size()});
+    state.order.push_back(std::move(job));
+    state.wake.notify_all();
+}
+
+int TUScheduler::run(const vector<string> &files, const function<int(const string &)> &analyse) {
+    auto state = make_shared<RunState>();
+    state->analyse = analyse;
+    estimatedFiles = 0;
+    // all files are known, the first workers already start on the longest ones
+    for (const string &file: files) {
+        enqueue(*state, file);
+    }
+    state->closed = true;
+    return execute(state);
+}
+
+int TUScheduler::run(const function<bool(string &)> &next, const function<int(const string &)> &analyse) {
+    auto state = make_shared<RunState>();
+    state->analyse = analyse;
+    estimatedFiles = 0;
+    thread feeder([this, state, &next]() {
+        string file;
+        while (next(file)) {
+            enqueue(*state, file);
+        }
+        lock_guard<std::mutex> guard(state->mutex);
+        state->closed = true;
+        state->wake.notify_all();
+    });
+    const int status = execute(state);
+    feeder.join();
+    return status;
+}
+
+int TUScheduler::execute(shared_ptr<RunState> state) {
+    if (memoryBudget) {
+        // the budget covers the process, not only the translation units
+        const uint64_t baseline = residentMemory();
+        state->availableMemory = memoryBudget > baseline ? memoryBudget - baseline : 1;
+    }
+
+    const auto start = chrono::steady_clock::now();
+    vector<thread> pool;
+    unique_lock<std::mutex> guard(state->mutex);
+    state->activeWorkers = state->closed ? min<size_t>(jobs, state->order.size()) : jobs;
+    for (size_t i = 0; i < state->activeWorkers; ++i) {
+        pool.emplace_back(&TUScheduler::work, this, state, i);
+    }
+
+    // Watchdog: cancel files over the time limit, replace workers that do not return after cancellation
+    const double grace = max(1.0, timeLimit / 4);
+    while (!state->closed || !state->waiting.empty() || state->activeWorkers > 0) {
+        if (timeLimit <= 0) {
+            state->wake.wait(guard);
+            continue;
+        }
+        state->wake.wait_for(guard, watchdogInterval);
+        for (auto &[index, running]: state->running) {
+            if (running.abandoned) continue;
+            const double elapsed = secondsSince(running.start);
+            if (elapsed < timeLimit) continue;
+
+            int parsing = Parsing;
+            running.phase->compare_exchange_strong(parsing, Cancelled);
+            if (running.phase->load() != Cancelled || elapsed < timeLimit + grace) continue;
+
+            const RunState::Job &job = state->order[index];
+            errs() << "Error: Could not analyse '" << job.file << "' within " << llvm::format("%.1f", timeLimit)
+                    << "s, abandoning it\n";
+            running.abandoned = true;
+            pool[running.worker].detach();
+            abandonedWorkers++;
+            recordRun(job.file, elapsed, job.shape, true);
+            if (abandonHandler) {
+                abandonHandler(job.file);
+            }
+            pool.emplace_back(&TUScheduler::work, this, state, pool.size());
+        }
+    }
+    guard.unlock();
+    for (thread &t: pool) {
+        if (t.joinable()) t.join();
+    }
+    actualMakespan = secondsSince(start);
+
+    // the makespan of the longest-first order over all files, as if they had been known from the start
+    vector<double> durations;
+    for (const RunState::Job &job: state->order) {
+        durations.push_back(job.seconds);
+    }
+    std::sort(durations.begin(), durations.end(), greater<>());
+    predictedMakespan = simulateMakespan(durations);
+    return state->status;
+}
+
+void TUScheduler::recordMemory(const string &file, uint64_t bytes) {
+    lock_guard<std::mutex> guard(mutex);
+    uint64_t &memory = measured[profileKey(file)].memory;
+    memory = max(memory, bytes);
+}
+
+bool TUScheduler::cancelled() {
+    return currentPhase && currentPhase->load() == Cancelled;
+}
+
+bool TUScheduler::beginAnalysis() {
+    if (!currentPhase) return true;
+    int parsing = Parsing;
+    return currentPhase->compare_exchange_strong(parsing, Analysing) || parsing == Analysing;
+}
+
+json TUScheduler::report() const {
+    lock_guard<std::mutex> guard(mutex);
+    vector<pair<string, Measurement>> slowest(measured.begin(), measured.end());
+    stable_sort(slowest.begin(), slowest.end(),
+                [](const auto &a, const auto &b) { return a.second.seconds > b.second.seconds; });
+
+    json timedOut = json::array();
+    for (const auto &[file, measurement]: slowest) {
+        if (measurement.timedOut) {
+            timedOut.push_back(file);
+        }
+    }
+    if (slowest.size() > reportedFiles) {
+        slowest.resize(reportedFiles);
+    }
+
+    json files = json::array();
+    for (const auto &[file, measurement]: slowest) {
+        auto prediction = predicted.find(file);
+        files.push_back({{"file", file},
+                         {"seconds", measurement.seconds},
+                         {"predictedSeconds", prediction != predicted.end() ? prediction->second : 0.0},
+                         {"memory", measurement.memory}});
+    }
+    return {{"jobs", jobs},
+            {"predictedSeconds", predictedMakespan},
+            {"actualSeconds", actualMakespan},
+            {"estimatedFiles", estimatedFiles},
+            {"slowest", files},
+            {"timedOut", timedOut}};
+}
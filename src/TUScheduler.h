@@ -0,0 +1,178 @@
+#ifndef RUIANALYSIS_TUSCHEDULER_H
+#define RUIANALYSIS_TUSCHEDULER_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * Run translation units on parallel workers, longest expected first
+ *
+ * The analysis time and AST memory of every translation unit are kept in a profile file. Files without
+ * history are estimated from their size and number of #include lines, with coefficients fitted to the
+ * profiled files. After the run the predicted makespan is compared with the measured one.
+ *
+ * With a memory budget a file is only started while the projected memory of all running files fits. With
+ * a time limit a file that runs too long is cancelled: its parse stops at the next top-level declaration,
+ * and a worker that does not return soon after is abandoned and replaced.
+ */
+class TUScheduler {
+public:
+    /**
+     * @param jobs parallel workers, 0 for one per core
+     * @param memoryBudget bytes of projected memory use, 0 for no limit
+     * @param timeLimit seconds per translation unit, 0 for no limit
+     */
+    TUScheduler(unsigned jobs, uint64_t memoryBudget, double timeLimit);
+
+    /**
+     * Read the profile of previous runs, a missing file is an empty profile
+     *
+     * @param path
+     * @return false if the file exists but cannot be parsed
+     */
+    bool loadProfile(const std::string &path);
+
+    /**
+     * Write the merged profile of previous runs and this one
+     *
+     * @param path
+     * @return false if the file cannot be written
+     */
+    bool saveProfile(const std::string &path) const;
+
+    /**
+     * Deal the files into shards of about equal size, largest first onto the least loaded shard
+     *
+     * The partition only depends on the files and their sizes, not on the schedule profile, which differs
+     * between machines; so the shards of a run cover each file exactly once without coordination.
+     *
+     * @param files
+     * @param index shard to keep, from 0
+     * @param count number of shards
+     * @return the files of the shard, in input order
+     */
+    static std::vector<std::string> shard(const std::vector<std::string> &files, unsigned index, unsigned count);
+
+    /**
+     * Analyse all files, the workers take them in order of decreasing expected time
+     *
+     * @param files
+     * @param analyse called concurrently with one file at a time, returns a ClangTool status
+     * @return highest status returned
+     */
+    int run(const std::vector<std::string> &files, const std::function<int(const std::string &)> &analyse);
+
+    /**
+     * Analyse files while they are still being found, the workers take the longest of the files arrived
+     *
+     * @param next waits for the next file, false when there are no more
+     * @param analyse called concurrently with one file at a time, returns a ClangTool status
+     * @return highest status returned
+     */
+    int run(const std::function<bool(std::string &)> &next, const std::function<int(const std::string &)> &analyse);
+
+    /**
+     * Be told of files abandoned after their time limit, whose analyse call may never return
+     *
+     * @param handler called with the file, from the watchdog
+     */
+    void onAbandoned(std::function<void(const std::string &)> handler) {
+        abandonHandler = std::move(handler);
+    }
+
+    /**
+     * Record the memory held by a parsed translation unit, may be called from any worker
+     *
+     * @param file
+     * @param bytes
+     */
+    void recordMemory(const std::string &file, uint64_t bytes);
+
+    /**
+     * Whether the translation unit of the calling worker ran out of time and should stop parsing
+     *
+     * @return
+     */
+    static bool cancelled();
+
+    /**
+     * Mark the start of the analysis of a parsed translation unit, which is not cancelled afterwards
+     *
+     * @return false if the translation unit already ran out of time and must not be analysed
+     */
+    static bool beginAnalysis();
+
+    /**
+     * Predicted and measured makespan of the last run
+     *
+     * @return {"jobs": ..., "predictedSeconds": ..., "actualSeconds": ..., "estimatedFiles": ..., "slowest": [...],
+     *          "timedOut": [...]}
+     */
+    nlohmann::json report() const;
+
+    /**
+     * Whether workers of timed-out files are still running; the process must then end without running
+     * static destructors
+     *
+     * @return
+     */
+    bool hasAbandonedWorkers() const {
+        return abandonedWorkers > 0;
+    }
+
+private:
+    struct Measurement {
+        double seconds = 0;
+        uint64_t memory = 0;
+        uint64_t bytes = 0;
+        unsigned includes = 0;
+        bool timedOut = false;
+    };
+
+    struct RunState;
+
+    unsigned jobs;
+    uint64_t memoryBudget;
+    double timeLimit;
+
+    // seconds and AST bytes per byte and per #include line for files without history
+    double secondsPerByte = 2e-7;
+    double secondsPerInclude = 0.01;
+    double memoryPerByte = 200;
+    double memoryPerInclude = 2 << 20;
+
+    mutable std::mutex mutex;
+    std::map<std::string, Measurement> history;
+    std::map<std::string, Measurement> measured;
+    std::map<std::string, double> predicted;
+
+    std::function<void(const std::string &)> abandonHandler;
+
+    size_t estimatedFiles = 0;
+    size_t abandonedWorkers = 0;
+    double predictedMakespan = 0;
+    double actualMakespan = 0;
+
+    void fitEstimate();
+
+    double predict(const std::string &file, Measurement &shape);
+
+    double simulateMakespan(const std::vector<double> &durations) const;
+
+    void enqueue(RunState &state, const std::string &file);
+
+    int execute(std::shared_ptr<RunState> state);
+
+    void work(std::shared_ptr<RunState> state, size_t worker);
+
+    void recordRun(const std::string &file, double seconds, const Measurement &shape, bool timedOut);
+};
+
+#endif // RUIANALYSIS_TUSCHEDULER_H
@@ -0,0 +1,128 @@
+#include "TemplateInstantiations.h"
+
+#include "FFmpegUtils.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Index/USRGeneration.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace llvm;
+using namespace std;
+using json = nlohmann::json;
+
+/**
+ * Visitor class: find expressions of a template body whose callee or branch depends on the template arguments
+ */
+class ArgumentDependenceFinder : public RecursiveASTVisitor<ArgumentDependenceFinder> {
+public:
+    bool found = false;
+
+    bool VisitExpr(Expr *expr) {
+        // unresolved calls, operators and members are only bound at instantiation; members of the current
+        // instantiation are resolved already, although `this` has a dependent type
+        if (expr->isTypeDependent() && !isa<CXXThisExpr>(expr)) {
+            found = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool VisitIfStmt(IfStmt *stmt) {
+        if (stmt->isConstexpr() && stmt->getCond() && stmt->getCond()->isValueDependent()) {
+            found = true;
+            return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * USR of a declaration, including the template arguments of a specialization
+ *
+ * @param decl
+ * @return empty if none can be generated
+ */
+static string declarationUSR(const Decl *decl) {
+    SmallString<128> usr;
+    if (index::generateUSRForDecl(decl, usr)) return "";
+    return string(usr);
+}
+
+string TemplateInstantiations::foldingKey(const FunctionDecl *instantiation) {
+    FunctionDecl *pattern = instantiation->getTemplateInstantiationPattern();
+    const string templateKey = declarationUSR(pattern) + "@" + to_string(pattern->getODRHash());
+    auto known = dependent.find(templateKey);
+    if (known == dependent.end()) {
+        ArgumentDependenceFinder finder;
+        finder.TraverseStmt(pattern->getBody());
+        known = dependent.emplace(templateKey, finder.found).first;
+    }
+    if (!known->second) return templateKey;
+    const string usr = declarationUSR(instantiation);
+    // without a USR the instantiation is not folded with anything
+    return usr.empty() ? "" : templateKey + "#" + usr;
+}
+
+TemplateInstantiations::TemplateUse &TemplateInstantiations::templateUse(const FunctionDecl *instantiation) {
+    const FunctionDecl *pattern = instantiation->getTemplateInstantiationPattern();
+    const SourceManager &SM = instantiation->getASTContext().getSourceManager();
+    const string fileKey = toDisplayPath(SM.getFilename(SM.getExpansionLoc(pattern->getLocation())).str());
+    return templates[{fileKey, getMethodFullName(pattern)}];
+}
+
+/**
+ * Name of an instantiation with its template arguments, e.g. FrameRef<AVFrame>::reset
+ *
+ * @param instantiation
+ * @return
+ */
+static string instantiationName(const FunctionDecl *instantiation) {
+    string name;
+    raw_string_ostream os(name);
+    instantiation->getNameForDiagnostic(os, instantiation->getASTContext().getPrintingPolicy(), true);
+    return os.str();
+}
+
+const TemplateInstantiations::Calls *TemplateInstantiations::lookup(const FunctionDecl *instantiation) {
+    TemplateUse &use = templateUse(instantiation);
+    const string name = instantiationName(instantiation);
+    use.instantiations.insert(name);
+
+    const string key = foldingKey(instantiation);
+    if (key.empty()) return nullptr;
+    auto entry = folded.find(key);
+    if (entry == folded.end()) return nullptr;
+    if (!entry->second.ffmpegCalls.empty()) {
+        use.ffmpegCalls[name] = entry->second.ffmpegCalls;
+    }
+    return &entry->second;
+}
+
+void TemplateInstantiations::store(const FunctionDecl *instantiation, Calls calls) {
+    TemplateUse &use = templateUse(instantiation);
+    use.analysed++;
+    if (!calls.ffmpegCalls.empty()) {
+        use.ffmpegCalls[instantiationName(instantiation)] = calls.ffmpegCalls;
+    }
+    const string key = foldingKey(instantiation);
+    if (!key.empty()) {
+        folded[key] = std::move(calls);
+    }
+}
+
+json TemplateInstantiations::report() const {
+    json result = json::object();
+    for (const auto &[templateKey, use]: templates) {
+        if (use.ffmpegCalls.empty()) continue;
+        json callingFFmpeg = json::object();
+        for (const auto &[name, apis]: use.ffmpegCalls) {
+            callingFFmpeg[name] = apis;
+        }
+        result[templateKey.first][templateKey.second] = {{"instantiations", use.instantiations.size()},
+                                                         {"analysed", use.analysed},
+                                                         {"callingFFmpeg", callingFFmpeg}};
+    }
+    return result;
+}
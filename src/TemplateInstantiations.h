@@ -0,0 +1,68 @@
+#ifndef RUIANALYSIS_TEMPLATEINSTANTIATIONS_H
+#define RUIANALYSIS_TEMPLATEINSTANTIATIONS_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "clang/AST/Decl.h"
+
+/**
+ * Fold the implicit instantiations of function templates and of members of class templates
+ *
+ * An instantiation calls the same functions as its template unless the template body has expressions
+ * depending on the template arguments (unresolved calls and operators, constexpr-if conditions). Without
+ * such expressions every instantiation of the template shares one analysis. With them, instantiations are
+ * identified by their USR, which includes the template arguments, so an instantiation found in many
+ * translation units is analysed once per run. Both keys include the ODR hash of the template, so editing
+ * the template body separates the results.
+ *
+ * Calls are attributed to the primary template, with the number of distinct instantiations and the ones
+ * calling FFmpeg.
+ */
+class TemplateInstantiations {
+public:
+    struct Calls {
+        std::vector<std::string> calls;
+        std::vector<std::string> ffmpegCalls;
+    };
+
+    /**
+     * Count an instantiation and look up the calls of an equal one analysed before
+     *
+     * @param instantiation function with a template instantiation pattern
+     * @return nullptr when it has to be analysed, the results are then given to store()
+     */
+    const Calls *lookup(const clang::FunctionDecl *instantiation);
+
+    void store(const clang::FunctionDecl *instantiation, Calls calls);
+
+    /**
+     * Instantiation counts of the templates calling FFmpeg
+     *
+     * @return {file: {template: {"instantiations": n, "analysed": n, "callingFFmpeg": {instantiation: [api, ...]}}}}
+     */
+    nlohmann::json report() const;
+
+private:
+    struct TemplateUse {
+        std::set<std::string> instantiations;
+        size_t analysed = 0;
+        std::map<std::string, std::vector<std::string>> ffmpegCalls;
+    };
+
+    // calls by folding key
+    std::map<std::string, Calls> folded;
+    // whether the calls of a template depend on its arguments, by template key
+    std::map<std::string, bool> dependent;
+    // by template file and name
+    std::map<std::pair<std::string, std::string>, TemplateUse> templates;
+
+    std::string foldingKey(const clang::FunctionDecl *instantiation);
+
+    TemplateUse &templateUse(const clang::FunctionDecl *instantiation);
+};
+
+#endif // RUIANALYSIS_TEMPLATEINSTANTIATIONS_H
@@ -0,0 +1,146 @@
+#include "WatchDaemon.h"
+
+#include <chrono>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Errno.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace std;
+
+WatchDaemon::WatchDaemon(function<void(const string &)> reanalyse, function<string()> render, string outputPath)
+    : reanalyse(std::move(reanalyse)), render(std::move(render)), outputPath(std::move(outputPath)) {
+}
+
+void WatchDaemon::recordDependencies(const string &translationUnit, const vector<string> &files) {
+    lock_guard<std::mutex> guard(mutex);
+    for (const string &file: dependencies[translationUnit]) {
+        dependents[file].erase(translationUnit);
+    }
+    dependencies[translationUnit] = files;
+    for (const string &file: files) {
+        dependents[file].insert(translationUnit);
+    }
+}
+
+bool WatchDaemon::publish() const {
+    // Written aside and renamed so readers never see a partial file
+    const string temporaryPath = outputPath + ".tmp" + to_string(sys::Process::getProcessId());
+    {
+        error_code ec;
+        raw_fd_ostream os(temporaryPath, ec);
+        if (ec) {
+            errs() << "Error: Could not write '" << outputPath << "': " << ec.message() << "\n";
+            return false;
+        }
+        os << render();
+    }
+    if (error_code ec = sys::fs::rename(temporaryPath, outputPath)) {
+        sys::fs::remove(temporaryPath);
+        errs() << "Error: Could not write '" << outputPath << "': " << ec.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+#ifdef __linux__
+// Events closer together than this belong to the same save
+static constexpr int settleMs = 50;
+static constexpr uint32_t watchedEvents = IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB;
+
+void WatchDaemon::watchDependencyDirectories() {
+    lock_guard<std::mutex> guard(mutex);
+    for (const auto &[file, translationUnits]: dependents) {
+        const string directory = sys::path::parent_path(file).str();
+        if (directory.empty() || !watchedPaths.insert(directory).second) continue;
+
+        const int wd = inotify_add_watch(inotifyFd, directory.c_str(), watchedEvents);
+        if (wd < 0) {
+            errs() << "Error: Could not watch '" << directory << "': " << sys::StrError() << "\n";
+            continue;
+        }
+        watchedDirectories[wd] = directory;
+    }
+}
+
+set<string> WatchDaemon::readChanges(int timeoutMs) {
+    set<string> changed;
+    pollfd pfd{inotifyFd, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0) return changed;
+
+    alignas(inotify_event) char buffer[64 * 1024];
+    const ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+    for (ssize_t offset = 0; offset < length;) {
+        const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+        offset += sizeof(inotify_event) + event->len;
+        auto directory = watchedDirectories.find(event->wd);
+        if (directory == watchedDirectories.end() || !event->len) continue;
+
+        SmallString<256> path(directory->second);
+        sys::path::append(path, event->name);
+        changed.insert(string(path));
+    }
+    return changed;
+}
+
+int WatchDaemon::run() {
+    inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        errs() << "Error: Could not start watching: " << sys::StrError() << "\n";
+        return 1;
+    }
+    watchDependencyDirectories();
+    outs() << "Watching " << watchedDirectories.size() << " directories for changes\n";
+    outs().flush();
+
+    while (true) {
+        set<string> changed = readChanges(-1);
+        // wait until the editor or build has finished writing
+        for (set<string> more = readChanges(settleMs); !more.empty(); more = readChanges(settleMs)) {
+            changed.insert(more.begin(), more.end());
+        }
+
+        set<string> affected;
+        {
+            lock_guard<std::mutex> guard(mutex);
+            for (const string &file: changed) {
+                // the event names the path in the watched directory, the map holds canonical paths
+                SmallString<256> real;
+                const string key = sys::fs::real_path(file, real) ? file : string(real);
+                auto found = dependents.find(key);
+                if (found != dependents.end()) {
+                    affected.insert(found->second.begin(), found->second.end());
+                }
+            }
+        }
+        if (affected.empty()) continue;
+
+        const auto start = chrono::steady_clock::now();
+        for (const string &translationUnit: affected) {
+            outs() << "Re-analysing " << translationUnit << "\n";
+            reanalyse(translationUnit);
+        }
+        // edits may have added includes from new directories
+        watchDependencyDirectories();
+        if (publish()) {
+            const auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+            outs() << "Updated " << outputPath << " after " << affected.size() << " translation units in "
+                    << elapsed.count() << " ms\n";
+        }
+        outs().flush();
+    }
+}
+#else
+int WatchDaemon::run() {
+    errs() << "Error: --watch is only supported on Linux\n";
+    return 1;
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef RUIANALYSIS_WATCHDAEMON_H
+#define RUIANALYSIS_WATCHDAEMON_H
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Keep the call map up to date while sources are edited
+ *
+ * The directories of all translation units and of the files they include are watched with inotify. After
+ * a burst of changes settles, the translation units that include a changed file (found through the
+ * reverse include map) are analysed again and the output file is replaced atomically.
+ */
+class WatchDaemon {
+public:
+    /**
+     * @param reanalyse analyses one translation unit again, replacing its previous results
+     * @param render current content of the output file
+     * @param outputPath
+     */
+    WatchDaemon(std::function<void(const std::string &)> reanalyse, std::function<std::string()> render,
+                std::string outputPath);
+
+    /**
+     * Replace the files a translation unit depends on, may be called from any worker
+     *
+     * @param translationUnit file name the translation unit is analysed with
+     * @param files canonical paths of the main file and all included files
+     */
+    void recordDependencies(const std::string &translationUnit, const std::vector<std::string> &files);
+
+    /**
+     * Watch and re-analyse until the process is stopped
+     *
+     * @return non-zero if inotify is unavailable, always on systems other than Linux
+     */
+    int run();
+
+private:
+    std::function<void(const std::string &)> reanalyse;
+    std::function<std::string()> render;
+    std::string outputPath;
+
+    std::mutex mutex;
+    // file -> translation units including it, and the reverse
+    std::map<std::string, std::set<std::string>> dependents;
+    std::map<std::string, std::vector<std::string>> dependencies;
+
+    int inotifyFd = -1;
+    std::map<int, std::string> watchedDirectories;
+    std::set<std::string> watchedPaths;
+
+    void watchDependencyDirectories();
+
+    std::set<std::string> readChanges(int timeoutMs);
+
+    bool publish() const;
+};
+
+#endif // RUIANALYSIS_WATCHDAEMON_H
@@ -1,6 +1,11 @@
 // #include <iostream>
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
 #include <nlohmann/json.hpp>
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/RecursiveASTVisitor.h"
@@ -9,6 +14,36 @@
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "BinaryTriage.h"
+#include "BoundedQueue.h"
+#include "CachingFileSystem.h"
+#include "BitcodeAnalyser.h"
+#include "CallMapDiff.h"
+#include "CodecLatencyAudit.h"
+#include "CostModel.h"
+#include "DemandDriver.h"
+#include "DemuxAudit.h"
+#include "FFmpegUtils.h"
+#include "FunctionCache.h"
+#include "LazyCompilationDatabase.h"
+#include "LockIOChecker.h"
+#include "PerfProfile.h"
+#include "PointsToAnalysis.h"
+#include "QueryServer.h"
+#include "ProbeRewriter.h"
+#include "ResultWriter.h"
+#include "ShardMerge.h"
+#include "ShimGenerator.h"
+#include "SmallWriteDetector.h"
+#include "SourceDiscovery.h"
+#include "SummaryLinker.h"
+#include "SymbolIndex.h"
+#include "TemplateInstantiations.h"
+#include "TUScheduler.h"
+#include "WatchDaemon.h"
 
 using namespace clang;
 using namespace clang::tooling;
@@ -16,105 +51,196 @@ using namespace llvm;
 using namespace std;
 using json = nlohmann::json;
 
+// Discovered sources waiting for a parse worker before the directory crawl is held back
+static constexpr size_t pendingSources = 1024;
+
 // Command-line options
 static cl::OptionCategory MyToolCategory("my-tool options");
 static cl::extrahelp CommonHelp(CommonOptionsParser::HelpMessage);
 static cl::extrahelp MoreHelp("\nMore help text...\n");
+// Options of CommonOptionsParser, parsed here so that the compilation database is loaded lazily
+static cl::opt<string> BuildPath("p", cl::desc("Build path"), cl::Optional, cl::cat(MyToolCategory));
+static cl::list<string> SourcePaths(cl::Positional, cl::desc("<source0> [... <sourceN>]"), cl::OneOrMore,
+                                    cl::cat(MyToolCategory));
+static cl::list<string> ArgsAfter("extra-arg",
+                                  cl::desc("Additional argument to append to the compiler command line"),
+                                  cl::cat(MyToolCategory));
+static cl::list<string> ArgsBefore("extra-arg-before",
+                                   cl::desc("Additional argument to prepend to the compiler command line"),
+                                   cl::cat(MyToolCategory));
+static cl::list<string> Extensions("extensions",
+                                   cl::desc("Source extensions searched in input directories (default: .c,.cc,.cpp,.cxx,.m,.mm)"),
+                                   cl::CommaSeparated,
+                                   cl::value_desc("ext"),
+                                   cl::cat(MyToolCategory));
+static cl::list<string> Excludes("exclude",
+                                 cl::desc("Skip paths of input directories matching a .gitignore-style pattern"),
+                                 cl::value_desc("pattern"),
+                                 cl::cat(MyToolCategory));
+static cl::opt<unsigned> DiscoveryThreads("discovery-threads",
+                                          cl::desc("Threads searching input directories (default: one per core)"),
+                                          cl::init(0),
+                                          cl::cat(MyToolCategory));
+static cl::opt<string> DiscoveryCache("discovery-cache",
+                                      cl::desc("Directory snapshot used to skip unchanged directories, empty to disable"),
+                                      cl::init("ruianalysis_discovery.cache"),
+                                      cl::value_desc("file"),
+                                      cl::cat(MyToolCategory));
+static cl::opt<unsigned> Jobs("jobs",
+                              cl::desc("Translation units analysed in parallel, 0 for one per core"),
+                              cl::init(1),
+                              cl::cat(MyToolCategory));
+static cl::opt<string> FunctionCachePath("function-cache",
+                                         cl::desc("Per-function results reused for unchanged function bodies, empty to disable"),
+                                         cl::init("ruianalysis_functions.json"),
+                                         cl::value_desc("file"),
+                                         cl::cat(MyToolCategory));
+static cl::opt<bool> FileSystemCaching("fs-cache",
+                                       cl::desc("Share stats, directory listings and file contents between "
+                                                "translation units (default: on)"),
+                                       cl::init(true),
+                                       cl::cat(MyToolCategory));
+static cl::opt<string> ScheduleProfile("schedule-profile",
+                                       cl::desc("Per-file analysis times used to start the slowest files first, empty to disable"),
+                                       cl::init("ruianalysis_schedule.json"),
+                                       cl::value_desc("file"),
+                                       cl::cat(MyToolCategory));
+static cl::opt<unsigned> MemoryBudget("memory-budget",
+                                      cl::desc("Megabytes of projected memory use up to which translation units are started"),
+                                      cl::value_desc("MB"),
+                                      cl::init(0),
+                                      cl::cat(MyToolCategory));
+static cl::opt<double> TUTimeout("tu-timeout",
+                                 cl::desc("Seconds after which a translation unit is abandoned and reported as timed out"),
+                                 cl::value_desc("seconds"),
+                                 cl::init(0),
+                                 cl::cat(MyToolCategory));
+static cl::opt<string> Shard("shard",
+                            cl::desc("Analyse only shard i of N, balanced by expected time, and write its results "
+                                     "for --merge"),
+                            cl::value_desc("i/N"),
+                            cl::cat(MyToolCategory));
+static cl::opt<bool> Merge("merge",
+                           cl::desc("Merge the shard files given as inputs into ffmpeg_calls.json without analysing sources"),
+                           cl::cat(MyToolCategory));
+static cl::opt<bool> Diff("diff",
+                          cl::desc("Compare two ffmpeg_calls.json files given as inputs, old then new, without "
+                                   "analysing sources"),
+                          cl::cat(MyToolCategory));
+static cl::opt<string> DenyListPath("deny",
+                                    cl::desc("JSON file of FFmpeg APIs whose new calls make --diff fail"),
+                                    cl::value_desc("file"),
+                                    cl::cat(MyToolCategory));
+static cl::opt<bool> Watch("watch",
+                           cl::desc("Keep running and update ffmpeg_calls.json when sources or headers change"),
+                           cl::cat(MyToolCategory));
+static cl::list<string> Entries("entry",
+                               cl::desc("Parse only the translation units defining functions reachable from this "
+                                        "function, found through the symbol index"),
+                               cl::value_desc("function"),
+                               cl::cat(MyToolCategory));
+static cl::opt<string> SymbolIndexPath("symbol-index",
+                                       cl::desc("Translation units defining each function, updated by every run, "
+                                                "empty to disable"),
+                                       cl::init("ruianalysis_symbols.json"),
+                                       cl::value_desc("file"),
+                                       cl::cat(MyToolCategory));
+static cl::opt<string> ServeSocket("serve",
+                                   cl::desc("Answer JSON-RPC call map queries on a Unix domain socket after the analysis"),
+                                   cl::value_desc("socket"),
+                                   cl::cat(MyToolCategory));
+static cl::opt<bool> Triage("triage",
+                            cl::desc("Report the FFmpeg symbols used by the ELF binaries, shared libraries and archives "
+                                     "among the inputs instead of analysing sources"),
+                            cl::cat(MyToolCategory));
+static cl::opt<string> SummaryDir("summaries",
+                                  cl::desc("Keep per-function summaries of every translation unit and link them into "
+                                           "whole-program FFmpeg reachability"),
+                                  cl::value_desc("dir"),
+                                  cl::cat(MyToolCategory));
+static cl::opt<bool> LinkOnly("link",
+                              cl::desc("Link the summaries in the input directories without analysing sources"),
+                              cl::cat(MyToolCategory));
+static cl::opt<bool> PointsTo("points-to",
+                              cl::desc("Resolve calls through function pointers and callback tables with a "
+                                       "project-wide points-to analysis"),
+                              cl::cat(MyToolCategory));
+static cl::opt<bool> Instantiations("instantiations",
+                                    cl::desc("Analyse the instantiations of C++ templates, folding equal ones, and "
+                                             "attribute their calls to the template"),
+                                    cl::cat(MyToolCategory));
+static cl::opt<bool> LockIO("lock-io",
+                            cl::desc("Report blocking FFmpeg I/O reachable while a lock is held"),
+                            cl::cat(MyToolCategory));
+static cl::opt<bool> Cost("cost",
+                          cl::desc("Estimate the relative FFmpeg cost of every function"),
+                          cl::cat(MyToolCategory));
+static cl::opt<string> CostCatalogPath("cost-catalog",
+                                       cl::desc("JSON file assigning cost classes to FFmpeg APIs"),
+                                       cl::value_desc("file"),
+                                       cl::cat(MyToolCategory));
+static cl::opt<bool> DemuxAuditing("demux-audit",
+                                   cl::desc("Report demuxer open and probe calls with their probing options, "
+                                            "flagging those reachable from loops or request handlers"),
+                                   cl::cat(MyToolCategory));
+static cl::list<string> RequestHandlers("request-handler",
+                                        cl::desc("Glob pattern of request handler functions for --demux-audit "
+                                                 "(default: *[Hh]andle*, *[Rr]equest*)"),
+                                        cl::value_desc("pattern"),
+                                        cl::cat(MyToolCategory));
+static cl::opt<bool> CodecLatency("codec-latency",
+                                  cl::desc("Report codec configuration and send/receive patterns which add latency"),
+                                  cl::cat(MyToolCategory));
+static cl::opt<bool> SmallWrites("small-writes",
+                                 cl::desc("Report loops doing small writes per iteration which could be batched"),
+                                 cl::cat(MyToolCategory));
+static cl::opt<unsigned> SmallWriteLimit("small-write-limit",
+                                         cl::desc("Largest write in bytes counted as small (default: 1024)"),
+                                         cl::value_desc("bytes"),
+                                         cl::init(1024),
+                                         cl::cat(MyToolCategory));
+static cl::opt<string> ProbeDir("probe-dir",
+                                cl::desc("Write copies of the sources with timing probes around FFmpeg calls"),
+                                cl::value_desc("directory"),
+                                cl::cat(MyToolCategory));
+static cl::opt<string> ShimPath("shim",
+                                cl::desc("Generate the C source of an LD_PRELOAD interposer timing the FFmpeg APIs called"),
+                                cl::value_desc("file"),
+                                cl::cat(MyToolCategory));
+static cl::opt<string> PerfPath("perf",
+                                cl::desc("Rank FFmpeg call sites by the samples of a `perf script` or folded-stack file"),
+                                cl::value_desc("file"),
+                                cl::cat(MyToolCategory));
 
 // static json globalResults = json::object();
-static vector<filesystem::path> inputRootDirs; // directories provided as inputs
 static json ffmpegResults = json::object();
-
-/**
- * Check if API belongs to FFmpeg
- *
- * @param decl
- * @param Context
- * @return
- */
-static bool isFFmpegAPIDecl(const FunctionDecl *decl, const ASTContext &Context) {
-    if (!decl) return false;
-
-    // Heuristic: File name contains FFmpeg libs
-    const string name = decl->getNameAsString();
-    if (!name.empty()) {
-        // return true;
-        if (
-            name.rfind("avutil", 0) == 0 ||
-            name.rfind("swscale", 0) == 0 ||
-            name.rfind("swresample", 0) == 0 ||
-            name.rfind("avcodec", 0) == 0 ||
-            name.rfind("avformat", 0) == 0 ||
-            name.rfind("avdevice", 0) == 0 ||
-            name.rfind("avfilter", 0) == 0 ||
-            name.rfind("ffmpeg", 0) == 0
-        ) {
-            return true;
-        }
-    }
-
-    // Heuristic: Header path contains FFmpeg libs
-    // Get callee source location
-    const SourceManager &SM = Context.getSourceManager();
-    SourceLocation loc = decl->getLocation();
-    if (!loc.isValid()) return false;
-
-    SourceLocation spellingLoc = SM.getSpellingLoc(loc);
-    StringRef filenameRef = SM.getFilename(spellingLoc);
-    string path = filenameRef.str();
-    // lowercase checking
-    string lower;
-    lower.resize(path.size());
-    transform(path.begin(), path.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
-    // FFmpeg library source: https://www.ffmpeg.org/documentation.html
-    return (
-        lower.find("avutil") != string::npos ||
-        lower.find("swscale") != string::npos ||
-        lower.find("swresample") != string::npos ||
-        lower.find("avcodec") != string::npos ||
-        lower.find("avformat") != string::npos ||
-        lower.find("avdevice") != string::npos ||
-        lower.find("avfilter") != string::npos ||
-        lower.find("ffmpeg") != string::npos
-    );
-}
-
-/**
- * Get the relative file path to store in the result
- *
- * @param absoluteOrInputPath
- * @return
- */
-static string toDisplayPath(const string &absoluteOrInputPath) {
-    filesystem::path absPath = filesystem::weakly_canonical(filesystem::path(absoluteOrInputPath));
-    for (const auto &root: inputRootDirs) {
-        std::error_code ec;
-        filesystem::path rel = absPath.lexically_relative(root);
-        if (!rel.empty() && rel.native().find("..") != 0) {
-            return rel.string();
-        }
-    }
-    return absPath.filename().string();
-}
-
-vector<string> findProjectFiles(const string &projectDir) {
-    vector<string> files;
-
-    try {
-        for (const auto &entry: filesystem::recursive_directory_iterator(projectDir)) {
-            if (entry.is_regular_file()) {
-                string extension = entry.path().extension().string();
-                // Find all c++ and c files
-                if (extension == ".cpp" || extension == ".c") {
-                    files.push_back(entry.path().string());
-                }
-            }
-        }
-    } catch (const filesystem::filesystem_error &e) {
-        errs() << "Error: Could not read directory '" << projectDir << "': " << e.what() << "\n";
-    }
-    return files;
-}
+// every callee of every function, {file: {function: [callee, ...]}}
+static json callGraphResults = json::object();
+// callees resolved through function pointers, also merged into the two maps above
+static json indirectCallResults = json::object();
+static LockIOChecker lockIOChecker;
+static unique_ptr<CostModel> costModel;
+static unique_ptr<DemuxAudit> demuxAudit;
+static unique_ptr<CodecLatencyAudit> codecLatencyAudit;
+static unique_ptr<SmallWriteDetector> smallWriteDetector;
+static ShimGenerator shimGenerator;
+static unique_ptr<ProbeRewriter> probeRewriter;
+static unique_ptr<TUScheduler> scheduler;
+static unique_ptr<WatchDaemon> watchDaemon;
+static unique_ptr<QueryServer> queryServer;
+static unique_ptr<FunctionCache> functionCache;
+static unique_ptr<PointsToAnalysis> pointsTo;
+static unique_ptr<TemplateInstantiations> templateInstantiations;
+static unique_ptr<ResultWriter> resultWriter;
+static unique_ptr<FileSystemCache> fileSystemCache;
+static unique_ptr<SymbolIndex> symbolIndex;
+static unique_ptr<DemandDriver> demandDriver;
+// the writer keeps the only copy of finished results when no later stage reads the call map
+static bool releaseResults = false;
+// set while watching, when only the call map is kept up to date
+static bool callMapOnly = false;
+// The analyses share global state, only parsing runs in parallel
+static mutex analysisMutex;
 
 class CallAnalyser : public RecursiveASTVisitor<CallAnalyser> {
     ASTContext &Context;
@@ -122,16 +248,19 @@ class CallAnalyser : public RecursiveASTVisitor<CallAnalyser> {
     string currentFunction;
     vector<string> currentCalls;
     vector<string> currentFfmpegCalls;
+    // instantiations add to the calls of their template instead of replacing them
+    bool currentIsInstantiation = false;
 
-    static string getMethodFullName(const FunctionDecl *func) {
-        // if method
-        if (auto *method = dyn_cast<CXXMethodDecl>(func)) {
-            if (auto *cls = method->getParent()) {
-                return cls->getNameAsString() + "::" + method->getNameAsString();
+    void storeCalls(json &stored, const vector<string> &calls) const {
+        if (!currentIsInstantiation || stored.is_null()) {
+            stored = calls;
+            return;
+        }
+        for (const string &call: calls) {
+            if (std::find(stored.begin(), stored.end(), call) == stored.end()) {
+                stored.push_back(call);
             }
         }
-        // if function
-        return func->getNameAsString();
     }
 
     void storeResults() {
@@ -140,10 +269,14 @@ class CallAnalyser : public RecursiveASTVisitor<CallAnalyser> {
             if (!ffmpegResults.contains(fileKey)) {
                 ffmpegResults[fileKey] = json::object();
             }
-            ffmpegResults[fileKey][currentFunction] = currentFfmpegCalls;
+            storeCalls(ffmpegResults[fileKey][currentFunction], currentFfmpegCalls);
+        }
+        if (queryServer && !currentFunction.empty() && !currentCalls.empty()) {
+            storeCalls(callGraphResults[toDisplayPath(currentFileName)][currentFunction], currentCalls);
         }
         currentCalls.clear();
         currentFfmpegCalls.clear();
+        currentIsInstantiation = false;
     }
 
 public:
@@ -151,6 +284,10 @@ public:
     explicit CallAnalyser(ASTContext &Context, const string &fileName) : Context(Context), currentFileName(fileName) {
     }
 
+    bool shouldVisitTemplateInstantiations() const {
+        return templateInstantiations != nullptr;
+    }
+
     /**
      * Visit methods (in classes)
      *
@@ -209,9 +346,50 @@ private:
         Stmt *body = funcDecl->getBody();
         if (!body) return;
 
+        if (templateInstantiations && funcDecl->isTemplateInstantiation()) {
+            analyseInstantiation(funcDecl, callerName);
+            return;
+        }
+
+        // Unchanged bodies reuse their calls, system headers are not worth caching
+        const FunctionDecl *definition = funcDecl->getDefinition();
+        const bool cacheable = functionCache && definition &&
+                               !Context.getSourceManager().isInSystemHeader(definition->getLocation());
+        const string fileKey = toDisplayPath(currentFileName);
+        if (cacheable) {
+            if (const json *cached = functionCache->lookup(definition, fileKey, "calls")) {
+                currentCalls = cached->at("calls").get<vector<string>>();
+                currentFfmpegCalls = cached->at("ffmpeg").get<vector<string>>();
+                return;
+            }
+        }
+
         // Visitor to find call expressions in method
         CallExprVisitor callVisitor(Context, callerName, currentCalls, currentFfmpegCalls);
         callVisitor.TraverseStmt(body);
+        if (cacheable) {
+            functionCache->store(definition, fileKey, "calls", {{"calls", currentCalls}, {"ffmpeg", currentFfmpegCalls}});
+        }
+    }
+
+    /**
+     * Analyse an instantiation of a project template once per equal instantiation
+     *
+     * @param funcDecl
+     * @param callerName name of the template
+     */
+    void analyseInstantiation(FunctionDecl *funcDecl, const string &callerName) {
+        const FunctionDecl *pattern = funcDecl->getTemplateInstantiationPattern();
+        if (!pattern || Context.getSourceManager().isInSystemHeader(pattern->getLocation())) return;
+        currentIsInstantiation = true;
+        if (const auto *folded = templateInstantiations->lookup(funcDecl)) {
+            currentCalls = folded->calls;
+            currentFfmpegCalls = folded->ffmpegCalls;
+            return;
+        }
+        CallExprVisitor callVisitor(Context, callerName, currentCalls, currentFfmpegCalls);
+        callVisitor.TraverseStmt(funcDecl->getBody());
+        templateInstantiations->store(funcDecl, {currentCalls, currentFfmpegCalls});
     }
 
     /**
@@ -234,7 +412,7 @@ private:
             // get callee
             FunctionDecl *callee = callExpr->getDirectCallee();
             if (!callee) {
-                outs() << callerName << " invalid call expression!\n";
+                outs() << callerName << " calls through a function pointer\n";
                 return true;
             }
             string calleeName = getMethodFullName(callee);
@@ -248,22 +426,96 @@ private:
     };
 };
 
+/**
+ * Pass the results of a file to the writer, with the analysis lock held
+ *
+ * @param fileKey
+ */
+static void handOverResults(const string &fileKey) {
+    auto entry = ffmpegResults.find(fileKey);
+    if (entry == ffmpegResults.end()) return;
+    if (releaseResults) {
+        resultWriter->add(fileKey, std::move(*entry));
+        ffmpegResults.erase(entry);
+    } else {
+        resultWriter->add(fileKey, *entry);
+    }
+}
+
 /**
  * Manage analysis process
  */
 class CallExprConsumer : public ASTConsumer {
     CallAnalyser analyser;
+    string fileName;
 
 public:
     // Constructor
     explicit CallExprConsumer(ASTContext &Context, const string &fileName)
-        : analyser(Context, fileName) {
+        : analyser(Context, fileName), fileName(fileName) {
+    }
+
+    bool HandleTopLevelDecl(DeclGroupRef D) override {
+        // Stop parsing a translation unit that ran out of time
+        return !TUScheduler::cancelled();
     }
 
     void HandleTranslationUnit(ASTContext &Context) override {
+        const SourceManager &SM = Context.getSourceManager();
+        scheduler->recordMemory(fileName, Context.getASTAllocatedMemory() + Context.getSideTableAllocatedMemory() +
+                                          SM.getContentCacheSize() + SM.getDataStructureSizes());
+        if (watchDaemon) {
+            vector<string> dependencies;
+            for (auto it = SM.fileinfo_begin(); it != SM.fileinfo_end(); ++it) {
+                dependencies.push_back(SM.getFileManager().getCanonicalName(it->first).str());
+            }
+            watchDaemon->recordDependencies(fileName, dependencies);
+        }
+        if (!TUScheduler::beginAnalysis()) {
+            return;
+        }
+        if (!SummaryDir.empty()) {
+            // Only reads this translation unit, runs outside the lock
+            SummaryLinker::write(SummaryDir, SummaryLinker::summarise(Context, fileName));
+        }
+        if (demandDriver) {
+            // Queues the translation units of newly reachable callees while this one is analysed
+            demandDriver->addTranslationUnit(Context, fileName);
+        }
+        lock_guard<mutex> guard(analysisMutex);
+        if (symbolIndex) {
+            symbolIndex->addTranslationUnit(Context, fileName);
+        }
         outs() << "Starting Analysis\n";
         // Traverse AST
         analyser.TraverseDecl(Context.getTranslationUnitDecl());
+        if (resultWriter && !callMapOnly) {
+            handOverResults(toDisplayPath(fileName));
+        }
+        if (pointsTo) {
+            pointsTo->addTranslationUnit(Context, fileName);
+        }
+        if (LockIO && !callMapOnly) {
+            lockIOChecker.analyseTranslationUnit(Context, fileName);
+        }
+        if (costModel && !callMapOnly) {
+            costModel->analyseTranslationUnit(Context, fileName);
+        }
+        if (demuxAudit && !callMapOnly) {
+            demuxAudit->analyseTranslationUnit(Context, fileName);
+        }
+        if (codecLatencyAudit && !callMapOnly) {
+            codecLatencyAudit->analyseTranslationUnit(Context, fileName);
+        }
+        if (smallWriteDetector && !callMapOnly) {
+            smallWriteDetector->analyseTranslationUnit(Context, fileName);
+        }
+        if (!ShimPath.empty() && !callMapOnly) {
+            shimGenerator.analyseTranslationUnit(Context);
+        }
+        if (probeRewriter && !callMapOnly) {
+            probeRewriter->rewriteTranslationUnit(Context, fileName);
+        }
         outs() << "Analysis Complete\n";
     };
 };
@@ -278,24 +530,220 @@ public:
     }
 };
 
+/**
+ * Add the targets of calls through function pointers to the call maps
+ *
+ * @return the resolved calls, flagged FFmpeg or not
+ */
+static json mergeIndirectCalls() {
+    const json resolved = pointsTo->resolve();
+    auto addCallee = [](json &calls, const string &callee) {
+        if (std::find(calls.begin(), calls.end(), callee) == calls.end()) {
+            calls.push_back(callee);
+        }
+    };
+    indirectCallResults = json::object();
+    for (const auto &[fileKey, functions]: resolved.items()) {
+        for (const auto &[function, targets]: functions.items()) {
+            for (const auto &target: targets) {
+                const string callee = target["callee"].get<string>();
+                indirectCallResults[fileKey][function].push_back(callee);
+                if (target["ffmpeg"].get<bool>()) {
+                    addCallee(ffmpegResults[fileKey][function], callee);
+                }
+                if (queryServer) {
+                    addCallee(callGraphResults[fileKey][function], callee);
+                }
+            }
+        }
+    }
+    return resolved;
+}
+
+/**
+ * Link the summaries and save the FFmpeg APIs reachable from every function
+ *
+ * @param linker
+ * @return exit status
+ */
+static int writeReachability(const SummaryLinker &linker) {
+    const json reach = linker.link();
+    ofstream reachOfs("ffmpeg_reach.json", ios::out | ios::trunc);
+    if (!reachOfs) {
+        errs() << "Error: Could not write 'ffmpeg_reach.json'\n";
+        return 1;
+    }
+    reachOfs << reach.dump(2);
+    reachOfs.close();
+    outs() << "Linked " << linker.translationUnitCount() << " translation unit summaries into ffmpeg_reach.json\n";
+    return 0;
+}
+
+/**
+ * Parse a shard selection
+ *
+ * @param text i/N with 0 <= i < N
+ * @param index
+ * @param count
+ * @return false if malformed
+ */
+static bool parseShard(StringRef text, unsigned &index, unsigned &count) {
+    auto [first, second] = text.split('/');
+    if (first.getAsInteger(10, index) || second.getAsInteger(10, count) || count == 0 || index >= count) {
+        errs() << "Error: Invalid shard '" << text << "', expected i/N with 0 <= i < N\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Compare the call maps of two runs and save the changes
+ *
+ * @param oldPath
+ * @param newPath
+ * @return exit status, 1 if a denied API is newly called
+ */
+static int writeDiff(const string &oldPath, const string &newPath) {
+    CallMapDiff diff;
+    if (!DenyListPath.empty() && !diff.loadDenyList(DenyListPath)) {
+        return 1;
+    }
+    json callMaps[2];
+    const string paths[2] = {oldPath, newPath};
+    for (size_t i = 0; i < 2; ++i) {
+        ifstream ifs(paths[i]);
+        if (!ifs) {
+            errs() << "Error: Could not read call map '" << paths[i] << "'\n";
+            return 1;
+        }
+        try {
+            callMaps[i] = json::parse(ifs);
+        } catch (const json::exception &e) {
+            errs() << "Error: Invalid call map '" << paths[i] << "': " << e.what() << "\n";
+            return 1;
+        }
+    }
+    const json changes = diff.compare(callMaps[0], callMaps[1]);
+    ofstream diffOfs("ffmpeg_diff.json", ios::out | ios::trunc);
+    diffOfs << changes.dump(2);
+    diffOfs.close();
+
+    for (const auto &[fileKey, apis]: changes["files"].items()) {
+        for (const auto &api: apis["added"]) {
+            outs() << "+ " << fileKey << ": " << api.get<string>() << "\n";
+        }
+        for (const auto &api: apis["removed"]) {
+            outs() << "- " << fileKey << ": " << api.get<string>() << "\n";
+        }
+    }
+    for (const auto &finding: changes["denied"]) {
+        errs() << "Denied: " << finding["file"].get<string>() << ": " << finding["function"].get<string>()
+                << " calls " << finding["api"].get<string>() << " (" << finding["reason"].get<string>() << ")\n";
+    }
+    return changes["denied"].empty() ? 0 : 1;
+}
+
 int main(int argc, const char **argv) {
-    auto ExpectedParser = CommonOptionsParser::create(argc, argv, MyToolCategory);
-    if (!ExpectedParser) {
-        llvm::errs() << ExpectedParser.takeError();
+    // Compiler flags after "--" take the place of the compilation database
+    string errorMessage;
+    unique_ptr<CompilationDatabase> compilations =
+            FixedCompilationDatabase::loadFromCommandLine(argc, argv, errorMessage);
+    if (!cl::ParseCommandLineOptions(argc, argv, "", &errs())) {
         return 1;
     }
-    CommonOptionsParser &OptionsParser = ExpectedParser.get();
 
-    vector<string> inPaths = OptionsParser.getSourcePathList();
-    vector<string> allFiles;
-    for (const auto &p: inPaths) {
-        if (filesystem::is_directory(p)) {
-            auto more = findProjectFiles(p);
-            allFiles.insert(allFiles.end(), more.begin(), more.end());
-        } else {
-            allFiles.push_back(p);
+    vector<string> inPaths = SourcePaths;
+    if (LinkOnly) {
+        // Summaries of earlier runs only, no compilation database involved
+        SummaryLinker linker;
+        for (const auto &p: inPaths) {
+            if (!linker.load(p)) {
+                return 1;
+            }
+        }
+        return writeReachability(linker);
+    }
+    if (Diff) {
+        // Results of earlier runs only, no compilation database involved
+        if (inPaths.size() != 2) {
+            errs() << "Error: --diff compares two call maps, old then new\n";
+            return 1;
+        }
+        return writeDiff(inPaths[0], inPaths[1]);
+    }
+    if (Merge) {
+        // Shard files only, no compilation database involved
+        return mergeShards(inPaths, "ffmpeg_calls.json") ? 0 : 1;
+    }
+    if (Triage) {
+        // Build artifacts only, no compilation database involved
+        BinaryTriage triage(DiscoveryThreads);
+        const json binaries = triage.scan(inPaths);
+        ofstream triageOfs("ffmpeg_binaries.json", ios::out | ios::trunc);
+        triageOfs << binaries.dump(2);
+        triageOfs.close();
+        outs() << "Read " << triage.scannedCount() << " binaries, " << binaries.size() << " use FFmpeg\n";
+        return 0;
+    }
+    unsigned shardIndex = 0, shardCount = 0;
+    if (!Shard.empty()) {
+        if (!parseShard(Shard, shardIndex, shardCount)) {
+            return 1;
+        }
+        if (PointsTo || Watch) {
+            // both need every translation unit of the project in one process
+            errs() << "Error: --shard cannot be combined with --points-to or --watch\n";
+            return 1;
+        }
+    }
+    if (!Entries.empty() && (shardCount || Watch)) {
+        errs() << "Error: --entry cannot be combined with --shard or --watch\n";
+        return 1;
+    }
+    if (!SymbolIndexPath.empty() && !shardCount) {
+        // a shard sees only part of the project, and shards running in parallel would replace each other's index
+        symbolIndex = make_unique<SymbolIndex>();
+        if (!symbolIndex->load(SymbolIndexPath) && !Entries.empty()) {
+            return 1;
+        }
+    }
+    if (!Entries.empty()) {
+        if (!symbolIndex || symbolIndex->size() == 0) {
+            errs() << "Error: --entry needs a symbol index, run once without --entry to build '" << SymbolIndexPath
+                   << "'\n";
+            return 1;
         }
+        demandDriver = make_unique<DemandDriver>(*symbolIndex, vector<string>(Entries.begin(), Entries.end()));
     }
+    if (!compilations) {
+        compilations = loadCompilationDatabase(BuildPath, inPaths.front(), errorMessage);
+    }
+    if (!compilations) {
+        errs() << "Error while trying to load a compilation database:\n" << errorMessage << "\nRunning without flags.\n";
+        compilations = make_unique<FixedCompilationDatabase>(".", vector<string>());
+    }
+    ArgumentsAdjustingCompilations adjustedCompilations(std::move(compilations));
+    adjustedCompilations.appendArgumentsAdjuster(getInsertArgumentAdjuster(ArgsBefore, ArgumentInsertPosition::BEGIN));
+    adjustedCompilations.appendArgumentsAdjuster(getInsertArgumentAdjuster(ArgsAfter, ArgumentInsertPosition::END));
+
+    SourceDiscovery discovery(Extensions, Excludes, DiscoveryThreads);
+    if (!DiscoveryCache.empty()) {
+        discovery.loadSnapshot(DiscoveryCache);
+    }
+    const bool searchedDirectories = any_of(inPaths.begin(), inPaths.end(),
+                                            [](const string &p) { return filesystem::is_directory(p); });
+    auto discoverSources = [&](const function<void(const string &)> &onFile) {
+        for (const auto &p: inPaths) {
+            if (filesystem::is_directory(p)) {
+                discovery.discover(p, onFile);
+            } else {
+                onFile(p);
+            }
+        }
+        if (searchedDirectories && !DiscoveryCache.empty()) {
+            discovery.saveSnapshot(DiscoveryCache);
+        }
+    };
     // Record input root directories for relative path computation
     inputRootDirs.clear();
     for (const auto &p: inPaths) {
@@ -305,14 +753,305 @@ int main(int argc, const char **argv) {
             inputRootDirs.emplace_back(filesystem::weakly_canonical(filesystem::path(p)).parent_path());
         }
     }
-    ClangTool Tool(OptionsParser.getCompilations(), allFiles);
-    int res = Tool.run(newFrontendActionFactory<CallExprAction>().get());
+    if (Cost) {
+        CostCatalog catalog = CostCatalog::defaults();
+        if (!CostCatalogPath.empty() && !catalog.load(CostCatalogPath)) {
+            return 1;
+        }
+        costModel = make_unique<CostModel>(std::move(catalog));
+    }
+    if (DemuxAuditing) {
+        demuxAudit = make_unique<DemuxAudit>(vector<string>(RequestHandlers.begin(), RequestHandlers.end()));
+    }
+    if (CodecLatency) {
+        codecLatencyAudit = make_unique<CodecLatencyAudit>();
+    }
+    if (SmallWrites) {
+        smallWriteDetector = make_unique<SmallWriteDetector>(SmallWriteLimit);
+    }
+    if (PointsTo) {
+        pointsTo = make_unique<PointsToAnalysis>();
+    }
+    if (Instantiations) {
+        templateInstantiations = make_unique<TemplateInstantiations>();
+    }
+    if (!FunctionCachePath.empty()) {
+        functionCache = make_unique<FunctionCache>();
+        functionCache->load(FunctionCachePath);
+        lockIOChecker.useCache(functionCache.get());
+        if (costModel) {
+            costModel->useCache(functionCache.get());
+        }
+    }
+    if (!ProbeDir.empty()) {
+        probeRewriter = make_unique<ProbeRewriter>(ProbeDir);
+    }
+    if (!SummaryDir.empty()) {
+        if (error_code ec = sys::fs::create_directories(SummaryDir)) {
+            errs() << "Error: Could not create '" << SummaryDir << "': " << ec.message() << "\n";
+            return 1;
+        }
+    }
+    if (FileSystemCaching) {
+        fileSystemCache = make_unique<FileSystemCache>();
+    }
+    scheduler = make_unique<TUScheduler>(Jobs, uint64_t(MemoryBudget) << 20, TUTimeout);
+    if (!ScheduleProfile.empty()) {
+        scheduler->loadProfile(ScheduleProfile);
+    }
+    auto analyseFile = [&adjustedCompilations](const string &file) {
+        // Bitcode carries the calls already, no compile command or parse needed
+        if (isBitcodeFile(file)) {
+            json calls = json::object();
+            json graph = json::object();
+            if (!analyseBitcodeFile(file, calls, graph)) return 1;
+            lock_guard<mutex> guard(analysisMutex);
+            for (const auto &[fileKey, functions]: calls.items()) {
+                for (const auto &[function, apis]: functions.items()) {
+                    ffmpegResults[fileKey][function] = apis;
+                }
+                if (resultWriter && !callMapOnly) {
+                    handOverResults(fileKey);
+                }
+            }
+            if (queryServer) {
+                for (const auto &[fileKey, functions]: graph.items()) {
+                    for (const auto &[function, callees]: functions.items()) {
+                        callGraphResults[fileKey][function] = callees;
+                    }
+                }
+            }
+            return 0;
+        }
+        // A physical file system per tool, the working directory of the process is shared by all workers
+        IntrusiveRefCntPtr<vfs::FileSystem> fileSystem(vfs::createPhysicalFileSystem().release());
+        if (fileSystemCache) {
+            fileSystem = makeIntrusiveRefCnt<CachingFileSystem>(fileSystem, *fileSystemCache);
+        }
+        ClangTool Tool(adjustedCompilations, {file}, make_shared<PCHContainerOperations>(), fileSystem);
+        return Tool.run(newFrontendActionFactory<CallExprAction>().get());
+    };
+    if (!ServeSocket.empty()) {
+        queryServer = make_unique<QueryServer>(ServeSocket);
+    }
+    if (Watch) {
+        watchDaemon = make_unique<WatchDaemon>(
+            [&analyseFile](const string &file) {
+                {
+                    lock_guard<mutex> guard(analysisMutex);
+                    ffmpegResults.erase(toDisplayPath(file));
+                    callGraphResults.erase(toDisplayPath(file));
+                }
+                analyseFile(file);
+            },
+            []() {
+                lock_guard<mutex> guard(analysisMutex);
+                if (fileSystemCache) {
+                    // the next change is read from disk
+                    fileSystemCache->clear();
+                }
+                if (pointsTo) {
+                    mergeIndirectCalls();
+                }
+                // queries see the new results together with the file
+                if (queryServer) {
+                    queryServer->update(ffmpegResults, callGraphResults, indirectCallResults);
+                }
+                return ffmpegResults.dump(2);
+            },
+            "ffmpeg_calls.json");
+    }
+    int res;
+    if (shardCount) {
+        // The partition needs every file before the first one is analysed
+        vector<string> allFiles;
+        discoverSources([&allFiles](const string &file) { allFiles.push_back(file); });
+        const size_t totalFiles = allFiles.size();
+        allFiles = scheduler->shard(allFiles, shardIndex, shardCount);
+        outs() << "Shard " << shardIndex << " of " << shardCount << ": " << allFiles.size() << " of " << totalFiles
+                << " files\n";
+        res = scheduler->run(allFiles, analyseFile);
+    } else if (demandDriver) {
+        // Files are parsed as the functions they define become reachable, no directory is read
+        resultWriter = make_unique<ResultWriter>("ffmpeg_calls.jsonl");
+        releaseResults = !pointsTo && !queryServer && PerfPath.empty();
+        scheduler->onAbandoned([](const string &file) { demandDriver->finished(file); });
+        res = scheduler->run([](string &file) { return demandDriver->next(file); },
+                             [&analyseFile](const string &file) {
+                                 const int status = analyseFile(file);
+                                 demandDriver->finished(file);
+                                 return status;
+                             });
+    } else {
+        // Files are parsed while directories are still read, and formatted while others are parsed
+        resultWriter = make_unique<ResultWriter>("ffmpeg_calls.jsonl");
+        releaseResults = !pointsTo && !queryServer && !watchDaemon && PerfPath.empty();
+        BoundedQueue<string> sources(pendingSources);
+        thread discoverer([&discoverSources, &sources]() {
+            discoverSources([&sources](const string &file) { sources.push(file); });
+            sources.close();
+        });
+        res = scheduler->run([&sources](string &file) { return sources.pop(file); }, analyseFile);
+        discoverer.join();
+    }
+    if (searchedDirectories && !demandDriver) {
+        discovery.crossCheck(adjustedCompilations.getAllFiles());
+    }
+    const json schedule = scheduler->report();
+    outs() << "Schedule: " << schedule["jobs"].get<unsigned>() << " jobs, predicted makespan "
+            << llvm::format("%.1f", schedule["predictedSeconds"].get<double>()) << "s, actual "
+            << llvm::format("%.1f", schedule["actualSeconds"].get<double>()) << "s ("
+            << schedule["estimatedFiles"].get<size_t>() << " files without history)\n";
+    for (const auto &file: schedule["timedOut"]) {
+        outs() << "Timed out: " << file.get<string>() << "\n";
+    }
+    if (!ScheduleProfile.empty() && !shardCount) {
+        // shards running in parallel would each replace the profile with the merge of their own files
+        scheduler->saveProfile(ScheduleProfile);
+    }
+    if (functionCache) {
+        const json reuse = functionCache->report();
+        for (const auto &[section, counts]: reuse.items()) {
+            outs() << "Function cache (" << section << "): " << counts["reused"].get<size_t>() << " reused, "
+                    << counts["analysed"].get<size_t>() << " analysed\n";
+        }
+        functionCache->save(FunctionCachePath);
+    }
+    if (symbolIndex) {
+        symbolIndex->save(SymbolIndexPath);
+    }
+    if (demandDriver) {
+        const json demand = demandDriver->report();
+        outs() << "Demand-driven analysis: " << demandDriver->parsedCount() << " of " << symbolIndex->size()
+                << " indexed translation units parsed, " << demand["unresolved"].size()
+                << " reachable functions not defined in any\n";
+        // Save FFmpeg calls of the functions reachable from the entries in JSON file
+        ofstream demandOfs("ffmpeg_demand.json", ios::out | ios::trunc);
+        demandOfs << demand.dump(2);
+        demandOfs.close();
+    }
+    if (fileSystemCache) {
+        const json lookups = fileSystemCache->report();
+        for (const auto &[kind, counts]: lookups.items()) {
+            const size_t hits = counts["hits"].get<size_t>();
+            const size_t total = hits + counts["misses"].get<size_t>();
+            outs() << "File system cache (" << kind << "): " << hits << " of " << total << " lookups hit ("
+                    << llvm::format("%.1f", total ? 100.0 * hits / total : 0.0) << "%)\n";
+        }
+    }
+
+    if (pointsTo) {
+        const json indirect = mergeIndirectCalls();
+        if (resultWriter) {
+            for (const auto &[fileKey, functions]: indirect.items()) {
+                handOverResults(fileKey);
+            }
+        }
+        outs() << "Points-to analysis: " << pointsTo->size() << " abstract locations\n";
+        // Save calls resolved through function pointers in JSON file
+        ofstream indirectOfs("ffmpeg_indirect_calls.json", ios::out | ios::trunc);
+        indirectOfs << indirect.dump(2);
+        indirectOfs.close();
+    }
+
+    if (shardCount) {
+        outs() << ffmpegResults.dump(2) << "\n";
+        // Save FFmpeg calls of this shard, --merge writes ffmpeg_calls.json from all of them
+        if (!writeShard(shardFileName(shardIndex, shardCount), ffmpegResults, shardIndex, shardCount)) {
+            return 1;
+        }
+    } else {
+        // Save FFmpeg calls in JSON file, formatted during the run
+        if (!resultWriter->finish("ffmpeg_calls.json", &outs())) {
+            return 1;
+        }
+    }
 
-    outs() << ffmpegResults.dump(2) << "\n";
-    // Save FFmpeg calls in JSON file
-    const string ffmpegOutput = "ffmpeg_calls.json";
-    ofstream ofs2(ffmpegOutput, ios::out | ios::trunc);
-    ofs2 << ffmpegResults.dump(2);
-    ofs2.close();
+    if (templateInstantiations) {
+        // Save FFmpeg calls of template instantiations in JSON file
+        ofstream instantiationOfs("ffmpeg_instantiations.json", ios::out | ios::trunc);
+        instantiationOfs << templateInstantiations->report().dump(2);
+        instantiationOfs.close();
+    }
+    if (LockIO) {
+        // Save blocking I/O under locks in JSON file
+        ofstream lockOfs("ffmpeg_lock_io.json", ios::out | ios::trunc);
+        lockOfs << lockIOChecker.report().dump(2);
+        lockOfs.close();
+    }
+    if (costModel) {
+        // Save ranked cost estimates in JSON file
+        ofstream costOfs("ffmpeg_cost.json", ios::out | ios::trunc);
+        costOfs << costModel->report().dump(2);
+        costOfs.close();
+    }
+    if (demuxAudit) {
+        // Save demuxer open and probe sites in JSON file
+        ofstream demuxOfs("ffmpeg_demux.json", ios::out | ios::trunc);
+        demuxOfs << demuxAudit->report().dump(2);
+        demuxOfs.close();
+    }
+    if (codecLatencyAudit) {
+        // Save latency-adding codec setups and drain patterns in JSON file
+        ofstream latencyOfs("ffmpeg_codec_latency.json", ios::out | ios::trunc);
+        latencyOfs << codecLatencyAudit->report().dump(2);
+        latencyOfs.close();
+    }
+    if (smallWriteDetector) {
+        // Save loops with batchable small writes in JSON file
+        ofstream writesOfs("ffmpeg_small_writes.json", ios::out | ios::trunc);
+        writesOfs << smallWriteDetector->report().dump(2);
+        writesOfs.close();
+    }
+    if (!PerfPath.empty()) {
+        PerfProfile profile(ffmpegResults);
+        if (!profile.load(PerfPath)) {
+            return 1;
+        }
+        // Save sampled weight of FFmpeg call sites in JSON file
+        ofstream perfOfs("ffmpeg_perf.json", ios::out | ios::trunc);
+        perfOfs << profile.report().dump(2);
+        perfOfs.close();
+    }
+    if (!ShimPath.empty()) {
+        // Save interposer source
+        ofstream shimOfs(ShimPath, ios::out | ios::trunc);
+        shimOfs << shimGenerator.render();
+        shimOfs.close();
+        outs() << "Interposer for " << shimGenerator.size() << " FFmpeg APIs written to " << ShimPath << "\n";
+    }
+    if (!SummaryDir.empty()) {
+        // Summaries of files not analysed in this run are linked too
+        SummaryLinker linker;
+        if (!linker.load(SummaryDir) || writeReachability(linker)) {
+            return 1;
+        }
+    }
+    if (probeRewriter) {
+        if (!probeRewriter->writeRuntime()) {
+            return 1;
+        }
+        outs() << probeRewriter->size() << " FFmpeg call sites probed in " << ProbeDir << "\n";
+    }
+    if (queryServer) {
+        queryServer->update(ffmpegResults, callGraphResults, indirectCallResults);
+        if (!watchDaemon) {
+            return queryServer->run();
+        }
+        thread([]() { queryServer->run(); }).detach();
+    }
+    if (watchDaemon) {
+        callMapOnly = true;
+        if (fileSystemCache) {
+            fileSystemCache->clear();
+        }
+        return watchDaemon->run();
+    }
+    if (scheduler->hasAbandonedWorkers()) {
+        // abandoned workers still use the global state, skip the static destructors
+        outs().flush();
+        errs().flush();
+        _exit(res);
+    }
     return res;
 };
@@ -0,0 +1,31 @@
+# Runs --codec-latency on SOURCE and checks which avcodec_open2 sites miss AV_CODEC_FLAG_LOW_DELAY.
+# Expects RUIANALYSIS, SOURCE, INCLUDE_DIR and WORK_DIR.
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+
+execute_process(COMMAND "${RUIANALYSIS}" --codec-latency "${SOURCE}" -- "-I${INCLUDE_DIR}"
+        WORKING_DIRECTORY "${WORK_DIR}" RESULT_VARIABLE result OUTPUT_QUIET)
+if (result)
+    message(FATAL_ERROR "RuiAnalysis --codec-latency failed: ${result}")
+endif ()
+
+file(READ "${WORK_DIR}/ffmpeg_codec_latency.json" report)
+# the fixture is the only file in the report
+string(JSON sourceKey MEMBER "${report}" 0)
+
+# function name, then whether its open must be flagged
+foreach (expectation IN ITEMS "open_low_delay;OFF" "open_cleared;ON")
+    list(GET expectation 0 function)
+    list(GET expectation 1 expected)
+    string(JSON findings GET "${report}" "${sourceKey}" "${function}" 0 findings)
+    string(FIND "${findings}" "lowDelayFlagMissing" found)
+    if (found EQUAL -1)
+        set(flagged OFF)
+    else ()
+        set(flagged ON)
+    endif ()
+    if (NOT flagged STREQUAL expected)
+        message(FATAL_ERROR "${function}: lowDelayFlagMissing expected ${expected}, findings ${findings}")
+    endif ()
+endforeach ()
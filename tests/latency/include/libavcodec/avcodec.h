@@ -0,0 +1,27 @@
+/* Minimal stand-in for the FFmpeg header, only what the latency fixture sets and calls */
+#ifndef AVCODEC_AVCODEC_H
+#define AVCODEC_AVCODEC_H
+
+#define AV_CODEC_FLAG_LOW_DELAY (1 << 19)
+#define AV_CODEC_FLAG_GLOBAL_HEADER (1 << 22)
+
+typedef struct AVCodec AVCodec;
+typedef struct AVDictionary AVDictionary;
+typedef struct AVFrame AVFrame;
+typedef struct AVPacket AVPacket;
+
+typedef struct AVCodecContext {
+    int flags;
+    int flags2;
+    int max_b_frames;
+    int thread_type;
+    int thread_count;
+    int gop_size;
+} AVCodecContext;
+
+const AVCodec *avcodec_find_decoder_by_name(const char *name);
+int avcodec_open2(AVCodecContext *avctx, const AVCodec *codec, AVDictionary **options);
+int avcodec_send_packet(AVCodecContext *avctx, const AVPacket *avpkt);
+int avcodec_receive_frame(AVCodecContext *avctx, AVFrame *frame);
+
+#endif
@@ -0,0 +1,15 @@
+#include <libavcodec/avcodec.h>
+
+/* Clearing another flag keeps low delay */
+int open_low_delay(AVCodecContext *ctx) {
+    ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    ctx->flags &= ~AV_CODEC_FLAG_GLOBAL_HEADER;
+    return avcodec_open2(ctx, avcodec_find_decoder_by_name("h264"), 0);
+}
+
+/* Low delay set and cleared again */
+int open_cleared(AVCodecContext *ctx) {
+    ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    ctx->flags &= ~AV_CODEC_FLAG_LOW_DELAY;
+    return avcodec_open2(ctx, avcodec_find_decoder_by_name("h264"), 0);
+}
@@ -0,0 +1,42 @@
+# Analyses SOURCES once, and again as SHARDS shards merged with --merge, the call maps must be identical.
+# Every shard must have files of its own, or the merge has nothing to interleave.
+# Expects RUIANALYSIS, SOURCES, INCLUDE_DIR, SHARDS and WORK_DIR.
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}/unsharded" "${WORK_DIR}/sharded")
+
+execute_process(COMMAND "${RUIANALYSIS}" "${SOURCES}" -- "-I${INCLUDE_DIR}"
+        WORKING_DIRECTORY "${WORK_DIR}/unsharded" RESULT_VARIABLE result OUTPUT_QUIET)
+if (result)
+    message(FATAL_ERROR "Unsharded run failed: ${result}")
+endif ()
+
+set(shardFiles)
+math(EXPR lastShard "${SHARDS} - 1")
+foreach (i RANGE ${lastShard})
+    execute_process(COMMAND "${RUIANALYSIS}" --shard=${i}/${SHARDS} "${SOURCES}" -- "-I${INCLUDE_DIR}"
+            WORKING_DIRECTORY "${WORK_DIR}/sharded" RESULT_VARIABLE result OUTPUT_QUIET)
+    if (result)
+        message(FATAL_ERROR "Shard ${i}/${SHARDS} failed: ${result}")
+    endif ()
+    set(shardFile "ffmpeg_calls.${i}-of-${SHARDS}.shard")
+    file(STRINGS "${WORK_DIR}/sharded/${shardFile}" header LIMIT_COUNT 1)
+    string(JSON files GET "${header}" files)
+    if (files EQUAL 0)
+        message(FATAL_ERROR "Shard ${i}/${SHARDS} has no files, the fixture no longer covers the merge")
+    endif ()
+    list(APPEND shardFiles "${shardFile}")
+endforeach ()
+
+execute_process(COMMAND "${RUIANALYSIS}" --merge ${shardFiles}
+        WORKING_DIRECTORY "${WORK_DIR}/sharded" RESULT_VARIABLE result OUTPUT_QUIET)
+if (result)
+    message(FATAL_ERROR "RuiAnalysis --merge failed: ${result}")
+endif ()
+
+execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files
+        "${WORK_DIR}/unsharded/ffmpeg_calls.json" "${WORK_DIR}/sharded/ffmpeg_calls.json"
+        RESULT_VARIABLE result)
+if (result)
+    message(FATAL_ERROR "Merged shards differ from the unsharded call map, see ${WORK_DIR}")
+endif ()
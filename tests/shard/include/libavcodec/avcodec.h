@@ -0,0 +1,17 @@
+/* Minimal stand-in for the FFmpeg header, only what the shard fixture calls */
+#ifndef AVCODEC_AVCODEC_H
+#define AVCODEC_AVCODEC_H
+
+typedef struct AVCodecContext AVCodecContext;
+typedef struct AVFrame AVFrame;
+typedef struct AVPacket AVPacket;
+
+AVPacket *av_packet_alloc(void);
+void av_packet_free(AVPacket **pkt);
+void av_packet_unref(AVPacket *pkt);
+int avcodec_send_packet(AVCodecContext *avctx, const AVPacket *avpkt);
+int avcodec_receive_frame(AVCodecContext *avctx, AVFrame *frame);
+int avcodec_send_frame(AVCodecContext *avctx, const AVFrame *frame);
+int avcodec_receive_packet(AVCodecContext *avctx, AVPacket *avpkt);
+
+#endif
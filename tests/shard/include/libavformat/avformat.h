@@ -0,0 +1,20 @@
+/* Minimal stand-in for the FFmpeg header, only what the shard fixture calls */
+#ifndef AVFORMAT_AVFORMAT_H
+#define AVFORMAT_AVFORMAT_H
+
+#include <libavcodec/avcodec.h>
+
+typedef struct AVFormatContext AVFormatContext;
+typedef struct AVIOContext AVIOContext;
+
+int avformat_open_input(AVFormatContext **ps, const char *url, const void *fmt, void **options);
+int avformat_find_stream_info(AVFormatContext *ic, void **options);
+void avformat_close_input(AVFormatContext **s);
+int av_read_frame(AVFormatContext *s, AVPacket *pkt);
+int avformat_write_header(AVFormatContext *s, void **options);
+int av_interleaved_write_frame(AVFormatContext *s, AVPacket *pkt);
+int av_write_trailer(AVFormatContext *s);
+void avio_write(AVIOContext *s, const unsigned char *buf, int size);
+void avio_flush(AVIOContext *s);
+
+#endif
@@ -0,0 +1,11 @@
+#include <libavcodec/avcodec.h>
+
+int codec_decode(AVCodecContext *decoder, const AVPacket *packet, AVFrame *frame)
+{
+	int frames = 0;
+	if (avcodec_send_packet(decoder, packet) < 0)
+		return -1;
+	while (avcodec_receive_frame(decoder, frame) >= 0)
+		frames++;
+	return frames;
+}
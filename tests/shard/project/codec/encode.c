@@ -0,0 +1,18 @@
+#include <libavcodec/avcodec.h>
+
+int codec_encode(AVCodecContext *encoder, const AVFrame *frame, AVPacket *packet)
+{
+	int packets = 0;
+	if (avcodec_send_frame(encoder, frame) < 0)
+		return -1;
+	while (avcodec_receive_packet(encoder, packet) >= 0) {
+		packets++;
+		av_packet_unref(packet);
+	}
+	return packets;
+}
+
+int codec_flush(AVCodecContext *encoder, AVPacket *packet)
+{
+	return codec_encode(encoder, 0, packet);
+}
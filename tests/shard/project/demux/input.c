@@ -0,0 +1,26 @@
+#include <libavformat/avformat.h>
+
+/* same name as the static helper of output.c */
+static int open_input(AVFormatContext **context, const char *url)
+{
+	if (avformat_open_input(context, url, 0, 0) < 0)
+		return -1;
+	return avformat_find_stream_info(*context, 0);
+}
+
+int demux_count_packets(const char *url)
+{
+	AVFormatContext *context = 0;
+	if (open_input(&context, url) < 0)
+		return -1;
+
+	AVPacket *packet = av_packet_alloc();
+	int packets = 0;
+	while (av_read_frame(context, packet) >= 0) {
+		packets++;
+		av_packet_unref(packet);
+	}
+	av_packet_free(&packet);
+	avformat_close_input(&context);
+	return packets;
+}
@@ -0,0 +1,33 @@
+#include <libavformat/avformat.h>
+
+/* same name as the static helper of input.c, opens the input a remux reads from */
+static int open_input(AVFormatContext **context, const char *url)
+{
+	return avformat_open_input(context, url, 0, 0);
+}
+
+static int write_packet(AVFormatContext *output, AVPacket *packet)
+{
+	return av_interleaved_write_frame(output, packet);
+}
+
+int demux_remux(const char *url, AVFormatContext *output)
+{
+	AVFormatContext *input = 0;
+	if (open_input(&input, url) < 0)
+		return -1;
+	if (avformat_write_header(output, 0) < 0) {
+		avformat_close_input(&input);
+		return -1;
+	}
+
+	AVPacket *packet = av_packet_alloc();
+	while (av_read_frame(input, packet) >= 0) {
+		write_packet(output, packet);
+		av_packet_unref(packet);
+	}
+	av_packet_free(&packet);
+	av_write_trailer(output);
+	avformat_close_input(&input);
+	return 0;
+}
@@ -0,0 +1,17 @@
+#include <libavformat/avformat.h>
+
+/* same name as the static helper of mux/stream.c */
+static int write_packet(AVIOContext *io, const unsigned char *data, int size)
+{
+	avio_write(io, data, size);
+	return size;
+}
+
+int mux_write_chunks(AVIOContext *io, const unsigned char *data, int chunks, int size)
+{
+	int written = 0;
+	for (int i = 0; i < chunks; i++)
+		written += write_packet(io, data + i * size, size);
+	avio_flush(io);
+	return written;
+}
@@ -0,0 +1,16 @@
+#include <libavformat/avformat.h>
+
+/* same name as the static helper of mux/file.c */
+static int write_packet(AVFormatContext *output, AVPacket *packet)
+{
+	int result = av_interleaved_write_frame(output, packet);
+	av_packet_unref(packet);
+	return result;
+}
+
+int mux_finish(AVFormatContext *output, AVPacket *last)
+{
+	if (last)
+		write_packet(output, last);
+	return av_write_trailer(output);
+}
@@ -0,0 +1,49 @@
+# Generates the interposer for shim_sample.c, runs the sample with it and checks the counts it reports.
+# Expects RUIANALYSIS, SAMPLE, SAMPLE_SOURCE, INCLUDE_DIR, C_COMPILER and WORK_DIR.
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+
+execute_process(COMMAND "${RUIANALYSIS}" --shim=ffmpeg_shim.c "${SAMPLE_SOURCE}" -- "-I${INCLUDE_DIR}"
+        WORKING_DIRECTORY "${WORK_DIR}" RESULT_VARIABLE result OUTPUT_QUIET)
+if (result)
+    message(FATAL_ERROR "RuiAnalysis --shim failed: ${result}")
+endif ()
+
+execute_process(COMMAND "${C_COMPILER}" -O2 -shared -fPIC "-I${INCLUDE_DIR}" -o ffmpeg_shim.so ffmpeg_shim.c -ldl
+        WORKING_DIRECTORY "${WORK_DIR}" RESULT_VARIABLE result)
+if (result)
+    message(FATAL_ERROR "Generated shim does not compile: ${result}")
+endif ()
+
+# Callers are reported as the executable path plus offset, a quote in it must be escaped in the report
+set(runDir "${WORK_DIR}/caller\"dir")
+file(COPY "${SAMPLE}" DESTINATION "${runDir}")
+get_filename_component(sampleName "${SAMPLE}" NAME)
+execute_process(COMMAND "${CMAKE_COMMAND}" -E env "RUIANALYSIS_SHIM_OUTPUT=${WORK_DIR}/shim.json"
+        "LD_PRELOAD=${WORK_DIR}/ffmpeg_shim.so" "${runDir}/${sampleName}"
+        RESULT_VARIABLE result)
+if (result)
+    message(FATAL_ERROR "Sample did not reach avcodec_send_packet through the shim: ${result}")
+endif ()
+
+file(READ "${WORK_DIR}/shim.json" report)
+string(JSON calls ERROR_VARIABLE error GET "${report}" avcodec_send_packet calls)
+if (error)
+    message(FATAL_ERROR "Invalid shim report: ${error}\n${report}")
+endif ()
+if (NOT calls EQUAL 4)
+    message(FATAL_ERROR "Expected 4 calls of avcodec_send_packet, got ${calls}\n${report}")
+endif ()
+
+string(JSON callerCount LENGTH "${report}" avcodec_send_packet callers)
+set(callerCalls 0)
+math(EXPR lastCaller "${callerCount} - 1")
+foreach (i RANGE ${lastCaller})
+    string(JSON caller MEMBER "${report}" avcodec_send_packet callers ${i})
+    string(JSON count GET "${report}" avcodec_send_packet callers "${caller}" calls)
+    math(EXPR callerCalls "${callerCalls} + ${count}")
+endforeach ()
+if (NOT callerCalls EQUAL 4)
+    message(FATAL_ERROR "Expected 4 calls over all callers, got ${callerCalls}\n${report}")
+endif ()
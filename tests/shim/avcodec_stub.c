@@ -0,0 +1,10 @@
+#include <libavcodec/avcodec.h>
+
+/* returns the number of calls so far, the sample checks the shim forwarded every call */
+int avcodec_send_packet(AVCodecContext *avctx, const AVPacket *avpkt)
+{
+	static int calls;
+	(void)avctx;
+	(void)avpkt;
+	return ++calls;
+}
@@ -0,0 +1,10 @@
+/* Minimal stand-in for the FFmpeg header, only what the shim test calls */
+#ifndef AVCODEC_AVCODEC_H
+#define AVCODEC_AVCODEC_H
+
+typedef struct AVCodecContext AVCodecContext;
+typedef struct AVPacket AVPacket;
+
+int avcodec_send_packet(AVCodecContext *avctx, const AVPacket *avpkt);
+
+#endif
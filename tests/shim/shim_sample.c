@@ -0,0 +1,16 @@
+#include <libavcodec/avcodec.h>
+
+static int send_packets(int count)
+{
+	int last = 0;
+	for (int i = 0; i < count; i++)
+		last = avcodec_send_packet(0, 0);
+	return last;
+}
+
+int main(void)
+{
+	if (send_packets(3) != 3)
+		return 1;
+	return avcodec_send_packet(0, 0) == 4 ? 0 : 1;
+}